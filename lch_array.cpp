@@ -0,0 +1,11 @@
+﻿#define LUA_LIB
+#include "lua_typed_array.h"
+
+extern "C"
+{
+	LUALIB_API int luaopen_lch_array(lua_State * L)
+	{
+		LuaCppHelper::LuaTypedArrayOpen(L);
+		return 1;
+	}
+}
@@ -0,0 +1,547 @@
+﻿#include "lua_helper.h"
+#include "lua_object.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+extern "C"
+{
+#include "lualib.h"
+}
+
+// every allocation of the process goes through here, lua's allocations through CountingAlloc below
+namespace
+{
+	std::atomic<size_t> g_allocs(0);
+	std::atomic<size_t> g_bytes(0);
+
+	void* Allocate(size_t size)
+	{
+		g_allocs.fetch_add(1, std::memory_order_relaxed);
+		g_bytes.fetch_add(size, std::memory_order_relaxed);
+		void* block = malloc(size > 0 ? size : 1);
+		if (block == nullptr)
+		{
+			throw std::bad_alloc();
+		}
+		return block;
+	}
+}
+
+void* operator new(size_t size) { return Allocate(size); }
+void* operator new[](size_t size) { return Allocate(size); }
+void operator delete(void* block) noexcept { free(block); }
+void operator delete[](void* block) noexcept { free(block); }
+void operator delete(void* block, size_t) noexcept { free(block); }
+void operator delete[](void* block, size_t) noexcept { free(block); }
+
+namespace
+{
+	using namespace LuaCppHelper;
+
+	void* CountingAlloc(void*, void* ptr, size_t osize, size_t nsize)
+	{
+		if (nsize == 0)
+		{
+			free(ptr);
+			return nullptr;
+		}
+		// a new block or a block that grows counts as an allocation
+		if (ptr == nullptr || nsize > osize)
+		{
+			g_allocs.fetch_add(1, std::memory_order_relaxed);
+			g_bytes.fetch_add(nsize, std::memory_order_relaxed);
+		}
+		return realloc(ptr, nsize);
+	}
+
+	// keep the compiler from discarding a benchmarked result
+	template <typename T>
+	void Keep(T& value)
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		asm volatile("" : : "r,m"(value) : "memory");
+#else
+		static volatile const void* sink;
+		sink = &value;
+#endif
+	}
+
+	struct BenchResult
+	{
+		std::string		name;
+		size_t			iterations;
+		double			nsPerOp;
+		double			allocsPerOp;
+		double			bytesPerOp;
+	};
+
+	struct BenchOptions
+	{
+		BenchOptions(void) : minTime(0.2), format("table") {}
+
+		double			minTime;	// seconds of the measured batch
+		std::string		format;		// table, json or csv
+		std::string		filter;		// run the benchmarks whose name contains it
+	};
+
+	class BenchRunner
+	{
+	public:
+		explicit BenchRunner(const BenchOptions& options) : _options(options) {}
+
+		/**
+		* Run func in batches of growing size until one batch lasts minTime, that batch is reported.
+		*/
+		void Run(const std::string& name, const std::function<void(size_t)>& func)
+		{
+			if (!_options.filter.empty() && name.find(_options.filter) == std::string::npos)
+			{
+				return;
+			}
+			func(1);	// warm up the caches and the lazily created state
+			size_t iterations = 1;
+			for (;;)
+			{
+				size_t allocs = g_allocs.load(std::memory_order_relaxed);
+				size_t bytes = g_bytes.load(std::memory_order_relaxed);
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				func(iterations);
+				double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				if (seconds >= _options.minTime || iterations >= ((size_t)1 << 40))
+				{
+					BenchResult result;
+					result.name = name;
+					result.iterations = iterations;
+					result.nsPerOp = seconds * 1e9 / iterations;
+					result.allocsPerOp = (double)(g_allocs.load(std::memory_order_relaxed) - allocs) / iterations;
+					result.bytesPerOp = (double)(g_bytes.load(std::memory_order_relaxed) - bytes) / iterations;
+					_results.push_back(result);
+					if (_options.format == "table")
+					{
+						printf("%-40s %12zu %12.1f ns/op %10.2f allocs/op %12.1f B/op\n", name.c_str(), iterations, result.nsPerOp, result.allocsPerOp, result.bytesPerOp);
+						fflush(stdout);
+					}
+					return;
+				}
+				// aim a bit past minTime so that the next batch is most likely the last one
+				double scale = seconds > 0 ? _options.minTime * 1.2 / seconds : 100.0;
+				iterations = (size_t)(iterations * (scale < 2.0 ? 2.0 : (scale > 100.0 ? 100.0 : scale)));
+			}
+		}
+
+		void Report(void) const
+		{
+			if (_options.format == "json")
+			{
+				printf("{\"benchmarks\":[");
+				for (size_t i = 0; i < _results.size(); ++i)
+				{
+					const BenchResult& result = _results[i];
+					printf("%s\n{\"name\":%s,\"iterations\":%zu,\"ns_per_op\":%.3f,\"allocs_per_op\":%.3f,\"bytes_per_op\":%.3f}",
+						i > 0 ? "," : "", JsonString(result.name).c_str(), result.iterations, result.nsPerOp, result.allocsPerOp, result.bytesPerOp);
+				}
+				printf("\n]}\n");
+			}
+			else if (_options.format == "csv")
+			{
+				printf("name,iterations,ns_per_op,allocs_per_op,bytes_per_op\n");
+				for (size_t i = 0; i < _results.size(); ++i)
+				{
+					const BenchResult& result = _results[i];
+					printf("%s,%zu,%.3f,%.3f,%.3f\n", CsvField(result.name).c_str(), result.iterations, result.nsPerOp, result.allocsPerOp, result.bytesPerOp);
+				}
+			}
+		}
+
+	private:
+		// names hold commas and quotes, like "Check/int,double,string"
+		static std::string CsvField(const std::string& value)
+		{
+			std::string field = "\"";
+			for (size_t i = 0; i < value.size(); ++i)
+			{
+				field += value[i];
+				if (value[i] == '"')
+				{
+					field += '"';
+				}
+			}
+			return field + "\"";
+		}
+
+		static std::string JsonString(const std::string& value)
+		{
+			std::string json = "\"";
+			for (size_t i = 0; i < value.size(); ++i)
+			{
+				unsigned char c = (unsigned char)value[i];
+				if (c == '"' || c == '\\')
+				{
+					json += '\\';
+					json += (char)c;
+				}
+				else if (c < 0x20)
+				{
+					char escaped[8];
+					snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+					json += escaped;
+				}
+				else
+				{
+					json += (char)c;
+				}
+			}
+			return json + "\"";
+		}
+
+		BenchOptions				_options;
+		std::vector<BenchResult>	_results;
+	};
+
+	// the table shapes, every generator is deterministic so that runs compare
+	LuaTable MakeSmall(void)
+	{
+		LuaTable table;
+		table.Set("id", LuaValue::IntValue(42));
+		table.Set("name", LuaValue::StringValue("player"));
+		table.Set("hp", LuaValue::NumberValue(97.5));
+		table.Set("alive", LuaValue::BooleanValue(true));
+		return table;
+	}
+
+	LuaTable MakeDense(size_t size)
+	{
+		LuaTable table;
+		table.Reserve(size, 0);
+		for (size_t i = 0; i < size; ++i)
+		{
+			table.Append(LuaValue::IntValue((long long)(i * 3)));
+		}
+		return table;
+	}
+
+	LuaTable MakeSparse(size_t size)
+	{
+		LuaTable table;
+		table.Reserve(0, size);
+		for (size_t i = 0; i < size; ++i)
+		{
+			table.Set((long long)(i * 7919 + 1000000), LuaValue::NumberValue(i * 0.5));
+		}
+		return table;
+	}
+
+	LuaTable MakeHash(size_t size)
+	{
+		LuaTable table;
+		table.Reserve(0, size);
+		for (size_t i = 0; i < size; ++i)
+		{
+			table.Set("field_" + std::to_string(i), LuaValue::IntValue((long long)i));
+		}
+		return table;
+	}
+
+	LuaTable MakeNested(int depth, int fanout)
+	{
+		LuaTable table = MakeSmall();
+		if (depth > 0)
+		{
+			for (int i = 0; i < fanout; ++i)
+			{
+				table.Append(LuaValue::TableValue(MakeNested(depth - 1, fanout)));
+			}
+		}
+		return table;
+	}
+
+	struct BenchObject
+	{
+		int		id;
+	};
+
+	int Add(lua_State* L)
+	{
+		lua_pushinteger(L, luaL_checkinteger(L, 1) + luaL_checkinteger(L, 2));
+		return 1;
+	}
+
+	void RunCheck(BenchRunner& runner, lua_State* L)
+	{
+		lua_settop(L, 0);
+		lua_pushinteger(L, 123456789);
+		runner.Run("Check/int", [L](size_t n) {
+			for (size_t i = 0; i < n; ++i) { int v = 0; LuaHelper::Check(L, v); Keep(v); }
+		});
+		runner.Run("Check/long long", [L](size_t n) {
+			for (size_t i = 0; i < n; ++i) { long long v = 0; LuaHelper::Check(L, v); Keep(v); }
+		});
+		lua_settop(L, 0);
+		lua_pushnumber(L, 3.25);
+		runner.Run("Check/double", [L](size_t n) {
+			for (size_t i = 0; i < n; ++i) { double v = 0; LuaHelper::Check(L, v); Keep(v); }
+		});
+		runner.Run("Check/float", [L](size_t n) {
+			for (size_t i = 0; i < n; ++i) { float v = 0; LuaHelper::Check(L, v); Keep(v); }
+		});
+		lua_settop(L, 0);
+		lua_pushboolean(L, 1);
+		runner.Run("Check/bool", [L](size_t n) {
+			for (size_t i = 0; i < n; ++i) { bool v = false; LuaHelper::Check(L, v); Keep(v); }
+		});
+		const char* lengths[] = { "short", "a string well beyond the small string buffer of std::string" };
+		for (size_t s = 0; s < 2; ++s)
+		{
+			std::string suffix = s == 0 ? "/short" : "/long";
+			lua_settop(L, 0);
+			lua_pushstring(L, lengths[s]);
+			runner.Run("Check/const char*" + suffix, [L](size_t n) {
+				for (size_t i = 0; i < n; ++i) { const char* v = nullptr; LuaHelper::Check(L, v); Keep(v); }
+			});
+			runner.Run("Check/std::string_view" + suffix, [L](size_t n) {
+				for (size_t i = 0; i < n; ++i) { std::string_view v; LuaHelper::Check(L, v); Keep(v); }
+			});
+			runner.Run("Check/std::string" + suffix, [L](size_t n) {
+				for (size_t i = 0; i < n; ++i) { std::string v; LuaHelper::Check(L, v); Keep(v); }
+			});
+			runner.Run("Check/LuaValue string" + suffix, [L](size_t n) {
+				for (size_t i = 0; i < n; ++i) { LuaValue v; LuaHelper::Check(L, v); Keep(v); }
+			});
+		}
+		lua_settop(L, 0);
+		lua_pushinteger(L, 1);
+		lua_pushnumber(L, 2.5);
+		lua_pushstring(L, "three");
+		runner.Run("Check/int,double,string", [L](size_t n) {
+			for (size_t i = 0; i < n; ++i) { int a = 0; double b = 0; std::string c; LuaHelper::Check(L, a, b, c); Keep(a); Keep(b); Keep(c); }
+		});
+		lua_settop(L, 0);
+	}
+
+	void RunTables(BenchRunner& runner, lua_State* L)
+	{
+		struct Shape
+		{
+			std::string	name;
+			LuaTable	table;
+		};
+		std::vector<Shape> shapes;
+		shapes.push_back(Shape{ "small", MakeSmall() });
+		shapes.push_back(Shape{ "dense16", MakeDense(16) });
+		shapes.push_back(Shape{ "dense1024", MakeDense(1024) });
+		shapes.push_back(Shape{ "sparse1024", MakeSparse(1024) });
+		shapes.push_back(Shape{ "hash16", MakeHash(16) });
+		shapes.push_back(Shape{ "hash1024", MakeHash(1024) });
+		shapes.push_back(Shape{ "nested4x4", MakeNested(4, 4) });
+		for (size_t s = 0; s < shapes.size(); ++s)
+		{
+			const LuaTable& table = shapes[s].table;
+			runner.Run("PushLuaTable/" + shapes[s].name, [L, &table](size_t n) {
+				for (size_t i = 0; i < n; ++i) { LuaHelper::PushLuaTable(L, table); lua_pop(L, 1); }
+			});
+			LuaKeyCache cache(L);
+			runner.Run("PushLuaTable/" + shapes[s].name + "/keycache", [L, &table, &cache](size_t n) {
+				for (size_t i = 0; i < n; ++i) { LuaHelper::PushLuaTable(L, table, cache); lua_pop(L, 1); }
+			});
+			LuaHelper::PushLuaTable(L, table);
+			runner.Run("CheckLuaTable/" + shapes[s].name, [L](size_t n) {
+				for (size_t i = 0; i < n; ++i) { LuaTable v; LuaHelper::CheckLuaTable(L, -1, v); Keep(v); }
+			});
+			LuaArena arena(64 * 1024);
+			runner.Run("CheckLuaTable/" + shapes[s].name + "/arena", [L, &arena](size_t n) {
+				for (size_t i = 0; i < n; ++i)
+				{
+					{
+						LuaTable v(&arena);
+						LuaHelper::CheckLuaTable(L, -1, v, arena);
+						Keep(v);
+					}
+					arena.Reset();
+				}
+			});
+			lua_pop(L, 1);
+		}
+	}
+
+	// the same shapes decoded straight into STL containers, to compare with CheckLuaTable/PushLuaTable
+	void RunContainers(BenchRunner& runner, lua_State* L)
+	{
+		const size_t sizes[] = { 16, 1024 };
+		for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+		{
+			std::string suffix = "/dense" + std::to_string(sizes[s]);
+			std::vector<long long> vector(sizes[s]);
+			for (size_t i = 0; i < vector.size(); ++i)
+			{
+				vector[i] = (long long)(i * 3);
+			}
+			runner.Run("Push std::vector<long long>" + suffix, [L, &vector](size_t n) {
+				for (size_t i = 0; i < n; ++i) { LuaHelper::Result(L, vector); lua_pop(L, 1); }
+			});
+			LuaHelper::Result(L, vector);
+			runner.Run("Check std::vector<long long>" + suffix, [L](size_t n) {
+				for (size_t i = 0; i < n; ++i) { std::vector<long long> v = LuaHelper::CheckArgument<std::vector<long long> >(L, lua_gettop(L)); Keep(v); }
+			});
+			lua_pop(L, 1);
+
+			suffix = "/hash" + std::to_string(sizes[s]);
+			std::unordered_map<std::string, long long> map;
+			for (size_t i = 0; i < sizes[s]; ++i)
+			{
+				map["field_" + std::to_string(i)] = (long long)i;
+			}
+			runner.Run("Push std::unordered_map<std::string, long long>" + suffix, [L, &map](size_t n) {
+				for (size_t i = 0; i < n; ++i) { LuaHelper::Result(L, map); lua_pop(L, 1); }
+			});
+			LuaHelper::Result(L, map);
+			runner.Run("Check std::unordered_map<std::string, long long>" + suffix, [L](size_t n) {
+				for (size_t i = 0; i < n; ++i)
+				{
+					std::unordered_map<std::string, long long> v = LuaHelper::CheckArgument<std::unordered_map<std::string, long long> >(L, lua_gettop(L));
+					Keep(v);
+				}
+			});
+			lua_pop(L, 1);
+		}
+	}
+
+	void RunValues(BenchRunner& runner)
+	{
+		struct Sample
+		{
+			std::string	name;
+			LuaValue	value;
+		};
+		std::vector<Sample> samples;
+		samples.push_back(Sample{ "int", LuaValue::IntValue(7) });
+		samples.push_back(Sample{ "double", LuaValue::NumberValue(7.5) });
+		samples.push_back(Sample{ "inline string", LuaValue::StringValue("inline") });
+		samples.push_back(Sample{ "heap string", LuaValue::StringValue(std::string(100, 'x')) });
+		samples.push_back(Sample{ "small table", LuaValue::TableValue(MakeSmall()) });
+		samples.push_back(Sample{ "dense1024 table", LuaValue::TableValue(MakeDense(1024)) });
+		for (size_t s = 0; s < samples.size(); ++s)
+		{
+			const LuaValue& value = samples[s].value;
+			runner.Run("LuaValue copy/" + samples[s].name, [&value](size_t n) {
+				for (size_t i = 0; i < n; ++i) { LuaValue copy(value); Keep(copy); }
+			});
+			LuaValue target;
+			runner.Run("LuaValue assign/" + samples[s].name, [&value, &target](size_t n) {
+				for (size_t i = 0; i < n; ++i) { target = value; Keep(target); }
+			});
+			runner.Run("LuaValue move/" + samples[s].name, [&value](size_t n) {
+				LuaValue source(value);
+				for (size_t i = 0; i < n; ++i) { LuaValue moved(std::move(source)); source = std::move(moved); Keep(source); }
+			});
+		}
+	}
+
+	void RunObjects(BenchRunner& runner, lua_State* L)
+	{
+		static BenchObject object = { 1 };
+		luaL_newmetatable(L, "BenchObject");
+		lua_pop(L, 1);
+		LuaObject named(&object, "BenchObject");
+		LuaObject anonymous(&object, std::string());
+		runner.Run("PushLuaObject/anonymous", [L, &anonymous](size_t n) {
+			for (size_t i = 0; i < n; ++i) { LuaHelper::PushLuaObject(L, anonymous); lua_pop(L, 1); }
+		});
+		runner.Run("PushLuaObject/named", [L, &named](size_t n) {
+			for (size_t i = 0; i < n; ++i) { LuaHelper::PushLuaObject(L, named); lua_pop(L, 1); }
+		});
+		LuaHelper::PushLuaObject(L, named);
+		runner.Run("CheckLuaObject/named", [L](size_t n) {
+			for (size_t i = 0; i < n; ++i) { LuaObject v(nullptr, "BenchObject"); LuaHelper::CheckLuaObject(L, -1, v); Keep(v); }
+		});
+		lua_pop(L, 1);
+		LuaObjectType<BenchObject>::Register(L, "BenchObject");
+		runner.Run("LuaObjectType::Push", [L](size_t n) {
+			for (size_t i = 0; i < n; ++i) { LuaObjectType<BenchObject>::Push(L, &object); lua_pop(L, 1); }
+		});
+		LuaObjectType<BenchObject>::Push(L, &object);
+		runner.Run("LuaObjectType::Check", [L](size_t n) {
+			for (size_t i = 0; i < n; ++i) { BenchObject* v = LuaObjectType<BenchObject>::Check(L, -1); Keep(v); }
+		});
+		lua_pop(L, 1);
+	}
+
+	void RunCalls(BenchRunner& runner, lua_State* L)
+	{
+		luaL_dostring(L, "return function(a, b) return a + b end");
+		LuaFunction func = luaL_ref(L, LUA_REGISTRYINDEX);
+		runner.Run("CallFunction/lua 2 args", [L, func](size_t n) {
+			for (size_t i = 0; i < n; ++i)
+			{
+				lua_pushinteger(L, (lua_Integer)i);
+				lua_pushinteger(L, 2);
+				LuaHelper::CallFunction(L, func, 2);
+			}
+		});
+		runner.Run("Call<long long>/lua 2 args", [L, func](size_t n) {
+			for (size_t i = 0; i < n; ++i) { long long v = LuaHelper::Call<long long>(L, func, (long long)i, 2LL); Keep(v); }
+		});
+		lua_pushcfunction(L, &Add);
+		LuaFunction cfunc = luaL_ref(L, LUA_REGISTRYINDEX);
+		runner.Run("Call<long long>/C 2 args", [L, cfunc](size_t n) {
+			for (size_t i = 0; i < n; ++i) { long long v = LuaHelper::Call<long long>(L, cfunc, (long long)i, 2LL); Keep(v); }
+		});
+		luaL_unref(L, LUA_REGISTRYINDEX, cfunc);
+		luaL_unref(L, LUA_REGISTRYINDEX, func);
+	}
+
+	void Usage(const char* program)
+	{
+		fprintf(stderr, "usage: %s [--format=table|json|csv] [--filter=TEXT] [--min-time=SECONDS]\n", program);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	BenchOptions options;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strncmp(argv[i], "--format=", 9) == 0)
+		{
+			options.format = argv[i] + 9;
+		}
+		else if (strncmp(argv[i], "--filter=", 9) == 0)
+		{
+			options.filter = argv[i] + 9;
+		}
+		else if (strncmp(argv[i], "--min-time=", 11) == 0)
+		{
+			options.minTime = atof(argv[i] + 11);
+		}
+		else
+		{
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+	if (options.format != "table" && options.format != "json" && options.format != "csv")
+	{
+		Usage(argv[0]);
+		return 1;
+	}
+
+	lua_State* L = lua_newstate(&CountingAlloc, nullptr);
+	luaL_openlibs(L);
+	// start every run from the same collected heap
+	lua_gc(L, LUA_GCCOLLECT, 0);
+	BenchRunner runner(options);
+	RunCheck(runner, L);
+	RunTables(runner, L);
+	RunContainers(runner, L);
+	RunValues(runner);
+	RunObjects(runner, L);
+	RunCalls(runner, L);
+	runner.Report();
+	lua_close(L);
+	return 0;
+}
@@ -1,5 +1,8 @@
 ﻿#define LUA_LIB
-#include "lua_helper.h"
+#include "lua_bind.h"
+#include "lua_json.h"
+#include "lua_serialize.h"
+#include "lua_stats.h"
 #include <iostream>
 
 namespace 
@@ -12,6 +15,74 @@ namespace
 		std::cout << msg << std::endl;
 		return LuaHelper::result(L);
 	}
+
+	long long LchAdd(long long a, long long b)
+	{
+		return a + b;
+	}
+
+	// write a value in the binary format and read it back, nil if either side fails
+	LuaValue LchSerializeRoundTrip(const LuaValue& value)
+	{
+		LuaBinaryWriter writer;
+		LuaSerializer serializer(writer);
+		LuaValue copy;
+		if (serializer.Write(value))
+		{
+			LuaDeserializer deserializer(writer.Data(), writer.Size());
+			deserializer.Read(copy);
+		}
+		return copy;
+	}
+
+	int LchJsonDecode(lua_State * L)
+	{
+		size_t size = 0;
+		const char * data = luaL_checklstring(L, 1, &size);
+		{
+			std::string error;
+			if (LuaJson::Push(L, data, size, &error))
+			{
+				return 1;
+			}
+			lua_pushlstring(L, error.c_str(), error.size());
+		}
+		// raised once error is destroyed
+		return lua_error(L);
+	}
+
+	int LchJsonEncode(lua_State * L)
+	{
+		luaL_checkany(L, 1);
+		{
+			std::string out;
+			std::string error;
+			if (LuaJson::Encode(L, 1, out, &error))
+			{
+				lua_pushlstring(L, out.c_str(), out.size());
+				return 1;
+			}
+			lua_pushlstring(L, error.c_str(), error.size());
+		}
+		return lua_error(L);
+	}
+
+	// erase the keys listed in the array part of keys from a LuaTable copy of table
+	LuaTable LchTableErase(LuaTable table, const LuaTable& keys)
+	{
+		for (LuaTableArrayIterator it = keys.ArrayBegin(); it != keys.ArrayEnd(); ++it)
+		{
+			if (it->getType() == LuaValueTypeInt)
+			{
+				table.Erase(it->IntValue());
+			}
+			else if (it->getType() == LuaValueTypeString)
+			{
+				table.Erase(std::string(it->StringValue()));
+			}
+		}
+		return table;
+	}
 }
 
 extern "C"
@@ -21,9 +92,16 @@ extern "C"
 		static const luaL_Reg lch_example_functions[] =
 		{
 			{ "print", LchPrint },
+			{ "add", LuaBinder::Function<&LchAdd> },
+			{ "stats", LuaStats::LuaSnapshot },
+			{ "serialize_roundtrip", LuaBinder::Function<&LchSerializeRoundTrip> },
+			{ "json_decode", LchJsonDecode },
+			{ "json_encode", LchJsonEncode },
+			{ "table_erase", LuaBinder::Function<&LchTableErase> },
 			{ NULL, NULL }
 		};
 		luaL_newlib(L, lch_example_functions);
+		LuaStats::Instrument(L, -1, "lch_example");
 		return 1;
 	}
 }
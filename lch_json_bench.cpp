@@ -0,0 +1,118 @@
+﻿#include "lua_json.h"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace
+{
+	using namespace LuaCppHelper;
+
+	// a corpus shaped like typical game data: records with nested arrays, floats and escaped strings
+	std::string MakeCorpus(size_t records)
+	{
+		std::ostringstream out;
+		out << "[";
+		for (size_t i = 0; i < records; ++i)
+		{
+			if (i > 0)
+			{
+				out << ",";
+			}
+			out << "{\"id\":" << i
+				<< ",\"name\":\"player_" << i << "\",\"title\":\"the \\\"quoted\\\" one\\n\""
+				<< ",\"level\":" << (i % 100)
+				<< ",\"position\":[" << (i * 0.25) << "," << (i * -1.5) << "," << (i % 7) * 3.125 << "]"
+				<< ",\"online\":" << (i % 2 ? "true" : "false")
+				<< ",\"guild\":null"
+				<< ",\"inventory\":[";
+			for (size_t j = 0; j < 8; ++j)
+			{
+				out << (j > 0 ? "," : "") << "{\"item\":" << (i * 8 + j) << ",\"count\":" << j + 1 << "}";
+			}
+			out << "],\"description\":\"Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor\"}";
+		}
+		out << "]";
+		return out.str();
+	}
+
+	template <typename FUNC>
+	void Measure(const char* name, size_t bytes, int iterations, FUNC func)
+	{
+		func();	// warm up
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; ++i)
+		{
+			func();
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		double mbps = (double)bytes * iterations / (1024.0 * 1024.0) / seconds;
+		printf("%-24s %10.1f MB/s %10.3f ms/iter\n", name, mbps, seconds * 1000.0 / iterations);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	std::string corpus;
+	if (argc > 1)
+	{
+		std::ifstream file(argv[1], std::ios::binary);
+		if (!file)
+		{
+			std::cerr << "can't open " << argv[1] << std::endl;
+			return 1;
+		}
+		std::ostringstream content;
+		content << file.rdbuf();
+		corpus = content.str();
+	}
+	else
+	{
+		corpus = MakeCorpus(20000);
+	}
+	int iterations = argc > 2 ? atoi(argv[2]) : 10;
+	printf("corpus: %zu bytes, %d iterations\n", corpus.size(), iterations);
+
+	LuaValue value;
+	std::string error;
+	if (!LuaJson::Decode(corpus.data(), corpus.size(), value, nullptr, &error))
+	{
+		std::cerr << "invalid JSON: " << error << std::endl;
+		return 1;
+	}
+	std::string encoded;
+	LuaJson::Encode(value, encoded);
+
+	Measure("decode LuaValue", corpus.size(), iterations, [&]() {
+		LuaValue decoded;
+		LuaJson::Decode(corpus.data(), corpus.size(), decoded);
+	});
+	LuaArena arena(1024 * 1024);
+	Measure("decode LuaValue arena", corpus.size(), iterations, [&]() {
+		{
+			LuaValue decoded;
+			LuaJson::Decode(corpus.data(), corpus.size(), decoded, &arena);
+		}
+		arena.Reset();
+	});
+	Measure("encode LuaValue", encoded.size(), iterations, [&]() {
+		std::string out;
+		out.reserve(encoded.size());
+		LuaJson::Encode(value, out);
+	});
+
+	lua_State* L = luaL_newstate();
+	Measure("decode lua stack", corpus.size(), iterations, [&]() {
+		LuaJson::Push(L, corpus.data(), corpus.size());
+		lua_pop(L, 1);
+	});
+	LuaJson::Push(L, corpus.data(), corpus.size());
+	Measure("encode lua stack", encoded.size(), iterations, [&]() {
+		std::string out;
+		out.reserve(encoded.size());
+		LuaJson::Encode(L, -1, out);
+	});
+	lua_close(L);
+	return 0;
+}
@@ -1,3 +1,54 @@
 local lch = require("lch_example")
 
 lch.print("12345")
+
+lch.print(tostring(lch.add(1, 2)))
+local lch_timer = require("lch_timer")
+local wheel = lch_timer.new()
+wheel:add(3, lch.print, "timer fired")
+wheel:advance(3)
+local lch_array = require("lch_array")
+local samples = lch_array.float64({ 1, 2, 3, 4 })
+samples:slice(3):mul(10)
+lch.print(tostring(#samples) .. " " .. tostring(samples:sum()) .. " " .. tostring(samples:max()))
+
+local function same(a, b)
+	if type(a) ~= "table" or type(b) ~= "table" then
+		return a == b
+	end
+	for k, v in pairs(a) do
+		if not same(v, b[k]) then
+			return false
+		end
+	end
+	for k in pairs(b) do
+		if a[k] == nil then
+			return false
+		end
+	end
+	return true
+end
+
+local value = { 1, 2.5, "three", true, nested = { x = 1, y = { "deep", -7 } }, [100] = "sparse", packed = { 1, 2, 3 }, floats = { 0.5, 1.5 } }
+assert(same(lch.serialize_roundtrip(value), value), "serialize round trip")
+
+local json = '{"a":[1,2,3],"b":{"c":"d","e":[true,false]},"f":1.5,"g":-12,"h":"esc\\"aped\\n"}'
+local decoded = lch.json_decode(json)
+assert(decoded.b.c == "d" and decoded.a[3] == 3 and decoded.h == "esc\"aped\n", "json decode")
+assert(same(lch.json_decode(lch.json_encode(decoded)), decoded), "json round trip")
+
+local big = {}
+for i = 1, 50 do
+	big[i] = i
+	big["k" .. i] = i * 2
+end
+local keys = { 25 }
+for i = 1, 50, 2 do
+	keys[#keys + 1] = "k" .. i
+end
+local erased = lch.table_erase(big, keys)
+for i = 1, 50 do
+	assert(erased[i] == (i ~= 25 and i or nil), "table erase array part")
+	assert(erased["k" .. i] == (i % 2 == 0 and i * 2 or nil), "table erase hash part")
+end
+lch.print("round trips ok")
@@ -0,0 +1,104 @@
+﻿#define LUA_LIB
+#include "lua_object.h"
+#include "lua_timer.h"
+
+namespace
+{
+	using namespace LuaCppHelper;
+
+	// wheel:add(delay, func, ...) and wheel:every(interval, func, ...), the extra arguments are bound to the callback
+	int AddTimer(lua_State * L, bool repeat)
+	{
+		LuaTimerWheel* wheel = LuaClass<LuaTimerWheel>::Check(L, 1);
+		lua_Integer ticks = luaL_checkinteger(L, 2);
+		luaL_argcheck(L, repeat ? ticks > 0 : ticks >= 0, 2, "invalid tick count");
+		luaL_checktype(L, 3, LUA_TFUNCTION);
+		int top = lua_gettop(L);
+		std::vector<LuaValue> args(top > 3 ? top - 3 : 0);
+		for (int i = 4; i <= top; ++i)
+		{
+			LuaHelper::CheckLuaValue(L, i, args[i - 4]);
+		}
+		lua_pushvalue(L, 3);
+		LuaFunction func = luaL_ref(L, LUA_REGISTRYINDEX);
+		LuaTimerId id = wheel->Add((unsigned long long)ticks, func, std::move(args), repeat ? (unsigned long long)ticks : 0);
+		lua_pushinteger(L, (lua_Integer)id);
+		return 1;
+	}
+
+	int TimerNew(lua_State * L)
+	{
+		LuaClass<LuaTimerWheel>::New(L, L);
+		return 1;
+	}
+
+	int TimerAdd(lua_State * L)
+	{
+		return AddTimer(L, false);
+	}
+
+	int TimerEvery(lua_State * L)
+	{
+		return AddTimer(L, true);
+	}
+
+	int TimerCancel(lua_State * L)
+	{
+		LuaTimerWheel* wheel = LuaClass<LuaTimerWheel>::Check(L, 1);
+		lua_pushboolean(L, wheel->Cancel((LuaTimerId)luaL_checkinteger(L, 2)));
+		return 1;
+	}
+
+	int TimerPending(lua_State * L)
+	{
+		LuaTimerWheel* wheel = LuaClass<LuaTimerWheel>::Check(L, 1);
+		lua_pushboolean(L, wheel->IsPending((LuaTimerId)luaL_checkinteger(L, 2)));
+		return 1;
+	}
+
+	// wheel:advance(ticks) returns the count of called callbacks and the count of errors
+	int TimerAdvance(lua_State * L)
+	{
+		LuaTimerWheel* wheel = LuaClass<LuaTimerWheel>::Check(L, 1);
+		lua_Integer ticks = luaL_checkinteger(L, 2);
+		luaL_argcheck(L, ticks >= 0, 2, "invalid tick count");
+		LuaDispatchStats stats = wheel->Advance((unsigned long long)ticks, L);
+		return LuaHelper::Result(L, (long long)stats.calls, (long long)stats.errors);
+	}
+
+	int TimerNow(lua_State * L)
+	{
+		return LuaHelper::Result(L, (long long)LuaClass<LuaTimerWheel>::Check(L, 1)->Now());
+	}
+
+	int TimerCount(lua_State * L)
+	{
+		return LuaHelper::Result(L, (long long)LuaClass<LuaTimerWheel>::Check(L, 1)->Count());
+	}
+}
+
+extern "C"
+{
+	LUALIB_API int luaopen_lch_timer(lua_State * L)
+	{
+		static const luaL_Reg lch_timer_methods[] =
+		{
+			{ "add", TimerAdd },
+			{ "every", TimerEvery },
+			{ "cancel", TimerCancel },
+			{ "pending", TimerPending },
+			{ "advance", TimerAdvance },
+			{ "now", TimerNow },
+			{ "count", TimerCount },
+			{ NULL, NULL }
+		};
+		static const luaL_Reg lch_timer_functions[] =
+		{
+			{ "new", TimerNew },
+			{ NULL, NULL }
+		};
+		LuaClass<LuaTimerWheel>::Register(L, "LuaTimerWheel", lch_timer_methods);
+		luaL_newlib(L, lch_timer_functions);
+		return 1;
+	}
+}
@@ -0,0 +1,278 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "lua_allocator.h"
+
+namespace LuaCppHelper
+{
+
+	namespace
+	{
+		// 16 byte steps up to 128, then wider steps, every size keeps the 16 byte alignment of malloc
+		const size_t ClassSizes[LuaAllocatorClassCount] = { 16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512 };
+
+		// the class of each size rounded up to 16 bytes, indexed by (size + 15) / 16
+		struct ClassTable
+		{
+			ClassTable(void)
+			{
+				int sizeClass = 0;
+				for (size_t i = 0; i <= LuaAllocatorMaxSmall / 16; ++i)
+				{
+					while (ClassSizes[sizeClass] < i * 16)
+					{
+						++sizeClass;
+					}
+					classes[i] = (unsigned char)sizeClass;
+				}
+			}
+
+			unsigned char classes[LuaAllocatorMaxSmall / 16 + 1];
+		};
+
+		const ClassTable Table;
+
+		int Panic(lua_State* L)
+		{
+			fprintf(stderr, "PANIC: unprotected error in call to Lua API (%s)\n", lua_tostring(L, -1));
+			fflush(stderr);
+			return 0;
+		}
+	}
+
+	LuaAllocator::LuaAllocator(size_t budget, size_t chunkSize)
+		: _chunkSize(chunkSize > LuaAllocatorMaxSmall * 4 ? chunkSize : LuaAllocatorMaxSmall * 4)
+		, _budget(budget)
+		, _live(0)
+		, _peak(0)
+		, _reserved(0)
+		, _failures(0)
+	{
+		for (int i = 0; i < LuaAllocatorClassCount; ++i)
+		{
+			_classes[i].head = nullptr;
+			_classes[i].stats.size = ClassSizes[i];
+			_classes[i].stats.live = 0;
+			_classes[i].stats.free = 0;
+			_classes[i].stats.allocs = 0;
+		}
+	}
+
+	LuaAllocator::~LuaAllocator(void)
+	{
+		for (size_t i = 0; i < _chunks.size(); ++i)
+		{
+			free(_chunks[i]);
+		}
+	}
+
+	lua_State * LuaAllocator::NewState(void)
+	{
+		lua_State* L = lua_newstate(&LuaAllocator::Alloc, this);
+		if (L != nullptr)
+		{
+			lua_atpanic(L, &Panic);
+		}
+		return L;
+	}
+
+	void * LuaAllocator::Alloc(void * ud, void * ptr, size_t osize, size_t nsize)
+	{
+		LuaAllocator& allocator = *static_cast<LuaAllocator*>(ud);
+		if (ptr == nullptr)
+		{
+			// osize is the type of the new object then
+			osize = 0;
+		}
+		if (nsize == 0)
+		{
+			if (ptr != nullptr)
+			{
+				allocator.Free(ptr, osize);
+				allocator._live -= osize;
+			}
+			return nullptr;
+		}
+		if (nsize > osize && allocator._budget != 0 && allocator._live - osize + nsize > allocator._budget)
+		{
+			++allocator._failures;
+			return nullptr;
+		}
+		void* block;
+		int oldClass = ptr != nullptr ? ClassOf(osize) : -1;
+		int newClass = ClassOf(nsize);
+		if (ptr != nullptr && oldClass == newClass && newClass >= 0)
+		{
+			block = ptr;
+		}
+		else if (ptr != nullptr && oldClass < 0 && newClass < 0)
+		{
+			block = realloc(ptr, nsize);
+			if (block == nullptr)
+			{
+				++allocator._failures;
+				return nullptr;
+			}
+			allocator._reserved = allocator._reserved - osize + nsize;
+		}
+		else
+		{
+			block = allocator.Allocate(nsize);
+			if (block == nullptr)
+			{
+				++allocator._failures;
+				if (nsize > osize)
+				{
+					return nullptr;
+				}
+				// lua expects a shrink to succeed, the old block is big enough
+				block = ptr;
+			}
+			else if (ptr != nullptr)
+			{
+				memcpy(block, ptr, osize < nsize ? osize : nsize);
+				allocator.Free(ptr, osize);
+			}
+		}
+		allocator._live = allocator._live - osize + nsize;
+		if (allocator._live > allocator._peak)
+		{
+			allocator._peak = allocator._live;
+		}
+		return block;
+	}
+
+	LuaAllocator * LuaAllocator::Get(lua_State * L)
+	{
+		void* ud = nullptr;
+		lua_Alloc alloc = lua_getallocf(L, &ud);
+		return alloc == &LuaAllocator::Alloc ? static_cast<LuaAllocator*>(ud) : nullptr;
+	}
+
+	int LuaAllocator::LuaMemory(lua_State * L)
+	{
+		LuaAllocator* allocator = Get(L);
+		if (allocator == nullptr)
+		{
+			return luaL_error(L, "the lua_State doesn't use a LuaAllocator");
+		}
+		// read the counters before the result tables change them
+		size_t live = allocator->LiveBytes();
+		size_t peak = allocator->PeakBytes();
+		size_t reserved = allocator->ReservedBytes();
+		size_t failures = allocator->FailureCount();
+		LuaAllocatorClassStats classes[LuaAllocatorClassCount];
+		for (int i = 0; i < LuaAllocatorClassCount; ++i)
+		{
+			classes[i] = allocator->ClassStats(i);
+		}
+		lua_createtable(L, 0, 6);												/* L: memory */
+		lua_pushinteger(L, (lua_Integer)live);
+		lua_setfield(L, -2, "live");
+		lua_pushinteger(L, (lua_Integer)peak);
+		lua_setfield(L, -2, "peak");
+		lua_pushinteger(L, (lua_Integer)allocator->Budget());
+		lua_setfield(L, -2, "budget");
+		lua_pushinteger(L, (lua_Integer)reserved);
+		lua_setfield(L, -2, "reserved");
+		lua_pushinteger(L, (lua_Integer)failures);
+		lua_setfield(L, -2, "failures");
+		lua_createtable(L, LuaAllocatorClassCount, 0);							/* L: memory, classes */
+		for (int i = 0; i < LuaAllocatorClassCount; ++i)
+		{
+			lua_createtable(L, 0, 4);											/* L: memory, classes, class */
+			lua_pushinteger(L, (lua_Integer)classes[i].size);
+			lua_setfield(L, -2, "size");
+			lua_pushinteger(L, (lua_Integer)classes[i].live);
+			lua_setfield(L, -2, "live");
+			lua_pushinteger(L, (lua_Integer)classes[i].free);
+			lua_setfield(L, -2, "free");
+			lua_pushinteger(L, (lua_Integer)classes[i].allocs);
+			lua_setfield(L, -2, "allocs");
+			lua_rawseti(L, -2, i + 1);											/* L: memory, classes */
+		}
+		lua_setfield(L, -2, "classes");											/* L: memory */
+		return 1;
+	}
+
+	int LuaAllocator::ClassOf(size_t size)
+	{
+		return size <= LuaAllocatorMaxSmall ? Table.classes[(size + 15) / 16] : -1;
+	}
+
+	void * LuaAllocator::Allocate(size_t size)
+	{
+		int index = ClassOf(size);
+		if (index < 0)
+		{
+			void* block = malloc(size);
+			if (block != nullptr)
+			{
+				_reserved += size;
+			}
+			return block;
+		}
+		SizeClass& sizeClass = _classes[index];
+		if (sizeClass.head == nullptr && !Refill(sizeClass))
+		{
+			return nullptr;
+		}
+		FreeBlock* block = sizeClass.head;
+		sizeClass.head = block->next;
+		--sizeClass.stats.free;
+		++sizeClass.stats.live;
+		++sizeClass.stats.allocs;
+		return block;
+	}
+
+	void LuaAllocator::Free(void * ptr, size_t size)
+	{
+		int index = ClassOf(size);
+		if (index < 0)
+		{
+			free(ptr);
+			_reserved -= size;
+			return;
+		}
+		SizeClass& sizeClass = _classes[index];
+		FreeBlock* block = static_cast<FreeBlock*>(ptr);
+		block->next = sizeClass.head;
+		sizeClass.head = block;
+		++sizeClass.stats.free;
+		--sizeClass.stats.live;
+	}
+
+	bool LuaAllocator::Refill(SizeClass & sizeClass)
+	{
+		char* chunk = static_cast<char*>(malloc(_chunkSize));
+		if (chunk == nullptr)
+		{
+			return false;
+		}
+		try
+		{
+			_chunks.push_back(chunk);
+		}
+		catch (...)
+		{
+			// lua_Alloc runs under C code, nothing may be thrown through it
+			free(chunk);
+			return false;
+		}
+		_reserved += _chunkSize;
+		size_t size = sizeClass.stats.size;
+		size_t count = _chunkSize / size;
+		// thread the blocks in address order so that consecutive allocations are adjacent
+		for (size_t i = count; i > 0; --i)
+		{
+			FreeBlock* block = reinterpret_cast<FreeBlock*>(chunk + (i - 1) * size);
+			block->next = sizeClass.head;
+			sizeClass.head = block;
+		}
+		sizeClass.stats.free += count;
+		return true;
+	}
+
+}
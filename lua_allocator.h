@@ -0,0 +1,121 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#pragma once
+
+#include <vector>
+#include "lua_helper.h"
+
+namespace LuaCppHelper
+{
+
+	/**
+	* The count of size classes, blocks up to LuaAllocatorMaxSmall bytes are served from their free lists.
+	*/
+	static const int LuaAllocatorClassCount = 16;
+	static const size_t LuaAllocatorMaxSmall = 512;
+
+	/**
+	* The counters of one size class.
+	*/
+	struct LuaAllocatorClassStats
+	{
+		size_t	size;		// the block size of the class
+		size_t	live;		// blocks in use
+		size_t	free;		// blocks waiting in the free list
+		size_t	allocs;		// blocks handed out since the allocator was created
+	};
+
+	/**
+	* LuaAllocator is a lua_Alloc for one lua_State: the small blocks lua allocates all the time
+	* (strings, table nodes, closures, upvalues) come from size-class free lists refilled chunk by chunk,
+	* larger blocks go to realloc. Chunks are only given back when the allocator is destroyed.
+	*
+	* An optional budget caps the bytes lua holds: an allocation past it fails, lua collects garbage and retries,
+	* then raises a memory error in the script, which a pcall can catch. Shrinking never fails.
+	*
+	*   LuaAllocator allocator(64 * 1024 * 1024);
+	*   lua_State* L = allocator.NewState();
+	*   ...
+	*   lua_close(L);		// before the allocator goes away
+	*/
+	class LuaAllocator
+	{
+	public:
+		/**
+		* @param budget the most bytes lua may hold, 0 means no limit.
+		* @param chunkSize the bytes requested from malloc at once to refill a size class.
+		*/
+		explicit LuaAllocator(size_t budget = 0, size_t chunkSize = 64 * 1024);
+		~LuaAllocator(void);
+
+		/**
+		* Create a lua_State allocating through this allocator, it must be closed before the allocator is destroyed.
+		*/
+		lua_State* NewState(void);
+
+		/**
+		* The lua_Alloc, ud is the LuaAllocator.
+		*/
+		static void* Alloc(void* ud, void* ptr, size_t osize, size_t nsize);
+
+		/**
+		* Get the allocator of L, nullptr if L uses another lua_Alloc.
+		*/
+		static LuaAllocator* Get(lua_State* L);
+
+		/**
+		* memory() for lua, return a table with live, peak, budget, reserved, failures
+		* and classes, an array of { size, live, free, allocs }.
+		*/
+		static int LuaMemory(lua_State* L);
+
+		void SetBudget(size_t budget) { _budget = budget; }
+		size_t Budget(void) const { return _budget; }
+
+		size_t LiveBytes(void) const { return _live; }
+		size_t PeakBytes(void) const { return _peak; }
+		void ResetPeak(void) { _peak = _live; }
+
+		/**
+		* The bytes taken from malloc: the chunks of the size classes and the large blocks.
+		*/
+		size_t ReservedBytes(void) const { return _reserved; }
+
+		/**
+		* The count of allocations refused because of the budget or because malloc failed.
+		*/
+		size_t FailureCount(void) const { return _failures; }
+
+		const LuaAllocatorClassStats& ClassStats(int index) const { return _classes[index].stats; }
+
+	private:
+		LuaAllocator(const LuaAllocator&);
+		LuaAllocator& operator=(const LuaAllocator&);
+
+		struct FreeBlock
+		{
+			FreeBlock*	next;
+		};
+
+		struct SizeClass
+		{
+			FreeBlock*				head;
+			LuaAllocatorClassStats	stats;
+		};
+
+		static int ClassOf(size_t size);
+		void* Allocate(size_t size);
+		void Free(void* ptr, size_t size);
+		bool Refill(SizeClass& sizeClass);
+
+		SizeClass				_classes[LuaAllocatorClassCount];
+		std::vector<void*>		_chunks;
+		size_t					_chunkSize;
+		size_t					_budget;
+		size_t					_live;
+		size_t					_peak;
+		size_t					_reserved;
+		size_t					_failures;
+	};
+
+}
@@ -0,0 +1,104 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#include "lua_arena.h"
+#include <cstdlib>
+#include <cstring>
+
+namespace LuaCppHelper
+{
+
+	LuaArena::LuaArena(size_t blockSize)
+		: _blocks(nullptr)
+		, _cursor(nullptr)
+		, _end(nullptr)
+		, _blockSize(blockSize)
+		, _bytesAllocated(0)
+		, _bytesReserved(0)
+	{
+	}
+
+	LuaArena::~LuaArena(void)
+	{
+		while (_blocks != nullptr)
+		{
+			Block* next = _blocks->next;
+			free(_blocks);
+			_blocks = next;
+		}
+	}
+
+	void* LuaArena::Allocate(size_t size, size_t align)
+	{
+		size_t padding = (size_t)(-(ptrdiff_t)_cursor) & (align - 1);
+		if (_cursor == nullptr || (size_t)(_end - _cursor) < padding + size)
+		{
+			return AllocateBlock(size, align);
+		}
+		void* p = _cursor + padding;
+		_cursor += padding + size;
+		_bytesAllocated += size;
+		return p;
+	}
+
+	char* LuaArena::CopyString(const char* data, size_t size)
+	{
+		char* p = static_cast<char*>(Allocate(size + 1, 1));
+		memcpy(p, data, size);
+		p[size] = '\0';
+		return p;
+	}
+
+	void LuaArena::Reset(void)
+	{
+		// the oldest block is the last one in the list, keep it
+		while (_blocks != nullptr && _blocks->next != nullptr)
+		{
+			Block* next = _blocks->next;
+			_bytesReserved -= _blocks->size;
+			free(_blocks);
+			_blocks = next;
+		}
+		if (_blocks != nullptr)
+		{
+			_cursor = reinterpret_cast<char*>(_blocks + 1);
+			_end = reinterpret_cast<char*>(_blocks) + _blocks->size;
+		}
+		_bytesAllocated = 0;
+	}
+
+	void* LuaArena::AllocateBlock(size_t size, size_t align)
+	{
+		size_t blockSize = sizeof(Block) + size + align;
+		bool dedicated = blockSize > _blockSize;
+		if (!dedicated)
+		{
+			blockSize = _blockSize;
+		}
+		Block* block = static_cast<Block*>(malloc(blockSize));
+		if (block == nullptr)
+		{
+			throw std::bad_alloc();
+		}
+		block->size = blockSize;
+		_bytesReserved += blockSize;
+
+		char* begin = reinterpret_cast<char*>(block + 1);
+		char* p = begin + ((size_t)(-(ptrdiff_t)begin) & (align - 1));
+		if (dedicated && _blocks != nullptr)
+		{
+			// keep bumping in the current block, hide the dedicated one behind it
+			block->next = _blocks->next;
+			_blocks->next = block;
+		}
+		else
+		{
+			block->next = _blocks;
+			_blocks = block;
+			_cursor = p + size;
+			_end = reinterpret_cast<char*>(block) + blockSize;
+		}
+		_bytesAllocated += size;
+		return p;
+	}
+
+}
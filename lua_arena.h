@@ -0,0 +1,121 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+
+namespace LuaCppHelper
+{
+
+	/**
+	* LuaArena is a bump allocator for LuaValue trees that are thrown away together,
+	* e.g. the table arguments decoded during one call or one frame.
+	* Memory is only given back by Reset() or the destructor, never piece by piece.
+	*/
+	class LuaArena
+	{
+	public:
+		/**
+		* @param blockSize the size of each block requested from the heap,
+		*                  larger allocations get a block of their own.
+		*/
+		explicit LuaArena(size_t blockSize = 64 * 1024);
+		~LuaArena(void);
+
+		/**
+		* Allocate memory which stays valid until Reset() or destruction.
+		*
+		* @param size the count of bytes.
+		* @param align the alignment, must be a power of two.
+		* @return a pointer to the memory.
+		*/
+		void* Allocate(size_t size, size_t align = alignof(std::max_align_t));
+
+		/**
+		* Copy a buffer into the arena and terminate it with '\0'.
+		*
+		* @return a pointer to the copy.
+		*/
+		char* CopyString(const char* data, size_t size);
+
+		/**
+		* Release everything allocated so far in one step, the first block is kept for reuse.
+		* Every LuaValue and LuaTable using the arena must be destroyed before.
+		*/
+		void Reset(void);
+
+		size_t BytesAllocated(void) const { return _bytesAllocated; }
+		size_t BytesReserved(void) const { return _bytesReserved; }
+
+	private:
+		LuaArena(const LuaArena&);
+		LuaArena& operator=(const LuaArena&);
+
+		struct Block
+		{
+			Block*	next;
+			size_t	size;
+		};
+
+		void* AllocateBlock(size_t size, size_t align);
+
+		Block*	_blocks;
+		char*	_cursor;
+		char*	_end;
+		size_t	_blockSize;
+		size_t	_bytesAllocated;
+		size_t	_bytesReserved;
+	};
+
+	/**
+	* STL allocator taking memory from a LuaArena, or from the heap when no arena is given.
+	* Copies of a container fall back to the heap, moves keep the arena.
+	*/
+	template <typename T>
+	class LuaArenaAllocator
+	{
+	public:
+		typedef T value_type;
+		typedef std::true_type propagate_on_container_move_assignment;
+		typedef std::true_type propagate_on_container_swap;
+
+		LuaArenaAllocator(LuaArena* arena = nullptr) : _arena(arena) {}
+		template <typename U>
+		LuaArenaAllocator(const LuaArenaAllocator<U>& rhs) : _arena(rhs.Arena()) {}
+
+		T* allocate(size_t n)
+		{
+			if (_arena != nullptr)
+			{
+				return static_cast<T*>(_arena->Allocate(n * sizeof(T), alignof(T)));
+			}
+			return static_cast<T*>(::operator new(n * sizeof(T)));
+		}
+
+		void deallocate(T* p, size_t)
+		{
+			if (_arena == nullptr)
+			{
+				::operator delete(p);
+			}
+		}
+
+		LuaArenaAllocator select_on_container_copy_construction(void) const
+		{
+			return LuaArenaAllocator();
+		}
+
+		LuaArena* Arena(void) const { return _arena; }
+
+		template <typename U>
+		bool operator==(const LuaArenaAllocator<U>& rhs) const { return _arena == rhs.Arena(); }
+		template <typename U>
+		bool operator!=(const LuaArenaAllocator<U>& rhs) const { return _arena != rhs.Arena(); }
+
+	private:
+		LuaArena* _arena;
+	};
+
+}
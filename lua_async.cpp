@@ -0,0 +1,282 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#include "lua_async.h"
+
+namespace LuaCppHelper
+{
+
+	namespace
+	{
+		const char SchedulerKey = 0;
+	}
+
+	void LuaCompletion::ResolveWith(LuaPushResults push)
+	{
+		Complete(std::move(push), std::string());
+	}
+
+	void LuaCompletion::Reject(const std::string & message)
+	{
+		Complete(LuaPushResults(), message);
+	}
+
+	void LuaCompletion::Complete(LuaPushResults && push, const std::string & error)
+	{
+		if (!_inbox)
+		{
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(_inbox->mutex);
+			if (!_inbox->closed)
+			{
+				LuaAsyncCompletion completion;
+				completion.ticket = _ticket;
+				completion.push = std::move(push);
+				completion.error = error;
+				_inbox->completions.push_back(std::move(completion));
+			}
+		}
+		_inbox->wake.notify_one();
+		_inbox.reset();
+	}
+
+	LuaScheduler::LuaScheduler(lua_State * L)
+		: _inbox(std::make_shared<LuaAsyncInbox>())
+		, _nextTicket(0)
+		, _stopped(false)
+	{
+		lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);		/* L: main */
+		_L = lua_tothread(L, -1);
+		lua_pop(L, 1);												/* L: */
+		lua_pushlightuserdata(_L, this);							/* L: scheduler */
+		lua_rawsetp(_L, LUA_REGISTRYINDEX, &SchedulerKey);			/* L: */
+	}
+
+	LuaScheduler::~LuaScheduler(void)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_inbox->mutex);
+			_inbox->closed = true;
+			_inbox->completions.clear();
+		}
+		for (std::unordered_map<lua_State*, Task>::iterator it = _tasks.begin(); it != _tasks.end(); ++it)
+		{
+			luaL_unref(_L, LUA_REGISTRYINDEX, it->second.ref);
+		}
+		lua_pushnil(_L);											/* L: nil */
+		lua_rawsetp(_L, LUA_REGISTRYINDEX, &SchedulerKey);			/* L: */
+	}
+
+	LuaScheduler * LuaScheduler::Get(lua_State * L)
+	{
+		lua_rawgetp(L, LUA_REGISTRYINDEX, &SchedulerKey);			/* L: scheduler */
+		LuaScheduler* scheduler = static_cast<LuaScheduler*>(lua_touserdata(L, -1));
+		lua_pop(L, 1);												/* L: */
+		return scheduler;
+	}
+
+	int LuaScheduler::LuaSpawn(lua_State * L)
+	{
+		LuaScheduler* scheduler = Get(L);
+		if (scheduler == nullptr)
+		{
+			return luaL_error(L, "no LuaScheduler for this lua_State");
+		}
+		luaL_checktype(L, 1, LUA_TFUNCTION);
+		scheduler->Spawn(L, lua_gettop(L) - 1);
+		return 0;
+	}
+
+	void LuaScheduler::Spawn(lua_State * L, int nargs)
+	{
+		lua_State* thread = lua_newthread(L);						/* L: func, args..., thread */
+		lua_insert(L, -(nargs + 2));								/* L: thread, func, args... */
+		lua_xmove(L, thread, nargs + 1);							/* L: thread */
+		Task task;
+		task.ref = luaL_ref(L, LUA_REGISTRYINDEX);					/* L: */
+		task.waiting = false;
+		_tasks[thread] = task;
+		Ready ready = { thread, nargs };
+		_ready.push_back(ready);
+	}
+
+	LuaCompletion LuaScheduler::Suspend(lua_State * L)
+	{
+		std::unordered_map<lua_State*, Task>::iterator it = _tasks.find(L);
+		if (it == _tasks.end() || !lua_isyieldable(L))
+		{
+			luaL_error(L, "asynchronous calls must run in a LuaScheduler task");
+		}
+		if (it->second.waiting)
+		{
+			luaL_error(L, "the task is already waiting");
+		}
+		it->second.waiting = true;
+		unsigned long long ticket = ++_nextTicket;
+		_waiting[ticket] = L;
+		return LuaCompletion(_inbox, ticket);
+	}
+
+	int LuaScheduler::Yield(lua_State * L)
+	{
+		// the continuation returns what the completion pushes above this base
+		return lua_yieldk(L, 0, (lua_KContext)lua_gettop(L), &LuaScheduler::Continue);
+	}
+
+	int LuaScheduler::Continue(lua_State * L, int, lua_KContext base)
+	{
+		/* L: ..., ok, results... | ..., false, message */
+		int flag = (int)base + 1;
+		if (!lua_toboolean(L, flag))
+		{
+			lua_pushvalue(L, flag + 1);
+			return lua_error(L);
+		}
+		return lua_gettop(L) - flag;
+	}
+
+	size_t LuaScheduler::RunOnce(bool wait)
+	{
+		size_t resumed = 0;
+		// tasks spawned or yielded while resuming run on the next iteration
+		std::deque<Ready> ready;
+		ready.swap(_ready);
+		for (size_t i = 0; i < ready.size(); ++i)
+		{
+			Resume(ready[i].thread, ready[i].nargs);
+			++resumed;
+		}
+		for (size_t i = 0; i < _polls.size(); )
+		{
+			if (_polls[i]())
+			{
+				_polls[i] = std::move(_polls.back());
+				_polls.pop_back();
+			}
+			else
+			{
+				++i;
+			}
+		}
+		std::deque<LuaAsyncCompletion> completions;
+		{
+			std::unique_lock<std::mutex> lock(_inbox->mutex);
+			if (wait && resumed == 0 && _ready.empty() && _inbox->completions.empty() && !_stopped)
+			{
+				if (_polls.empty())
+				{
+					_inbox->wake.wait(lock);
+				}
+				else
+				{
+					// futures can't notify, poll them again soon
+					_inbox->wake.wait_for(lock, std::chrono::milliseconds(1));
+				}
+			}
+			completions.swap(_inbox->completions);
+		}
+		for (size_t i = 0; i < completions.size(); ++i)
+		{
+			Deliver(completions[i]);
+			++resumed;
+		}
+		return resumed;
+	}
+
+	void LuaScheduler::Run(void)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_inbox->mutex);
+			_stopped = false;
+		}
+		for (;;)
+		{
+			{
+				std::lock_guard<std::mutex> lock(_inbox->mutex);
+				if (_stopped)
+				{
+					break;
+				}
+			}
+			if (_tasks.empty())
+			{
+				break;
+			}
+			RunOnce(true);
+		}
+	}
+
+	void LuaScheduler::Stop(void)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_inbox->mutex);
+			_stopped = true;
+		}
+		_inbox->wake.notify_all();
+	}
+
+	void LuaScheduler::Deliver(LuaAsyncCompletion & completion)
+	{
+		std::unordered_map<unsigned long long, lua_State*>::iterator it = _waiting.find(completion.ticket);
+		if (it == _waiting.end())
+		{
+			return;
+		}
+		lua_State* thread = it->second;
+		_waiting.erase(it);
+		_tasks[thread].waiting = false;
+		int nargs = 1;
+		if (completion.push)
+		{
+			lua_pushboolean(thread, 1);								/* T: ..., true */
+			nargs += completion.push(thread);						/* T: ..., true, results... */
+		}
+		else
+		{
+			lua_pushboolean(thread, 0);								/* T: ..., false */
+			lua_pushlstring(thread, completion.error.c_str(), completion.error.size());	/* T: ..., false, message */
+			++nargs;
+		}
+		Resume(thread, nargs);
+	}
+
+	void LuaScheduler::Resume(lua_State * thread, int nargs)
+	{
+		int status = lua_resume(thread, _L, nargs);
+		if (status == LUA_YIELD)
+		{
+			if (!_tasks[thread].waiting)
+			{
+				// coroutine.yield from the task itself, give the other tasks a turn
+				lua_settop(thread, 0);
+				Ready ready = { thread, 0 };
+				_ready.push_back(ready);
+			}
+			return;
+		}
+		if (status != LUA_OK)
+		{
+			luaL_traceback(_L, thread, lua_tostring(thread, -1), 0);	/* L: traceback */
+			const char* traceback = lua_tostring(_L, -1);
+			if (_onError)
+			{
+				_onError(traceback);
+			}
+			else
+			{
+				LCH_LOG("[LUA ERROR]: %s", traceback);
+			}
+			lua_pop(_L, 1);											/* L: */
+		}
+		Finish(thread);
+	}
+
+	void LuaScheduler::Finish(lua_State * thread)
+	{
+		std::unordered_map<lua_State*, Task>::iterator it = _tasks.find(thread);
+		luaL_unref(_L, LUA_REGISTRYINDEX, it->second.ref);
+		_tasks.erase(it);
+	}
+
+}
@@ -0,0 +1,451 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
+#include "lua_helper.h"
+
+namespace LuaCppHelper
+{
+
+#if defined(__cpp_impl_coroutine)
+	template <typename T>
+	class LuaTask;
+#endif
+
+	/**
+	* Push the results of an asynchronous call onto the stack of the waiting task.
+	*
+	* @return the count of pushed values.
+	*/
+	typedef std::function<int(lua_State*)> LuaPushResults;
+
+	/// @cond
+	struct LuaAsyncCompletion
+	{
+		unsigned long long	ticket;
+		LuaPushResults		push;		// empty if the call failed
+		std::string			error;
+	};
+
+	// the completions handed over to the loop, shared with LuaCompletion so that late completions don't dangle
+	struct LuaAsyncInbox
+	{
+		LuaAsyncInbox(void) : closed(false) {}
+
+		std::mutex							mutex;
+		std::condition_variable				wake;
+		std::deque<LuaAsyncCompletion>		completions;
+		bool								closed;
+	};
+	/// @endcond
+
+	/**
+	* LuaCompletion finishes one suspended call, it may be used from any thread.
+	* The results are pushed by the loop thread of the scheduler, so they are captured by value.
+	* Only the first Resolve or Reject counts.
+	*/
+	class LuaCompletion
+	{
+	public:
+		LuaCompletion(void) : _ticket(0) {}
+		LuaCompletion(std::shared_ptr<LuaAsyncInbox> inbox, unsigned long long ticket) : _inbox(std::move(inbox)), _ticket(ticket) {}
+
+		/**
+		* Resume the task, the values become the results of the suspended call.
+		*/
+		template <typename ...ARGS>
+		void Resolve(ARGS ...values)
+		{
+			ResolveWith([values...](lua_State* L) { return LuaHelper::Result(L, values...); });
+		}
+
+		/**
+		* Resume the task, push pushes the results of the suspended call.
+		*/
+		void ResolveWith(LuaPushResults push);
+
+		/**
+		* Resume the task by raising a lua error with message from the suspended call.
+		*/
+		void Reject(const std::string& message);
+
+	private:
+		void Complete(LuaPushResults&& push, const std::string& error);
+
+		std::shared_ptr<LuaAsyncInbox>	_inbox;
+		unsigned long long				_ticket;
+	};
+
+	/**
+	* LuaScheduler runs lua functions as tasks on coroutines of one lua_State and resumes them
+	* when the C++ operations they wait for complete, all from a single-threaded event loop:
+	*
+	*   LuaScheduler scheduler(L);
+	*   scheduler.Spawn(L, 0);		// the function on top of the stack becomes a task
+	*   scheduler.Run();			// until every task finished
+	*
+	* A binding suspends the calling task with Await, the task yields through lua_yieldk and
+	* gets the results of the completion when it is resumed:
+	*
+	*   int Sleep(lua_State* L)
+	*   {
+	*       long long ms = 0;
+	*       LuaHelper::Check(L, ms);
+	*       return LuaScheduler::Get(L)->Await(L, [ms](LuaCompletion done) { timers.After(ms, [done]() mutable { done.Resolve(true); }); });
+	*   }
+	*
+	* A task that calls coroutine.yield itself is resumed on the next loop iteration.
+	* The scheduler must be destroyed before the lua_State is closed.
+	*/
+	class LuaScheduler
+	{
+	public:
+		explicit LuaScheduler(lua_State* L);
+		~LuaScheduler(void);
+
+		/**
+		* Get the scheduler of L or of the main state of the thread L, nullptr if there is none.
+		*/
+		static LuaScheduler* Get(lua_State* L);
+
+		/**
+		* spawn(func, ...) for lua, start func(...) as a task of the scheduler of L.
+		*/
+		static int LuaSpawn(lua_State* L);
+
+		lua_State* State(void) const { return _L; }
+		size_t TaskCount(void) const { return _tasks.size(); }
+		size_t WaitingCount(void) const { return _waiting.size(); }
+
+		/**
+		* Start a task, the function and nargs arguments are popped from the stack of L.
+		* The task first runs on the next loop iteration.
+		*/
+		void Spawn(lua_State* L, int nargs);
+
+		/**
+		* Suspend the task running on L until start completes the call, use it as the return value of a lua_CFunction.
+		* start is called at once, the task doesn't resume before the next loop iteration even if it completes synchronously.
+		*/
+		template <typename START>
+		int Await(lua_State* L, START&& start)
+		{
+			LuaCompletion completion = Suspend(L);
+			start(std::move(completion));
+			return Yield(L);
+		}
+
+		/**
+		* Suspend the task running on L until future is ready, the loop polls it.
+		* The value is the result of the call, an exception is raised as a lua error.
+		*/
+		template <typename T>
+		int Await(lua_State* L, std::future<T> future)
+		{
+			LuaCompletion completion = Suspend(L);
+			std::shared_ptr<std::future<T> > shared = std::make_shared<std::future<T> >(std::move(future));
+			_polls.push_back([shared, completion]() mutable
+			{
+				if (shared->wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+				{
+					return false;
+				}
+				try
+				{
+					if constexpr (std::is_void<T>::value)
+					{
+						shared->get();
+						completion.Resolve();
+					}
+					else
+					{
+						completion.Resolve(shared->get());
+					}
+				}
+				catch (const std::exception& e)
+				{
+					completion.Reject(e.what());
+				}
+				catch (...)
+				{
+					completion.Reject("unknown exception");
+				}
+				return true;
+			});
+			return Yield(L);
+		}
+
+#if defined(__cpp_impl_coroutine)
+		/**
+		* Suspend the task running on L until the coroutine task completes, the task is started at once.
+		*/
+		template <typename T>
+		int Await(lua_State* L, LuaTask<T> task);
+#endif
+
+		/**
+		* Register the task running on L as waiting, raise a lua error if L isn't a task or can't yield.
+		* Pair it with Yield when Await doesn't fit.
+		*/
+		LuaCompletion Suspend(lua_State* L);
+
+		/**
+		* Yield the task running on L, must be the return value of the lua_CFunction which called Suspend.
+		*/
+		int Yield(lua_State* L);
+
+		/**
+		* Resume the tasks which are ready.
+		*
+		* @param wait whether to block until a completion arrives when no task is ready.
+		* @return the count of resumed tasks.
+		*/
+		size_t RunOnce(bool wait = false);
+
+		/**
+		* Run the loop until every task finished or Stop is called.
+		*/
+		void Run(void);
+
+		/**
+		* Make Run return, may be called from any thread.
+		*/
+		void Stop(void);
+
+		/**
+		* Called with the traceback of a task which raised an error, the error is only logged by default.
+		*/
+		void SetErrorHandler(std::function<void(const char*)> handler) { _onError = std::move(handler); }
+
+	private:
+		struct Task
+		{
+			int					ref;		// keeps the thread alive in the registry
+			bool				waiting;
+		};
+
+		struct Ready
+		{
+			lua_State*			thread;
+			int					nargs;
+		};
+
+		LuaScheduler(const LuaScheduler&);
+		LuaScheduler& operator=(const LuaScheduler&);
+
+		static int Continue(lua_State* L, int status, lua_KContext base);
+		void Resume(lua_State* thread, int nargs);
+		void Deliver(LuaAsyncCompletion& completion);
+		void Finish(lua_State* thread);
+
+		lua_State*									_L;
+		std::shared_ptr<LuaAsyncInbox>				_inbox;
+		std::unordered_map<lua_State*, Task>		_tasks;
+		std::unordered_map<unsigned long long, lua_State*>	_waiting;
+		std::deque<Ready>							_ready;
+		std::vector<std::function<bool()> >			_polls;
+		std::function<void(const char*)>			_onError;
+		unsigned long long							_nextTicket;
+		bool										_stopped;
+	};
+
+#if defined(__cpp_impl_coroutine)
+	/// @cond
+	template <typename T>
+	struct LuaTaskPromiseBase
+	{
+		struct FinalAwaiter
+		{
+			bool await_ready(void) const noexcept { return false; }
+			template <typename PROMISE>
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<PROMISE> handle) noexcept
+			{
+				PROMISE& promise = handle.promise();
+				if (promise.continuation)
+				{
+					return promise.continuation;
+				}
+				if (promise.onDone)
+				{
+					// onDone destroys the frame, so it must not run from inside the promise
+					std::function<void()> done = std::move(promise.onDone);
+					done();
+				}
+				return std::noop_coroutine();
+			}
+			void await_resume(void) const noexcept {}
+		};
+
+		std::suspend_always initial_suspend(void) noexcept { return std::suspend_always(); }
+		FinalAwaiter final_suspend(void) noexcept { return FinalAwaiter(); }
+		void unhandled_exception(void) { exception = std::current_exception(); }
+
+		std::coroutine_handle<>		continuation;	// the awaiting LuaTask
+		std::function<void()>		onDone;			// set when the task is awaited by lua
+		std::exception_ptr			exception;
+	};
+
+	template <typename T>
+	struct LuaTaskPromise : LuaTaskPromiseBase<T>
+	{
+		LuaTask<T> get_return_object(void);
+		template <typename U>
+		void return_value(U&& value) { result = std::forward<U>(value); }
+
+		T Get(void)
+		{
+			if (this->exception)
+			{
+				std::rethrow_exception(this->exception);
+			}
+			return std::move(result);
+		}
+
+		T							result = T();
+	};
+
+	template <>
+	struct LuaTaskPromise<void> : LuaTaskPromiseBase<void>
+	{
+		LuaTask<void> get_return_object(void);
+		void return_void(void) {}
+
+		void Get(void)
+		{
+			if (this->exception)
+			{
+				std::rethrow_exception(this->exception);
+			}
+		}
+	};
+	/// @endcond
+
+	/**
+	* LuaTask is the lazy C++20 coroutine type of asynchronous bindings, it starts when it's awaited,
+	* either by another LuaTask with co_await or by a lua task through LuaScheduler::Await:
+	*
+	*   LuaTask<std::string> Fetch(std::string url) { co_return co_await http.Get(url); }
+	*
+	*   int LuaFetch(lua_State* L)
+	*   {
+	*       std::string url;
+	*       LuaHelper::Check(L, url);
+	*       return LuaScheduler::Get(L)->Await(L, Fetch(url));
+	*   }
+	*
+	* The coroutine may complete on any thread, the results are pushed on the loop thread.
+	*/
+	template <typename T>
+	class LuaTask
+	{
+	public:
+		typedef LuaTaskPromise<T> promise_type;
+
+		explicit LuaTask(std::coroutine_handle<promise_type> handle) : _handle(handle) {}
+		LuaTask(LuaTask&& rhs) noexcept : _handle(rhs._handle) { rhs._handle = nullptr; }
+		LuaTask& operator=(LuaTask&& rhs) noexcept
+		{
+			if (this != &rhs)
+			{
+				if (_handle)
+				{
+					_handle.destroy();
+				}
+				_handle = rhs._handle;
+				rhs._handle = nullptr;
+			}
+			return *this;
+		}
+		~LuaTask(void)
+		{
+			if (_handle)
+			{
+				_handle.destroy();
+			}
+		}
+
+		bool await_ready(void) const noexcept { return false; }
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+		{
+			_handle.promise().continuation = awaiting;
+			return _handle;
+		}
+		T await_resume(void) { return _handle.promise().Get(); }
+
+		/// @cond
+		// start the coroutine for LuaScheduler::Await, it owns itself until it completes
+		void Start(LuaCompletion completion)
+		{
+			std::coroutine_handle<promise_type> handle = _handle;
+			_handle = nullptr;
+			handle.promise().onDone = [handle, completion]() mutable
+			{
+				try
+				{
+					if constexpr (std::is_void<T>::value)
+					{
+						handle.promise().Get();
+						completion.Resolve();
+					}
+					else
+					{
+						completion.Resolve(handle.promise().Get());
+					}
+				}
+				catch (const std::exception& e)
+				{
+					completion.Reject(e.what());
+				}
+				catch (...)
+				{
+					completion.Reject("unknown exception");
+				}
+				handle.destroy();
+			};
+			handle.resume();
+		}
+		/// @endcond
+
+	private:
+		LuaTask(const LuaTask&);
+		LuaTask& operator=(const LuaTask&);
+
+		std::coroutine_handle<promise_type>	_handle;
+	};
+
+	/// @cond
+	template <typename T>
+	LuaTask<T> LuaTaskPromise<T>::get_return_object(void)
+	{
+		return LuaTask<T>(std::coroutine_handle<LuaTaskPromise<T> >::from_promise(*this));
+	}
+
+	inline LuaTask<void> LuaTaskPromise<void>::get_return_object(void)
+	{
+		return LuaTask<void>(std::coroutine_handle<LuaTaskPromise<void> >::from_promise(*this));
+	}
+	/// @endcond
+
+	template <typename T>
+	int LuaScheduler::Await(lua_State* L, LuaTask<T> task)
+	{
+		task.Start(Suspend(L));
+		return Yield(L);
+	}
+#endif
+
+}
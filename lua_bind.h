@@ -0,0 +1,176 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#pragma once
+
+#include <optional>
+#include <tuple>
+#include <utility>
+#include "lua_helper.h"
+
+namespace LuaCppHelper
+{
+
+	/// @cond
+	template <typename T>
+	struct LuaIsOptional : std::false_type {};
+	template <typename T>
+	struct LuaIsOptional<std::optional<T> > : std::true_type {};
+
+	// the count of parameters up to the last one which isn't a std::optional, the callers may omit the others
+	template <typename ...ARGS>
+	struct LuaRequiredArity { static const int Value = 0; };
+	template <typename T, typename ...ARGS>
+	struct LuaRequiredArity<T, ARGS...>
+	{
+		static const int Value = LuaRequiredArity<ARGS...>::Value > 0 ? LuaRequiredArity<ARGS...>::Value + 1 : (LuaIsOptional<T>::value ? 0 : 1);
+	};
+
+	template <typename FUNC>
+	struct LuaFunctionTraits : LuaFunctionTraits<decltype(&FUNC::operator())> {};
+
+	template <typename R, typename ...ARGS>
+	struct LuaFunctionTraits<R(*)(ARGS...)>
+	{
+		typedef R ResultType;
+		typedef std::tuple<typename std::decay<ARGS>::type...> ArgsType;
+		static const int Arity = sizeof...(ARGS);
+		static const int RequiredArity = LuaRequiredArity<typename std::decay<ARGS>::type...>::Value;
+	};
+	template <typename R, typename ...ARGS>
+	struct LuaFunctionTraits<R(*)(ARGS...) noexcept> : LuaFunctionTraits<R(*)(ARGS...)> {};
+	template <typename C, typename R, typename ...ARGS>
+	struct LuaFunctionTraits<R(C::*)(ARGS...)> : LuaFunctionTraits<R(*)(ARGS...)> {};
+	template <typename C, typename R, typename ...ARGS>
+	struct LuaFunctionTraits<R(C::*)(ARGS...) const> : LuaFunctionTraits<R(*)(ARGS...)> {};
+	template <typename C, typename R, typename ...ARGS>
+	struct LuaFunctionTraits<R(C::*)(ARGS...) noexcept> : LuaFunctionTraits<R(*)(ARGS...)> {};
+	template <typename C, typename R, typename ...ARGS>
+	struct LuaFunctionTraits<R(C::*)(ARGS...) const noexcept> : LuaFunctionTraits<R(*)(ARGS...)> {};
+
+	template <typename T>
+	struct LuaIsTuple : std::false_type {};
+	template <typename ...ARGS>
+	struct LuaIsTuple<std::tuple<ARGS...> > : std::true_type {};
+	/// @endcond
+
+	/**
+	* LuaBinder generates lua_CFunctions from plain C++ functions at compile time:
+	* arguments are checked with LuaHelper::Check one per parameter, the result is pushed with
+	* LuaHelper::Result, a std::tuple result is pushed as multiple results.
+	* Trailing std::optional parameters may be omitted by the caller, they are empty then.
+	*
+	*   int Add(int a, int b);
+	*   static const luaL_Reg functions[] = { { "add", LuaBinder::Function<&Add> }, { NULL, NULL } };
+	*/
+	class LuaBinder
+	{
+	public:
+		/**
+		* A lua_CFunction calling FUNC, usable in luaL_Reg tables.
+		*/
+		template <auto FUNC>
+		static int Function(lua_State* L)
+		{
+			typedef LuaFunctionTraits<decltype(FUNC)> Traits;
+			auto func = FUNC;
+			CheckArgc(L, Traits::RequiredArity);
+			return Invoke(L, func, (typename Traits::ArgsType*)nullptr, std::make_index_sequence<Traits::Arity>());
+		}
+
+		/**
+		* Push a closure calling func, which may be a lambda with captures.
+		* The callable is stored in a userdata upvalue and destroyed when the closure is collected.
+		*/
+		template <typename FUNC>
+		static void PushClosure(lua_State* L, FUNC func)
+		{
+			FUNC* storage = static_cast<FUNC*>(lua_newuserdata(L, sizeof(FUNC)));	/* L: ud */
+			new (storage) FUNC(std::move(func));
+			if (!std::is_trivially_destructible<FUNC>::value)
+			{
+				PushClosureMetatable<FUNC>(L);										/* L: ud, mt */
+				lua_setmetatable(L, -2);											/* L: ud */
+			}
+			lua_pushcclosure(L, &Closure<FUNC>, 1);									/* L: closure */
+		}
+
+	private:
+		static void CheckArgc(lua_State* L, int arity)
+		{
+			int argc = lua_gettop(L);
+			if (argc < arity)
+			{
+				luaL_error(L, "expects %d arguments, got %d", arity, argc);
+			}
+		}
+
+		template <typename FUNC, typename ...ARGS, size_t ...INDEX>
+		static int Invoke(lua_State* L, FUNC& func, std::tuple<ARGS...>*, std::index_sequence<INDEX...>)
+		{
+			typedef typename LuaFunctionTraits<typename std::decay<FUNC>::type>::ResultType R;
+			if constexpr ((std::is_arithmetic<ARGS>::value && ...))
+			{
+				// scalars are converted straight into the call, the check order doesn't matter
+				return Call<R>(L, func, LuaHelper::CheckArgument<ARGS>(L, INDEX + 1)...);
+			}
+			else
+			{
+				// braced initialization checks the arguments from left to right
+				std::tuple<ARGS...> args{ LuaHelper::CheckArgument<ARGS>(L, INDEX + 1)... };
+				return Call<R>(L, func, std::get<INDEX>(args)...);
+			}
+		}
+
+		template <typename R, typename FUNC, typename ...ARGS>
+		static int Call(lua_State* L, FUNC& func, ARGS&& ...args)
+		{
+			if constexpr (std::is_void<R>::value)
+			{
+				func(std::forward<ARGS>(args)...);
+				return 0;
+			}
+			else if constexpr (LuaIsTuple<typename std::decay<R>::type>::value)
+			{
+				return std::apply([L](auto&& ...results) { return LuaHelper::Result(L, results...); }, func(std::forward<ARGS>(args)...));
+			}
+			else
+			{
+				return LuaHelper::Result(L, func(std::forward<ARGS>(args)...));
+			}
+		}
+
+		template <typename FUNC>
+		static int Closure(lua_State* L)
+		{
+			typedef LuaFunctionTraits<FUNC> Traits;
+			FUNC& func = *static_cast<FUNC*>(lua_touserdata(L, lua_upvalueindex(1)));
+			CheckArgc(L, Traits::RequiredArity);
+			return Invoke(L, func, (typename Traits::ArgsType*)nullptr, std::make_index_sequence<Traits::Arity>());
+		}
+
+		template <typename FUNC>
+		static int Destroy(lua_State* L)
+		{
+			static_cast<FUNC*>(lua_touserdata(L, 1))->~FUNC();
+			return 0;
+		}
+
+		template <typename FUNC>
+		static void PushClosureMetatable(lua_State* L)
+		{
+			// one metatable per callable type, keyed by the address of a static of this instantiation
+			static const char tag = 0;
+			const void* key = &tag;
+			if (lua_rawgetp(L, LUA_REGISTRYINDEX, key) == LUA_TNIL)				/* L: nil */
+			{
+				lua_pop(L, 1);													/* L: */
+				lua_createtable(L, 0, 1);										/* L: mt */
+				lua_pushcfunction(L, &Destroy<FUNC>);							/* L: mt, gc */
+				lua_setfield(L, -2, "__gc");									/* L: mt */
+				lua_pushvalue(L, -1);											/* L: mt, mt */
+				lua_rawsetp(L, LUA_REGISTRYINDEX, key);							/* L: mt */
+			}
+		}
+	};
+
+}
@@ -0,0 +1,323 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <thread>
+#include "lua_bytecode_cache.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace LuaCppHelper
+{
+
+	namespace
+	{
+		/**
+		* A read only view of a whole file, mapped where mmap is available, read into memory elsewhere.
+		*/
+		class MappedFile
+		{
+		public:
+			explicit MappedFile(const char* path)
+				: _data(nullptr)
+				, _size(0)
+				, _mapped(false)
+				, _open(false)
+			{
+#ifndef _WIN32
+				int fd = open(path, O_RDONLY);
+				if (fd < 0)
+				{
+					return;
+				}
+				struct stat st;
+				if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+				{
+					_size = (size_t)st.st_size;
+					if (_size == 0)
+					{
+						_open = true;
+					}
+					else
+					{
+						void* data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+						if (data != MAP_FAILED)
+						{
+							_data = static_cast<const char*>(data);
+							_mapped = true;
+							_open = true;
+						}
+					}
+				}
+				close(fd);
+#else
+				FILE* file = fopen(path, "rb");
+				if (file == nullptr)
+				{
+					return;
+				}
+				char buffer[16 * 1024];
+				size_t count;
+				while ((count = fread(buffer, 1, sizeof(buffer), file)) > 0)
+				{
+					_buffer.append(buffer, count);
+				}
+				_open = ferror(file) == 0;
+				fclose(file);
+				_data = _buffer.data();
+				_size = _buffer.size();
+#endif
+			}
+
+			~MappedFile(void)
+			{
+#ifndef _WIN32
+				if (_mapped)
+				{
+					munmap(const_cast<char*>(_data), _size);
+				}
+#endif
+			}
+
+			bool IsOpen(void) const { return _open; }
+			const char* Data(void) const { return _open && _size > 0 ? _data : ""; }
+			size_t Size(void) const { return _open ? _size : 0; }
+
+		private:
+			MappedFile(const MappedFile&);
+			MappedFile& operator=(const MappedFile&);
+
+			const char*		_data;
+			size_t			_size;
+			bool			_mapped;
+			bool			_open;
+#ifdef _WIN32
+			std::string		_buffer;
+#endif
+		};
+
+		/**
+		* The lua_Reader handing the whole buffer to lua_load at once, lua reads it in place.
+		*/
+		struct ChunkReader
+		{
+			const char*		data;
+			size_t			size;
+		};
+
+		const char* ReadChunk(lua_State*, void* ud, size_t* size)
+		{
+			ChunkReader* reader = static_cast<ChunkReader*>(ud);
+			const char* data = reader->data;
+			*size = reader->size;
+			reader->data = nullptr;
+			reader->size = 0;
+			return *size > 0 ? data : nullptr;
+		}
+
+		int LoadChunk(lua_State* L, const char* data, size_t size, const char* chunkname, const char* mode)
+		{
+			ChunkReader reader = { data, size };
+			return lua_load(L, ReadChunk, &reader, chunkname, mode);
+		}
+
+		int WriteChunk(lua_State*, const void* data, size_t size, void* ud)
+		{
+			try
+			{
+				static_cast<std::string*>(ud)->append(static_cast<const char*>(data), size);
+			}
+			catch (...)
+			{
+				return 1;
+			}
+			return 0;
+		}
+
+		// FNV-1a over 8 byte words, with the high half folded back after each step so every byte reaches the low bits
+		uint64_t HashContent(const char* data, size_t size)
+		{
+			const uint64_t prime = 1099511628211ULL;
+			uint64_t hash = 14695981039346656037ULL ^ (uint64_t)size;
+			size_t i = 0;
+			for (; i + 8 <= size; i += 8)
+			{
+				uint64_t word;
+				memcpy(&word, data + i, 8);
+				hash = (hash ^ word) * prime;
+				hash ^= hash >> 32;
+			}
+			for (; i < size; ++i)
+			{
+				hash = (hash ^ (unsigned char)data[i]) * prime;
+			}
+			hash ^= hash >> 29;
+			return hash;
+		}
+	}
+
+	LuaBytecodeCache::LuaBytecodeCache(const std::string & directory, bool strip)
+		: _directory(directory)
+		, _strip(strip)
+		, _hits(0)
+		, _misses(0)
+	{
+		std::error_code error;
+		std::filesystem::create_directories(_directory, error);
+	}
+
+	bool LuaBytecodeCache::Install(lua_State * L)
+	{
+		if (lua_getglobal(L, "package") != LUA_TTABLE)					/* L: package */
+		{
+			lua_pop(L, 1);												/* L: */
+			return false;
+		}
+		if (lua_getfield(L, -1, "searchers") != LUA_TTABLE)				/* L: package, searchers */
+		{
+			lua_pop(L, 2);												/* L: */
+			return false;
+		}
+		lua_pushlightuserdata(L, this);									/* L: package, searchers, cache */
+		lua_pushvalue(L, -3);											/* L: package, searchers, cache, package */
+		lua_pushcclosure(L, Searcher, 2);								/* L: package, searchers, searcher */
+		lua_rawseti(L, -2, 2);											/* L: package, searchers */
+		lua_pop(L, 2);													/* L: */
+		return true;
+	}
+
+	int LuaBytecodeCache::Load(lua_State * L, const char * path)
+	{
+		MappedFile source(path);
+		if (!source.IsOpen())
+		{
+			lua_pushfstring(L, "cannot open %s", path);
+			return LUA_ERRFILE;
+		}
+		std::string chunkname = std::string("@") + path;
+		const char* data = source.Data();
+		size_t size = source.Size();
+
+		// what luaL_loadfilex skips: a BOM, then a first line starting with '#', keeping its newline for the line numbers
+		if (size >= 3 && memcmp(data, "\xEF\xBB\xBF", 3) == 0)
+		{
+			data += 3;
+			size -= 3;
+		}
+		if (size > 0 && data[0] == '#')
+		{
+			const char* newline = static_cast<const char*>(memchr(data, '\n', size));
+			size_t skip = newline != nullptr ? (size_t)(newline - data) : size;
+			data += skip;
+			size -= skip;
+		}
+		if (size > 0 && data[0] == LUA_SIGNATURE[0])
+		{
+			return LoadChunk(L, data, size, chunkname.c_str(), "b");
+		}
+		if (size > 0 && data[0] == '\n' && size > 1 && data[1] == LUA_SIGNATURE[0])
+		{
+			return LoadChunk(L, data + 1, size - 1, chunkname.c_str(), "b");
+		}
+
+		std::string cachePath = CachePath(chunkname, source.Data(), source.Size());
+		{
+			MappedFile cached(cachePath.c_str());
+			if (cached.IsOpen())
+			{
+				if (LoadChunk(L, cached.Data(), cached.Size(), chunkname.c_str(), "b") == LUA_OK)	/* L: chunk */
+				{
+					++_hits;
+					return LUA_OK;
+				}
+				// truncated or written by another lua build, compile it again
+				lua_pop(L, 1);											/* L: */
+				std::remove(cachePath.c_str());
+			}
+		}
+
+		++_misses;
+		int status = LoadChunk(L, data, size, chunkname.c_str(), "t");	/* L: chunk */
+		if (status != LUA_OK)
+		{
+			return status;
+		}
+		std::string chunk;
+		if (lua_dump(L, WriteChunk, &chunk, _strip ? 1 : 0) == 0)
+		{
+			Store(cachePath, chunk);
+		}
+		return LUA_OK;
+	}
+
+	int LuaBytecodeCache::Searcher(lua_State * L)
+	{
+		LuaBytecodeCache* cache = static_cast<LuaBytecodeCache*>(lua_touserdata(L, lua_upvalueindex(1)));
+		const char* name = luaL_checkstring(L, 1);
+		lua_settop(L, 1);												/* L: name */
+		lua_getfield(L, lua_upvalueindex(2), "searchpath");				/* L: name, searchpath */
+		lua_pushvalue(L, 1);											/* L: name, searchpath, name */
+		if (lua_getfield(L, lua_upvalueindex(2), "path") != LUA_TSTRING)	/* L: name, searchpath, name, path */
+		{
+			return luaL_error(L, "'package.path' must be a string");
+		}
+		lua_call(L, 2, 2);												/* L: name, filename|nil, message */
+		if (lua_isnil(L, -2))
+		{
+			return 1;
+		}
+		lua_pop(L, 1);													/* L: name, filename */
+		const char* filename = lua_tostring(L, -1);
+		if (cache->Load(L, filename) != LUA_OK)							/* L: name, filename, chunk|message */
+		{
+			return luaL_error(L, "error loading module '%s' from file '%s':\n\t%s", name, filename, lua_tostring(L, -1));
+		}
+		lua_insert(L, -2);												/* L: name, chunk, filename */
+		return 2;
+	}
+
+	std::string LuaBytecodeCache::CachePath(const std::string & chunkname, const char * data, size_t size) const
+	{
+		// the chunk name is part of the key, a chunk which isn't stripped keeps it for its error messages
+		char name[96];
+		snprintf(name, sizeof(name), "%016llx-%016llx-%llx-%d-%d%s.luac", (unsigned long long)HashContent(data, size),
+			(unsigned long long)HashContent(chunkname.c_str(), chunkname.size()), (unsigned long long)size,
+			(int)LUA_VERSION_NUM, (int)LUAL_NUMSIZES, _strip ? "-s" : "");
+		return _directory + "/" + name;
+	}
+
+	bool LuaBytecodeCache::Store(const std::string & cachePath, const std::string & chunk)
+	{
+		// a name no other thread or process writes to, so a reader only ever sees a complete chunk
+		static std::atomic<unsigned> sequence(0);
+		char suffix[64];
+		snprintf(suffix, sizeof(suffix), ".%llx.%x.tmp",
+			(unsigned long long)(std::hash<std::thread::id>()(std::this_thread::get_id()) ^ (size_t)std::chrono::steady_clock::now().time_since_epoch().count()),
+			sequence++);
+		std::string tempPath = cachePath + suffix;
+
+		FILE* file = fopen(tempPath.c_str(), "wb");
+		if (file == nullptr)
+		{
+			return false;
+		}
+		bool written = fwrite(chunk.data(), 1, chunk.size(), file) == chunk.size();
+		written = fclose(file) == 0 && written;
+		if (!written || std::rename(tempPath.c_str(), cachePath.c_str()) != 0)
+		{
+			std::remove(tempPath.c_str());
+			return false;
+		}
+		return true;
+	}
+
+}
@@ -0,0 +1,73 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#pragma once
+
+#include <atomic>
+#include <string>
+#include "lua_helper.h"
+
+namespace LuaCppHelper
+{
+
+	/**
+	* LuaBytecodeCache compiles each lua source once and keeps the lua_dump output in a directory,
+	* the file name is a hash of the source content and of its path, the lua version and the number sizes,
+	* so an edited source or another lua build never picks up a stale chunk,
+	* and two files with the same content keep their own chunk names.
+	* Later loads map the cached file and hand it to lua_load without copying it.
+	*
+	* Install replaces the lua file searcher of require, package.path is searched as before:
+	*
+	*   static LuaBytecodeCache cache("cache/luac");
+	*   cache.Install(L);
+	*   luaL_dostring(L, "require 'lch_test'");
+	*
+	* The cache may be shared by the states of several threads, different processes may share the directory:
+	* a chunk is written to a temporary file and renamed into place.
+	*/
+	class LuaBytecodeCache
+	{
+	public:
+		/**
+		* @param directory where the chunks are stored, it is created if needed.
+		* @param strip strip the debug information from the cached chunks, errors then lose their line numbers.
+		*/
+		explicit LuaBytecodeCache(const std::string& directory, bool strip = false);
+
+		/**
+		* Replace package.searchers[2] of L by the cached searcher, the cache must outlive L.
+		* Return false if the package library is not opened in L.
+		*/
+		bool Install(lua_State* L);
+
+		/**
+		* Load the lua file at path as a chunk, from the cache when possible, like luaL_loadfilex(L, path, nullptr).
+		* L: ... -> ... chunk, or ... message on error
+		* @return LUA_OK or the error of lua_load, LUA_ERRFILE if the file cannot be read.
+		*/
+		int Load(lua_State* L, const char* path);
+
+		const std::string& Directory(void) const { return _directory; }
+
+		/**
+		* The count of loads served from the cache, and of loads which compiled the source.
+		*/
+		size_t HitCount(void) const { return _hits; }
+		size_t MissCount(void) const { return _misses; }
+
+	private:
+		LuaBytecodeCache(const LuaBytecodeCache&);
+		LuaBytecodeCache& operator=(const LuaBytecodeCache&);
+
+		static int Searcher(lua_State* L);
+
+		std::string CachePath(const std::string& chunkname, const char* data, size_t size) const;
+		bool Store(const std::string& cachePath, const std::string& chunk);
+
+		std::string				_directory;
+		bool					_strip;
+		std::atomic<size_t>		_hits;
+		std::atomic<size_t>		_misses;
+	};
+
+}
@@ -0,0 +1,179 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#include <algorithm>
+#include "lua_event.h"
+
+namespace LuaCppHelper
+{
+
+	LuaEventDispatcher::LuaEventDispatcher(lua_State * L)
+		: _L(L)
+		, _depth(0)
+		, _dirty(false)
+	{
+	}
+
+	void LuaEventDispatcher::AddListener(int event, const LuaFunction func)
+	{
+		if (func != LUA_NOREF && func != LUA_REFNIL)
+		{
+			_listeners[event].push_back(func);
+		}
+	}
+
+	bool LuaEventDispatcher::RemoveListener(int event, const LuaFunction func)
+	{
+		auto it = _listeners.find(event);
+		if (it == _listeners.end())
+		{
+			return false;
+		}
+		std::vector<LuaFunction>& listeners = it->second;
+		auto listener = std::find(listeners.begin(), listeners.end(), func);
+		if (listener == listeners.end())
+		{
+			return false;
+		}
+		if (_depth > 0)
+		{
+			// a dispatch is iterating over the list, only mark the slot
+			*listener = LUA_NOREF;
+			_dirty = true;
+		}
+		else
+		{
+			listeners.erase(listener);
+		}
+		return true;
+	}
+
+	void LuaEventDispatcher::RemoveListeners(int event)
+	{
+		auto it = _listeners.find(event);
+		if (it == _listeners.end())
+		{
+			return;
+		}
+		if (_depth > 0)
+		{
+			std::fill(it->second.begin(), it->second.end(), LUA_NOREF);
+			_dirty = true;
+		}
+		else
+		{
+			_listeners.erase(it);
+		}
+	}
+
+	size_t LuaEventDispatcher::ListenerCount(int event) const
+	{
+		auto it = _listeners.find(event);
+		if (it == _listeners.end())
+		{
+			return 0;
+		}
+		return it->second.size() - std::count(it->second.begin(), it->second.end(), LUA_NOREF);
+	}
+
+	void LuaEventDispatcher::Post(int event, std::vector<LuaValue>&& args)
+	{
+		QueuedEvent queued;
+		queued.event = event;
+		queued.args = std::move(args);
+		_queue.push_back(std::move(queued));
+	}
+
+	LuaDispatchStats LuaEventDispatcher::Flush(void)
+	{
+		LuaDispatchStats stats;
+		if (_queue.empty())
+		{
+			return stats;
+		}
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		std::vector<QueuedEvent> queue;
+		queue.swap(_queue);
+		int top = lua_gettop(_L);
+		LuaHelper::PushErrorHandler(_L);											/* L: handler */
+		for (size_t i = 0; i < queue.size(); ++i)
+		{
+			const std::vector<LuaValue>& args = queue[i].args;
+			luaL_checkstack(_L, (int)args.size() + 2, "too many arguments");
+			for (size_t j = 0; j < args.size(); ++j)
+			{
+				LuaHelper::PushLuaValue(_L, args[j]);								/* L: handler, args... */
+			}
+			CallListeners(queue[i].event, top + 1, (int)args.size(), stats);
+			lua_settop(_L, top + 1);												/* L: handler */
+		}
+		lua_settop(_L, top);														/* L: */
+		// keep the storage of the drained queue for the next posts
+		queue.clear();
+		if (_queue.empty())
+		{
+			_queue.swap(queue);
+		}
+		stats.elapsed = std::chrono::steady_clock::now() - start;
+		return stats;
+	}
+
+	void LuaEventDispatcher::CallListeners(int event, int errfunc, int argc, LuaDispatchStats & stats)
+	{
+		++stats.events;
+		auto it = _listeners.find(event);
+		if (it == _listeners.end())
+		{
+			return;
+		}
+		// a reference to the mapped vector survives a rehash of the map, an iterator doesn't
+		std::vector<LuaFunction>& listeners = it->second;
+		luaL_checkstack(_L, argc + 1, "too many arguments");
+		++_depth;
+		// listeners added by the callbacks are behind count, they wait for the next dispatch
+		size_t count = listeners.size();
+		for (size_t i = 0; i < count; ++i)
+		{
+			// the vector may have been reallocated by AddListener, index it every time
+			LuaFunction func = listeners[i];
+			if (func == LUA_NOREF)
+			{
+				continue;
+			}
+			lua_rawgeti(_L, LUA_REGISTRYINDEX, func);								/* L: handler, args..., func */
+			for (int arg = 1; arg <= argc; ++arg)
+			{
+				lua_pushvalue(_L, errfunc + arg);									/* L: handler, args..., func, args... */
+			}
+			++stats.calls;
+			if (lua_pcall(_L, argc, 0, errfunc) != LUA_OK)							/* L: handler, args... */
+			{
+				LCH_LOG("[LUA ERROR]: %s", lua_tostring(_L, -1));					/* L: handler, args..., traceback */
+				lua_pop(_L, 1);														/* L: handler, args... */
+				++stats.errors;
+			}
+		}
+		if (--_depth == 0 && _dirty)
+		{
+			Compact();
+		}
+	}
+
+	void LuaEventDispatcher::Compact(void)
+	{
+		for (auto it = _listeners.begin(); it != _listeners.end(); )
+		{
+			std::vector<LuaFunction>& listeners = it->second;
+			listeners.erase(std::remove(listeners.begin(), listeners.end(), LUA_NOREF), listeners.end());
+			if (listeners.empty())
+			{
+				it = _listeners.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+		_dirty = false;
+	}
+
+}
@@ -0,0 +1,100 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#pragma once
+
+#include <chrono>
+#include <vector>
+#include "lua_helper.h"
+
+namespace LuaCppHelper
+{
+
+	/**
+	* The totals of one dispatch.
+	*/
+	struct LuaDispatchStats
+	{
+		LuaDispatchStats(void) : events(0), calls(0), errors(0), elapsed(0) {}
+
+		size_t						events;		// events dispatched
+		size_t						calls;		// listeners called
+		size_t						errors;		// listeners which raised an error
+		std::chrono::nanoseconds	elapsed;	// wall time of the whole dispatch
+	};
+
+	/**
+	* LuaEventDispatcher fans events out to lua listeners registered as LuaFunction refs.
+	* A dispatch fetches the error handler once and pushes the arguments once, then every
+	* listener is called under its own lua_pcall so that an error only stops that listener.
+	* The refs are not owned, release them with LuaHelper::RemoveFunction after removing the listener.
+	*
+	* Listeners may be added or removed from inside a callback: removed listeners are skipped at once,
+	* added listeners are called from the next dispatch on.
+	*/
+	class LuaEventDispatcher
+	{
+	public:
+		explicit LuaEventDispatcher(lua_State* L);
+
+		lua_State* State(void) const { return _L; }
+
+		void AddListener(int event, const LuaFunction func);
+
+		/**
+		* @return whether func was a listener of event.
+		*/
+		bool RemoveListener(int event, const LuaFunction func);
+		void RemoveListeners(int event);
+		size_t ListenerCount(int event) const;
+
+		/**
+		* Call every listener of event with args.
+		*/
+		template <typename ...ARGS>
+		LuaDispatchStats Dispatch(int event, ARGS&& ...args)
+		{
+			LuaDispatchStats stats;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			int top = lua_gettop(_L);
+			LuaHelper::PushErrorHandler(_L);										/* L: handler */
+			int argc = LuaHelper::Result(_L, std::forward<ARGS>(args)...);			/* L: handler, args... */
+			CallListeners(event, top + 1, argc, stats);
+			lua_settop(_L, top);													/* L: */
+			stats.elapsed = std::chrono::steady_clock::now() - start;
+			return stats;
+		}
+
+		/**
+		* Queue an event, it is dispatched by the next Flush().
+		*/
+		void Post(int event, std::vector<LuaValue>&& args = std::vector<LuaValue>());
+		size_t QueuedCount(void) const { return _queue.size(); }
+
+		/**
+		* Dispatch the queued events in order, all of them share one error handler setup.
+		* Events posted by the listeners are left for the next Flush().
+		*/
+		LuaDispatchStats Flush(void);
+
+	private:
+		LuaEventDispatcher(const LuaEventDispatcher&);
+		LuaEventDispatcher& operator=(const LuaEventDispatcher&);
+
+		struct QueuedEvent
+		{
+			int						event;
+			std::vector<LuaValue>	args;
+		};
+
+		// the error handler is at errfunc, followed by the argc arguments
+		void CallListeners(int event, int errfunc, int argc, LuaDispatchStats& stats);
+		void Compact(void);
+
+		lua_State*										_L;
+		std::unordered_map<int, std::vector<LuaFunction> >	_listeners;
+		std::vector<QueuedEvent>						_queue;
+		int												_depth;		// nested dispatches, removals are deferred while > 0
+		bool											_dirty;		// removed listeners are waiting to be compacted
+	};
+
+}
@@ -0,0 +1,219 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#include <new>
+#include "lua_function_ref.h"
+
+namespace LuaCppHelper
+{
+
+	namespace
+	{
+		// the registry keys of the pool userdata and of the function -> ref table, strings rather than
+		// the addresses of statics so that every module linking the pool into the same lua_State shares it
+		const char * const PoolKey = "LuaCppHelper.FunctionPool";
+		const char * const IdentitiesKey = "LuaCppHelper.FunctionIdentities";
+	}
+
+	LuaFunctionPool & LuaFunctionPool::Get(lua_State * L)
+	{
+		LuaFunctionPool* pool = Find(L);
+		if (pool != nullptr)
+		{
+			return *pool;
+		}
+		void* block = lua_newuserdata(L, sizeof(LuaFunctionPool));		/* L: ud */
+		pool = new (block) LuaFunctionPool();
+		lua_createtable(L, 0, 1);										/* L: ud, mt */
+		lua_pushcfunction(L, &LuaFunctionPool::Destroy);				/* L: ud, mt, gc */
+		lua_setfield(L, -2, "__gc");									/* L: ud, mt */
+		lua_setmetatable(L, -2);										/* L: ud */
+		lua_setfield(L, LUA_REGISTRYINDEX, PoolKey);					/* L: */
+		lua_newtable(L);												/* L: ids */
+		lua_setfield(L, LUA_REGISTRYINDEX, IdentitiesKey);				/* L: */
+		return *pool;
+	}
+
+	LuaFunctionPool * LuaFunctionPool::Find(lua_State * L)
+	{
+		lua_getfield(L, LUA_REGISTRYINDEX, PoolKey);					/* L: ud */
+		LuaFunctionPool* pool = static_cast<LuaFunctionPool*>(lua_touserdata(L, -1));
+		lua_pop(L, 1);													/* L: */
+		return pool;
+	}
+
+	LuaFunction LuaFunctionPool::Acquire(lua_State * L, int index)
+	{
+		index = lua_absindex(L, index);
+		LuaFunction func;
+		PushIdentities(L);												/* L: ids */
+		lua_pushvalue(L, index);										/* L: ids, func */
+		if (lua_rawget(L, -2) == LUA_TNUMBER)							/* L: ids, ref */
+		{
+			func = (LuaFunction)lua_tointeger(L, -1);
+			lua_pop(L, 2);												/* L: */
+		}
+		else
+		{
+			lua_pop(L, 1);												/* L: ids */
+			lua_pushvalue(L, index);									/* L: ids, func */
+			lua_pushvalue(L, index);									/* L: ids, func, func */
+			if (!_free.empty())
+			{
+				func = _free.back();
+				_free.pop_back();
+				lua_rawseti(L, LUA_REGISTRYINDEX, func);				/* L: ids, func */
+			}
+			else
+			{
+				func = luaL_ref(L, LUA_REGISTRYINDEX);					/* L: ids, func */
+				if ((size_t)func >= _counts.size())
+				{
+					_counts.resize((size_t)func + 1, 0);
+				}
+			}
+			lua_pushinteger(L, func);									/* L: ids, func, ref */
+			lua_rawset(L, -3);											/* L: ids */
+			lua_pop(L, 1);												/* L: */
+			++_live;
+		}
+		++_counts[func];
+		return func;
+	}
+
+	void LuaFunctionPool::Retain(const LuaFunction func)
+	{
+		if (Owns(func))
+		{
+			++_counts[func];
+		}
+	}
+
+	void LuaFunctionPool::Release(lua_State * L, const LuaFunction func)
+	{
+		if (!Owns(func) || --_counts[func] > 0)
+		{
+			return;
+		}
+		PushIdentities(L);												/* L: ids */
+		lua_rawgeti(L, LUA_REGISTRYINDEX, func);						/* L: ids, func */
+		lua_pushnil(L);													/* L: ids, func, nil */
+		lua_rawset(L, -3);												/* L: ids */
+		lua_pop(L, 1);													/* L: */
+		// false instead of nil, a hole could be handed out again by luaL_ref
+		lua_pushboolean(L, 0);											/* L: false */
+		lua_rawseti(L, LUA_REGISTRYINDEX, func);						/* L: */
+		_free.push_back(func);
+		--_live;
+	}
+
+	int LuaFunctionPool::Destroy(lua_State * L)
+	{
+		// finalizers running later in lua_close may still release refs: leave an empty pool which owns none,
+		// its memory goes away with the userdata
+		LuaFunctionPool* pool = static_cast<LuaFunctionPool*>(lua_touserdata(L, 1));
+		std::vector<int>().swap(pool->_counts);
+		std::vector<LuaFunction>().swap(pool->_free);
+		pool->_live = 0;
+		return 0;
+	}
+
+	void LuaFunctionPool::PushIdentities(lua_State * L)
+	{
+		lua_getfield(L, LUA_REGISTRYINDEX, IdentitiesKey);
+	}
+
+	LuaFunctionRef::LuaFunctionRef(lua_State * L, int index)
+	{
+		luaL_checktype(L, index, LUA_TFUNCTION);
+		_pool = &LuaFunctionPool::Get(L);
+		_func = _pool->Acquire(L, index);
+		lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+		_L = lua_tothread(L, -1);
+		lua_pop(L, 1);
+	}
+
+	LuaFunctionRef::LuaFunctionRef(const LuaFunctionRef & rhs)
+		: _L(rhs._L)
+		, _pool(rhs._pool)
+		, _func(rhs._func)
+	{
+		if (_pool != nullptr)
+		{
+			_pool->Retain(_func);
+		}
+	}
+
+	LuaFunctionRef::LuaFunctionRef(LuaFunctionRef && rhs) noexcept
+		: _L(rhs._L)
+		, _pool(rhs._pool)
+		, _func(rhs._func)
+	{
+		rhs._L = nullptr;
+		rhs._pool = nullptr;
+		rhs._func = LUA_NOREF;
+	}
+
+	LuaFunctionRef & LuaFunctionRef::operator=(const LuaFunctionRef & rhs)
+	{
+		if (this != &rhs)
+		{
+			if (rhs._pool != nullptr)
+			{
+				rhs._pool->Retain(rhs._func);
+			}
+			Reset();
+			_L = rhs._L;
+			_pool = rhs._pool;
+			_func = rhs._func;
+		}
+		return *this;
+	}
+
+	LuaFunctionRef & LuaFunctionRef::operator=(LuaFunctionRef && rhs) noexcept
+	{
+		if (this != &rhs)
+		{
+			Reset();
+			_L = rhs._L;
+			_pool = rhs._pool;
+			_func = rhs._func;
+			rhs._L = nullptr;
+			rhs._pool = nullptr;
+			rhs._func = LUA_NOREF;
+		}
+		return *this;
+	}
+
+	void LuaFunctionRef::Reset(void)
+	{
+		if (_pool != nullptr)
+		{
+			_pool->Release(_L, _func);
+		}
+		_L = nullptr;
+		_pool = nullptr;
+		_func = LUA_NOREF;
+	}
+
+	void LuaHelper::CheckImpl(lua_State * L, int index, LuaFunctionRef & val, bool cannil)
+	{
+		if (cannil && lua_isnoneornil(L, index))
+		{
+			return;
+		}
+		val = LuaFunctionRef(L, index);
+	}
+
+	void LuaHelper::ResultImpl(lua_State * L, const LuaFunctionRef & value)
+	{
+		if (value.IsValid())
+		{
+			value.Push(L);
+		}
+		else
+		{
+			lua_pushnil(L);
+		}
+	}
+
+}
@@ -0,0 +1,117 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#pragma once
+
+#include <vector>
+#include "lua_helper.h"
+
+namespace LuaCppHelper
+{
+
+	/**
+	* LuaFunctionPool hands out the registry refs of lua functions, there is one pool per lua_State,
+	* shared by all the modules loaded into it.
+	* A function already in the pool gets its existing ref back and a reference count is kept per ref.
+	* Released refs go to a free list on the C++ side and are reused by the next new function,
+	* so the registry stops growing once the count of live functions is stable.
+	* The refs are plain LuaFunction values, usable everywhere a luaL_ref'ed function is.
+	*/
+	class LuaFunctionPool
+	{
+	public:
+		/**
+		* Get the pool of a lua_State, it is created on first use and destroyed by lua_close.
+		*/
+		static LuaFunctionPool& Get(lua_State* L);
+
+		/**
+		* Get the pool of a lua_State if it has been created.
+		*/
+		static LuaFunctionPool* Find(lua_State* L);
+
+		/**
+		* Get the ref of the function at index and add a reference to it.
+		*/
+		LuaFunction Acquire(lua_State* L, int index);
+
+		/**
+		* Add a reference to a ref owned by the pool.
+		*/
+		void Retain(const LuaFunction func);
+
+		/**
+		* Drop a reference, the ref is recycled when the last one is gone.
+		*/
+		void Release(lua_State* L, const LuaFunction func);
+
+		bool Owns(const LuaFunction func) const
+		{
+			return func >= 0 && (size_t)func < _counts.size() && _counts[func] > 0;
+		}
+		int RefCount(const LuaFunction func) const { return Owns(func) ? _counts[func] : 0; }
+		size_t LiveCount(void) const { return _live; }
+		size_t FreeCount(void) const { return _free.size(); }
+
+	private:
+		LuaFunctionPool(void) : _live(0) {}
+		~LuaFunctionPool(void) {}
+		LuaFunctionPool(const LuaFunctionPool&);
+		LuaFunctionPool& operator=(const LuaFunctionPool&);
+
+		static int Destroy(lua_State* L);
+		static void PushIdentities(lua_State* L);
+
+		std::vector<int>			_counts;	// indexed by ref
+		std::vector<LuaFunction>	_free;
+		size_t						_live;
+	};
+
+	/**
+	* LuaFunctionRef is a reference counted handle of a lua function kept in the LuaFunctionPool.
+	* Copies share the ref, the ref is released with the last copy.
+	* The lua_State must outlive the LuaFunctionRef.
+	*/
+	class LuaFunctionRef
+	{
+	public:
+		LuaFunctionRef(void) : _L(nullptr), _pool(nullptr), _func(LUA_NOREF) {}
+		LuaFunctionRef(lua_State* L, int index);
+		LuaFunctionRef(const LuaFunctionRef& rhs);
+		LuaFunctionRef(LuaFunctionRef&& rhs) noexcept;
+		LuaFunctionRef& operator=(const LuaFunctionRef& rhs);
+		LuaFunctionRef& operator=(LuaFunctionRef&& rhs) noexcept;
+		~LuaFunctionRef(void) { Reset(); }
+
+		bool IsValid(void) const { return _func != LUA_NOREF; }
+		lua_State* State(void) const { return _L; }
+		LuaFunction Get(void) const { return _func; }
+
+		/**
+		* Release the ref, the LuaFunctionRef becomes invalid.
+		*/
+		void Reset(void);
+
+		/**
+		* Push the function onto the stack.
+		*/
+		void Push(lua_State* L) const { lua_rawgeti(L, LUA_REGISTRYINDEX, _func); }
+
+		/**
+		* Call the function, see LuaHelper::Call.
+		*/
+		template <typename ...R, typename ...ARGS>
+		typename LuaCallResult<R...>::Type Call(ARGS&& ...args) const
+		{
+			return LuaHelper::Call<R...>(_L, _func, std::forward<ARGS>(args)...);
+		}
+
+		bool operator==(const LuaFunctionRef& rhs) const { return _func == rhs._func; }
+		bool operator!=(const LuaFunctionRef& rhs) const { return _func != rhs._func; }
+
+	private:
+		lua_State*			_L;		// the main thread, it lives as long as the pool
+		LuaFunctionPool*	_pool;
+		LuaFunction			_func;
+	};
+
+}
@@ -1,12 +1,63 @@
 ﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
 
 #include "lua_helper.h"
+#include "lua_function_ref.h"
 
 namespace LuaCppHelper
 {
 
 	const LuaValue LuaHelper::NilValue;
 
+	LuaPinnedString::LuaPinnedString(lua_State * L, int index)
+	{
+		size_t len = 0;
+		const char * buf = luaL_checklstring(L, index, &len);
+		// keep the main thread, the coroutine the string was checked on may be collected first
+		lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);		/* L: main */
+		_L = lua_tothread(L, -1);
+		lua_pop(L, 1);												/* L: */
+		// the registry keeps the string object, and with it the characters, from being collected
+		lua_pushvalue(L, index);
+		_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+		_view = std::string_view(buf, len);
+	}
+
+	LuaPinnedString::LuaPinnedString(LuaPinnedString && rhs) noexcept
+		: _L(rhs._L)
+		, _ref(rhs._ref)
+		, _view(rhs._view)
+	{
+		rhs._L = nullptr;
+		rhs._ref = LUA_NOREF;
+		rhs._view = std::string_view();
+	}
+
+	LuaPinnedString & LuaPinnedString::operator=(LuaPinnedString && rhs) noexcept
+	{
+		if (this != &rhs)
+		{
+			Release();
+			_L = rhs._L;
+			_ref = rhs._ref;
+			_view = rhs._view;
+			rhs._L = nullptr;
+			rhs._ref = LUA_NOREF;
+			rhs._view = std::string_view();
+		}
+		return *this;
+	}
+
+	void LuaPinnedString::Release(void)
+	{
+		if (_L != nullptr)
+		{
+			luaL_unref(_L, LUA_REGISTRYINDEX, _ref);
+		}
+		_L = nullptr;
+		_ref = LUA_NOREF;
+		_view = std::string_view();
+	}
+
 	void LuaHelper::CheckBoolean(lua_State * L, int index, bool& val)
 	{
 		luaL_argcheck(L, lua_isboolean(L, index), index, "Need a Boolean");
@@ -20,31 +71,59 @@ namespace LuaCppHelper
 		val.assign(buf, len);
 	}
 
+	void LuaHelper::CheckString(lua_State * L, int index, std::string_view& val)
+	{
+		size_t len = 0;
+		const char * buf = luaL_checklstring(L, index, &len);
+		val = std::string_view(buf, len);
+	}
+
+	void LuaHelper::CheckString(lua_State * L, int index, LuaStringBuffer& val)
+	{
+		val.first = luaL_checklstring(L, index, &val.second);
+	}
+
+	void LuaHelper::CheckString(lua_State * L, int index, LuaPinnedString& val)
+	{
+		val = LuaPinnedString(L, index);
+	}
+
 	void LuaHelper::CheckLuaTable(lua_State * L, int index, LuaTable & val)
+	{
+		DecodeLuaTable(L, index, val, nullptr);
+	}
+
+	void LuaHelper::CheckLuaTable(lua_State * L, int index, LuaTable & val, LuaArena & arena)
+	{
+		DecodeLuaTable(L, index, val, &arena);
+	}
+
+	void LuaHelper::DecodeLuaTable(lua_State * L, int index, LuaTable & val, LuaArena * arena)
 	{
 		if (index < 0)
 		{
 			index = lua_gettop(L) + index + 1;
 		}
 		luaL_argcheck(L, lua_istable(L, index), index, "Need a Table");
-		LuaValueDict dict;
-		LuaValueArray array;
+		LuaTable table(arena);
+		table.Reserve(lua_rawlen(L, index), 0);
 		lua_pushnil(L);
 		while (lua_next(L, index) != 0)
 		{
 			LuaValue table_value;
-			CheckLuaValue(L, -1, table_value);
+			DecodeLuaValue(L, -1, table_value, arena);
 
 			// key must a string or a integer
-			if (lua_isstring(L, -2))
+			if (lua_type(L, -2) == LUA_TSTRING)
 			{
-				const char * table_key = lua_tostring(L, -2);
-				dict.insert(std::make_pair(std::string(table_key), table_value));
+				size_t len = 0;
+				const char * table_key = lua_tolstring(L, -2, &len);
+				table.Set(table_key, len, std::move(table_value));
 			}
 			else if (lua_isinteger(L, -2))
 			{
 				long long table_key = lua_tointeger(L, -2);
-				array.insert(std::make_pair(table_key, table_value));
+				table.Set(table_key, std::move(table_value));
 			}
 			else
 			{
@@ -53,52 +132,56 @@ namespace LuaCppHelper
 
 			lua_pop(L, 1);
 		}
-		val = std::make_pair(dict, array);
+		val = std::move(table);
 	}
 
 	void LuaHelper::CheckLuaObject(lua_State * L, int index, LuaObject & val)
 	{
-		std::string object_typename = val.second;
+		// the name is the only key the LuaObject carries, so it is looked up once per call,
+		// the flags are then read from that metatable; LuaObjectType<T> resolves T without any name
+		const std::string& object_typename = val.second;
 		if (lua_type(L, index) == LUA_TUSERDATA)
 		{
 			if (object_typename.empty())
 			{
-				val.first = *(void **)lua_touserdata(L, index);
+				val.first = ToObjectPointer(L, index);
+				return;
 			}
-			else
+			// boxes of a LuaClass type share its metatable too
+			int flags = -1;
+			luaL_getmetatable(L, object_typename.c_str());			/* L: mt */
+			if (lua_istable(L, -1) && lua_getmetatable(L, index))		/* L: mt, udmt */
+			{
+				bool named = lua_rawequal(L, -1, -2) != 0;
+				lua_pop(L, 1);										/* L: mt */
+				flags = named ? MetatableFlags(L, -1) : -1;
+			}
+			lua_pop(L, 1);											/* L: */
+			if (flags < 0)
 			{
-				val.first = *(void **)luaL_checkudata(L, index, object_typename.c_str());
+				luaL_argerror(L, index, lua_pushfstring(L, "%s expected, got %s", object_typename.c_str(), luaL_typename(L, index)));
 			}
+			void * block = lua_touserdata(L, index);
+			val.first = (!(flags & LuaTypeFlagInline) || IsBox(L, index)) ? *(void **)block : block;
 		}
 		else if (lua_type(L, index) == LUA_TLIGHTUSERDATA)
 		{
-			val.first = (void *)lua_topointer(L, index);
-			std::string err_msg;
+			// PushLuaObject only boxes the types with "__gc" or "__inline", the others come as plain lightuserdata
 			if (!object_typename.empty())
 			{
-				if (lua_getmetatable(L, index))
+				int flags = 0;
+				luaL_getmetatable(L, object_typename.c_str());		/* L: mt */
+				if (lua_istable(L, -1))
 				{
-					luaL_getmetatable(L, object_typename.c_str());
-					if (!lua_rawequal(L, -1, -2))
-					{
-						val.first = nullptr;
-						err_msg = "Need a ";
-						err_msg += object_typename;
-					}
-					lua_pop(L, 2);
+					flags = MetatableFlags(L, -1);
 				}
-				else
+				lua_pop(L, 1);										/* L: */
+				if (flags & (LuaTypeFlagHasGc | LuaTypeFlagInline))
 				{
-					// doesn't have metatable
-					val.first = nullptr;
-					err_msg = "Need a ";
-					err_msg += object_typename;
+					luaL_argerror(L, index, lua_pushfstring(L, "%s expected, got %s", object_typename.c_str(), luaL_typename(L, index)));
 				}
 			}
-			if (!err_msg.empty())
-			{
-				luaL_argerror(L, index, err_msg.c_str());
-			}
+			val.first = (void *)lua_topointer(L, index);
 		}
 		else
 		{
@@ -112,12 +195,32 @@ namespace LuaCppHelper
 		{
 			luaL_argerror(L, index, "Expected a function");
 		}
-		luaL_unref(L, LUA_REGISTRYINDEX, val._func);
-		lua_pushvalue(L, index);
-		val._func = luaL_ref(L, LUA_REGISTRYINDEX);
+		if (val._func != LUA_NOREF && val._func != LUA_REFNIL)
+		{
+			index = lua_absindex(L, index);
+			lua_rawgeti(L, LUA_REGISTRYINDEX, val._func);			/* L: old */
+			bool same = lua_rawequal(L, -1, index) != 0;
+			lua_pop(L, 1);											/* L: */
+			if (same)
+			{
+				return;
+			}
+			RemoveFunction(L, val._func);
+		}
+		val._func = LuaFunctionPool::Get(L).Acquire(L, index);
 	}
 
 	void LuaHelper::CheckLuaValue(lua_State * L, int index, LuaValue& val)
+	{
+		DecodeLuaValue(L, index, val, nullptr);
+	}
+
+	void LuaHelper::CheckLuaValue(lua_State * L, int index, LuaValue& val, LuaArena & arena)
+	{
+		DecodeLuaValue(L, index, val, &arena);
+	}
+
+	void LuaHelper::DecodeLuaValue(lua_State * L, int index, LuaValue& val, LuaArena * arena)
 	{
 		switch (lua_type(L, index))
 		{
@@ -147,14 +250,14 @@ namespace LuaCppHelper
 		{
 			size_t len = 0;
 			const char * buf = lua_tolstring(L, index, &len);
-			val = LuaValue::StringValue(std::string(buf, len));
+			val = arena != nullptr ? LuaValue::StringValue(buf, len, *arena) : LuaValue::StringValue(buf, len);
 		}
 		break;
 		case LUA_TTABLE:
 		{
-			LuaTable table;
-			CheckLuaTable(L, index, table);
-			val = LuaValue::TableValue(table);
+			LuaTable table(arena);
+			DecodeLuaTable(L, index, table, arena);
+			val = arena != nullptr ? LuaValue::TableValue(std::move(table), *arena) : LuaValue::TableValue(std::move(table));
 		}
 		break;
 		case LUA_TLIGHTUSERDATA:
@@ -174,7 +277,7 @@ namespace LuaCppHelper
 		break;
 		case LUA_TUSERDATA:
 		{
-			void * object_value = *(void **)lua_touserdata(L, index);
+			void * object_value = ToObjectPointer(L, index);
 			std::string object_typename;
 			if (luaL_getmetafield(L, index, "__name") != LUA_TNIL)
 			{
@@ -189,9 +292,7 @@ namespace LuaCppHelper
 		break;
 		case LUA_TFUNCTION:
 		{
-			LuaFunctionHelper func;
-			CheckLuaFunction(L, index, func);
-			val = LuaValue::FunctionValue(func._func);
+			val = LuaValue::FunctionValue(L, LuaFunctionPool::Get(L).Acquire(L, index));
 		}
 		break;
 		default:
@@ -202,6 +303,55 @@ namespace LuaCppHelper
 		}
 	}
 
+	void * LuaHelper::ToObjectPointer(lua_State * L, int index)
+	{
+		// the block holds the object itself for LuaClass types unless it is a box, a pointer to it otherwise
+		void * block = lua_touserdata(L, index);
+		if (IsBox(L, index))
+		{
+			return *(void **)block;
+		}
+		int flags = 0;
+		if (lua_getmetatable(L, index))				/* L: mt */
+		{
+			flags = MetatableFlags(L, -1);
+			lua_pop(L, 1);							/* L: */
+		}
+		return (flags & LuaTypeFlagInline) ? block : *(void **)block;
+	}
+
+	int LuaHelper::MetatableFlags(lua_State * L, int index)
+	{
+		// read every time, fields set after the type was registered count as well
+		index = lua_absindex(L, index);
+		int flags = 0;
+		if (lua_getfield(L, index, "__gc") != LUA_TNIL)					/* L: gc */
+		{
+			flags |= LuaTypeFlagHasGc;
+		}
+		lua_pop(L, 1);													/* L: */
+		if (lua_getfield(L, index, "__inline") != LUA_TNIL)				/* L: inline */
+		{
+			flags |= LuaTypeFlagInline;
+		}
+		lua_pop(L, 1);													/* L: */
+		return flags;
+	}
+
+	void LuaHelper::PushBox(lua_State * L, void * object)
+	{
+		*(void **)lua_newuserdata(L, sizeof(void *)) = object;		/* L: ud */
+		lua_pushboolean(L, 1);										/* L: ud, true */
+		lua_setuservalue(L, -2);									/* L: ud */
+	}
+
+	bool LuaHelper::IsBox(lua_State * L, int index)
+	{
+		bool box = lua_getuservalue(L, index) == LUA_TBOOLEAN;		/* L: uv */
+		lua_pop(L, 1);												/* L: */
+		return box;
+	}
+
 	void LuaHelper::PushNil(lua_State * L)
 	{
 		lua_pushnil(L);
@@ -222,68 +372,44 @@ namespace LuaCppHelper
 		lua_pushlstring(L, value.c_str(), value.size());
 	}
 
+	void LuaHelper::PushString(lua_State * L, std::string_view value)
+	{
+		lua_pushlstring(L, value.data(), value.size());
+	}
+
 	void LuaHelper::PushLuaTable(lua_State * L, const LuaTable & value)
 	{
-		lua_newtable(L);
-		LuaValueDict dict = value.first;
-		for (LuaValueDictIterator it = dict.begin(); it != dict.end(); ++it)
-		{
-			lua_pushstring(L, it->first.c_str());
-			PushLuaValue(L, it->second);
-			lua_rawset(L, -3);
-		}
-		LuaValueArray array = value.second;
-		for (LuaValueArrayIterator it = array.begin(); it != array.end(); ++it)
-		{
-			lua_pushinteger(L, it->first);
-			PushLuaValue(L, it->second);
-			lua_rawset(L, -3);
-		}
+		EncodeLuaTable(L, value, nullptr);
+	}
+
+	void LuaHelper::PushLuaTable(lua_State * L, const LuaTable & value, LuaKeyCache & cache)
+	{
+		EncodeLuaTable(L, value, &cache);
 	}
 
 	void LuaHelper::PushLuaObject(lua_State * L, const LuaObject & value)
 	{
-		// if metatable named object_typename has "__gc" field, push object_value as userdata
-		// otherwise put object_value as lightuserdata
+		// if the metatable named object_typename has "__gc" or "__inline", box object_value in a userdata
+		// with that metatable so that lua runs "__gc" or the LuaClass methods find the object,
+		// otherwise push object_value as plain lightuserdata: no allocation, and equal pointers stay rawequal.
+		// lightuserdata never gets a metatable, all of them would share it
 		void* object_value = value.first;
-		std::string object_typename = value.second;
-		do {
-			if (object_typename.empty())
-			{
-				break;
-			}
-			luaL_getmetatable(L, object_typename.c_str());		/* L: mt */
-			if (lua_isnil(L, -1))								/* L: mt */
-			{
-				lua_pop(L, 1);									/* L: */
-				break;
-			}
-			lua_getfield(L, -1, "__gc");						/* L: mt, gc */
-			if (lua_isnil(L, -1))								/* L: mt, gc */
-			{
-				lua_pop(L, 2);									/* L: */
-				break;
-			}
-			lua_pop(L, 2);										/* L: */
-			// push object_value as userdata
-			*(void **)lua_newuserdata(L, sizeof(void *)) = object_value;	/* L: ud */
-			luaL_getmetatable(L, object_typename.c_str());					/* L: ud, mt */
-			lua_setmetatable(L, -2);										/* L: ud */
-			return;
-		} while (false);
-
-		lua_pushlightuserdata(L, object_value);					/* L: lud */
+		const std::string& object_typename = value.second;
 		if (object_typename.empty())
 		{
+			lua_pushlightuserdata(L, object_value);				/* L: lud */
 			return;
 		}
-		luaL_getmetatable(L, object_typename.c_str());			/* L: lud, mt */
-		if (lua_isnil(L, -1))									/* L: lud, mt */
+		luaL_getmetatable(L, object_typename.c_str());			/* L: mt */
+		if (lua_isnil(L, -1) || !(MetatableFlags(L, -1) & (LuaTypeFlagHasGc | LuaTypeFlagInline)))
 		{
-			lua_pop(L, 1);										/* L: lud */
+			lua_pop(L, 1);										/* L: */
+			lua_pushlightuserdata(L, object_value);				/* L: lud */
 			return;
 		}
-		lua_setmetatable(L, -2);								/* L: lud */
+		PushBox(L, object_value);								/* L: mt, ud */
+		lua_insert(L, -2);										/* L: ud, mt */
+		lua_setmetatable(L, -2);								/* L: ud */
 	}
 
 	void LuaHelper::PushLuaFunction(lua_State * L, const LuaFunctionHelper & value)
@@ -292,6 +418,68 @@ namespace LuaCppHelper
 	}
 
 	void LuaHelper::PushLuaValue(lua_State * L, const LuaValue & value)
+	{
+		EncodeLuaValue(L, value, nullptr);
+	}
+
+	void LuaHelper::PushLuaValue(lua_State * L, const LuaValue & value, LuaKeyCache & cache)
+	{
+		EncodeLuaValue(L, value, &cache);
+	}
+
+	void LuaHelper::PushLuaValueDict(lua_State * L, const LuaValueDict & dict)
+	{
+		EncodeLuaValueDict(L, dict, nullptr);
+	}
+
+	void LuaHelper::PushLuaValueDict(lua_State * L, const LuaValueDict & dict, LuaKeyCache & cache)
+	{
+		EncodeLuaValueDict(L, dict, &cache);
+	}
+
+	void LuaHelper::PushLuaValueArray(lua_State * L, const LuaValueArray & array)
+	{
+		// keys are sorted, so the dense run 1..n is at the front once the non positive keys are skipped
+		int narr = 0;
+		for (LuaValueArrayIterator it = array.lower_bound(1); it != array.end() && it->first == narr + 1; ++it)
+		{
+			++narr;
+		}
+		lua_createtable(L, narr, (int)array.size() - narr);
+		for (LuaValueArrayIterator it = array.begin(); it != array.end(); ++it)
+		{
+			EncodeLuaValue(L, it->second, nullptr);
+			lua_rawseti(L, -2, it->first);
+		}
+	}
+
+	void LuaHelper::EncodeLuaTable(lua_State * L, const LuaTable & value, LuaKeyCache * cache)
+	{
+		luaL_checkstack(L, 3, "LuaTable nested too deep");
+		lua_createtable(L, (int)value.ArraySize(), (int)value.HashSize());
+		long long key = 1;
+		for (LuaTableArrayIterator it = value.ArrayBegin(); it != value.ArrayEnd(); ++it, ++key)
+		{
+			EncodeLuaValue(L, *it, cache);
+			lua_rawseti(L, -2, key);
+		}
+		for (LuaTableHashIterator it = value.HashBegin(); it != value.HashEnd(); ++it)
+		{
+			if (it->key.getType() == LuaValueTypeInt)
+			{
+				EncodeLuaValue(L, it->value, cache);
+				lua_rawseti(L, -2, it->key.IntValue());
+			}
+			else
+			{
+				EncodeKey(L, it->key.StringData(), it->key.StringSize(), cache);
+				EncodeLuaValue(L, it->value, cache);
+				lua_rawset(L, -3);
+			}
+		}
+	}
+
+	void LuaHelper::EncodeLuaValue(lua_State * L, const LuaValue & value, LuaKeyCache * cache)
 	{
 		const LuaValueType type = value.getType();
 		if (type == LuaValueTypeNil)
@@ -312,11 +500,11 @@ namespace LuaCppHelper
 		}
 		else if (type == LuaValueTypeString)
 		{
-			PushString(L, value.StringValue());
+			lua_pushlstring(L, value.StringData(), value.StringSize());
 		}
 		else if (type == LuaValueTypeTable)
 		{
-			PushLuaTable(L, value.TableValue());
+			EncodeLuaTable(L, value.TableValue(), cache);
 		}
 		else if (type == LuaValueTypeObject)
 		{
@@ -328,43 +516,115 @@ namespace LuaCppHelper
 		}
 	}
 
-	void LuaHelper::PushLuaValueDict(lua_State * L, const LuaValueDict & dict)
+	void LuaHelper::EncodeLuaValueDict(lua_State * L, const LuaValueDict & dict, LuaKeyCache * cache)
 	{
-		lua_newtable(L);
+		luaL_checkstack(L, 3, "LuaValueDict nested too deep");
+		lua_createtable(L, 0, (int)dict.size());
 		for (LuaValueDictIterator it = dict.begin(); it != dict.end(); ++it)
 		{
-			lua_pushstring(L, it->first.c_str());
-			PushLuaValue(L, it->second);
+			EncodeKey(L, it->first.c_str(), it->first.size(), cache);
+			EncodeLuaValue(L, it->second, cache);
 			lua_rawset(L, -3);
 		}
 	}
 
-	void LuaHelper::PushLuaValueArray(lua_State * L, const LuaValueArray & array)
+	void LuaHelper::EncodeKey(lua_State * L, const char * key, size_t keySize, LuaKeyCache * cache)
 	{
-		lua_newtable(L);
-		for (LuaValueArrayIterator it = array.begin(); it != array.end(); ++it)
+		if (cache != nullptr)
 		{
-			lua_pushinteger(L, it->first);
-			PushLuaValue(L, it->second);
-			lua_rawset(L, -3);
+			cache->Push(L, key, keySize);
+		}
+		else
+		{
+			lua_pushlstring(L, key, keySize);
+		}
+	}
+
+	LuaKeyCache::LuaKeyCache(lua_State * L, size_t capacity)
+		: _L(L)
+		, _capacity(capacity)
+	{
+		_refs.reserve(capacity);
+	}
+
+	LuaKeyCache::~LuaKeyCache(void)
+	{
+		Clear();
+	}
+
+	void LuaKeyCache::Push(lua_State * L, const char * key, size_t keySize)
+	{
+		std::unordered_map<std::string_view, int>::const_iterator it = _refs.find(std::string_view(key, keySize));
+		if (it != _refs.end())
+		{
+			lua_rawgeti(L, LUA_REGISTRYINDEX, it->second);
+			return;
+		}
+		const char * interned = lua_pushlstring(L, key, keySize);
+		if (_refs.size() < _capacity)
+		{
+			lua_pushvalue(L, -1);
+			int ref = luaL_ref(L, LUA_REGISTRYINDEX);
+			_refs.insert(std::make_pair(std::string_view(interned, keySize), ref));
 		}
 	}
 
+	void LuaKeyCache::Clear(void)
+	{
+		for (std::unordered_map<std::string_view, int>::const_iterator it = _refs.begin(); it != _refs.end(); ++it)
+		{
+			luaL_unref(_L, LUA_REGISTRYINDEX, it->second);
+		}
+		_refs.clear();
+	}
+
+	namespace
+	{
+		// the address is the registry key of the cached error handler
+		const char ErrorHandlerKey = 0;
+	}
+
+	void LuaHelper::PushErrorHandler(lua_State * L)
+	{
+		if (lua_rawgetp(L, LUA_REGISTRYINDEX, &ErrorHandlerKey) != LUA_TNIL)	/* L: handler */
+		{
+			return;
+		}
+		lua_pop(L, 1);															/* L: */
+		if (lua_getglobal(L, "debug") == LUA_TTABLE)							/* L: debug */
+		{
+			lua_getfield(L, -1, "traceback");									/* L: debug, traceback */
+			lua_remove(L, -2);													/* L: traceback */
+		}
+		lua_pushcclosure(L, LuaHelper::Traceback, 1);							/* L: handler */
+		lua_pushvalue(L, -1);													/* L: handler, handler */
+		lua_rawsetp(L, LUA_REGISTRYINDEX, &ErrorHandlerKey);					/* L: handler */
+	}
+
 	int LuaHelper::Traceback(lua_State * L)
 	{
 		if (!lua_isstring(L, 1))  /* 'message' not a string? */
 			return 1;  /* keep it intact */
-		lua_pushglobaltable(L);
-		lua_getfield(L, -1, "debug");
-		lua_remove(L, -2);
-		if (!lua_istable(L, -1)) {
-			lua_pop(L, 1);
-			return 1;
+		if (lua_type(L, lua_upvalueindex(1)) == LUA_TFUNCTION)
+		{
+			// the closure made by PushErrorHandler already holds debug.traceback
+			lua_pushvalue(L, lua_upvalueindex(1));
 		}
-		lua_getfield(L, -1, "traceback");
-		if (!lua_isfunction(L, -1)) {
-			lua_pop(L, 2);
-			return 1;
+		else
+		{
+			lua_pushglobaltable(L);
+			lua_getfield(L, -1, "debug");
+			lua_remove(L, -2);
+			if (!lua_istable(L, -1)) {
+				lua_pop(L, 1);
+				return 1;
+			}
+			lua_getfield(L, -1, "traceback");
+			lua_remove(L, -2);
+			if (!lua_isfunction(L, -1)) {
+				lua_pop(L, 1);
+				return 1;
+			}
 		}
 		lua_pushvalue(L, 1);  /* pass error message */
 		lua_pushinteger(L, 2);  /* skip this function and traceback */
@@ -380,7 +640,7 @@ namespace LuaCppHelper
 			return;
 		}
 
-		lua_pushcfunction(L, LuaHelper::Traceback);
+		PushErrorHandler(L);
 		int errfunc = lua_gettop(L);
 		// And insert it before the args if there are any.
 		if (argc != 0)
@@ -408,9 +668,69 @@ namespace LuaCppHelper
 
 	void LuaHelper::RemoveFunction(lua_State * L, const LuaFunction func)
 	{
+		LuaFunctionPool* pool = LuaFunctionPool::Find(L);
+		if (pool != nullptr && pool->Owns(func))
+		{
+			pool->Release(L, func);
+			return;
+		}
 		luaL_unref(L, LUA_REGISTRYINDEX, func);
 	}
 
+	bool LuaHelper::TryResult(lua_State * L, int index, int position, float & val)
+	{
+		double value = val;
+		if (!TryResult(L, index, position, value))
+		{
+			return false;
+		}
+		val = (float)value;
+		return true;
+	}
+
+	bool LuaHelper::TryResult(lua_State * L, int index, int position, double & val)
+	{
+		int isnum = 0;
+		lua_Number value = lua_tonumberx(L, index, &isnum);
+		if (isnum)
+		{
+			val = value;
+			return true;
+		}
+		return lua_isnoneornil(L, index) || ResultError(L, index, position);
+	}
+
+	bool LuaHelper::TryResult(lua_State * L, int index, int position, bool & val)
+	{
+		if (lua_isboolean(L, index))
+		{
+			val = lua_toboolean(L, index) != 0;
+			return true;
+		}
+		return lua_isnoneornil(L, index) || ResultError(L, index, position);
+	}
+
+	bool LuaHelper::TryResult(lua_State * L, int index, int position, std::string & val)
+	{
+		if (lua_type(L, index) == LUA_TSTRING || lua_type(L, index) == LUA_TNUMBER)
+		{
+			size_t len = 0;
+			const char * buf = lua_tolstring(L, index, &len);
+			val.assign(buf, len);
+			return true;
+		}
+		return lua_isnoneornil(L, index) || ResultError(L, index, position);
+	}
+
+	bool LuaHelper::ResultError(lua_State * L, int index, int position)
+	{
+		(void)L;
+		(void)index;
+		(void)position;
+		LCH_LOG("[LUA ERROR]: bad result #%d, unexpected %s", position, luaL_typename(L, index));
+		return false;
+	}
+
 	void LuaHelper::CheckImpl(lua_State * L, int index, float & val, bool cannil)
 	{
 		if (cannil && lua_isnoneornil(L, index))
@@ -438,6 +758,15 @@ namespace LuaCppHelper
 		CheckBoolean(L, index, val);
 	}
 
+	void LuaHelper::CheckImpl(lua_State * L, int index, const char *& val, bool cannil)
+	{
+		if (cannil && lua_isnoneornil(L, index))
+		{
+			return;
+		}
+		val = luaL_checkstring(L, index);
+	}
+
 	void LuaHelper::CheckImpl(lua_State * L, int index, std::string & val, bool cannil)
 	{
 		if (cannil && lua_isnoneornil(L, index))
@@ -447,6 +776,33 @@ namespace LuaCppHelper
 		CheckString(L, index, val);
 	}
 
+	void LuaHelper::CheckImpl(lua_State * L, int index, std::string_view & val, bool cannil)
+	{
+		if (cannil && lua_isnoneornil(L, index))
+		{
+			return;
+		}
+		CheckString(L, index, val);
+	}
+
+	void LuaHelper::CheckImpl(lua_State * L, int index, LuaStringBuffer & val, bool cannil)
+	{
+		if (cannil && lua_isnoneornil(L, index))
+		{
+			return;
+		}
+		CheckString(L, index, val);
+	}
+
+	void LuaHelper::CheckImpl(lua_State * L, int index, LuaPinnedString & val, bool cannil)
+	{
+		if (cannil && lua_isnoneornil(L, index))
+		{
+			return;
+		}
+		CheckString(L, index, val);
+	}
+
 	void LuaHelper::CheckImpl(lua_State * L, int index, LuaTable & val, bool cannil)
 	{
 		if (cannil && lua_isnoneornil(L, index))
@@ -503,6 +859,16 @@ namespace LuaCppHelper
 		PushString(L, value);
 	}
 
+	void LuaHelper::ResultImpl(lua_State * L, const std::string_view & value)
+	{
+		PushString(L, value);
+	}
+
+	void LuaHelper::ResultImpl(lua_State * L, const LuaStringBuffer & value)
+	{
+		lua_pushlstring(L, value.first, value.second);
+	}
+
 	void LuaHelper::ResultImpl(lua_State * L, const LuaTable & value)
 	{
 		PushLuaTable(L, value);
@@ -2,7 +2,16 @@
 
 #pragma once
 
-#include "lua_value.h"
+#include <array>
+#include <climits>
+#include <map>
+#include <optional>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "lua_table.h"
 extern "C"
 {
 #include "lauxlib.h"
@@ -10,20 +19,154 @@ extern "C"
 
 #define LCH_LOG(...)
 
+#if defined(LCH_ENABLE_STATS)
+#define LCH_STATS_DECODE_BEGIN() long long lchStatsDecodeStart = LuaCppHelper::LuaStatsDecodeBegin()
+#define LCH_STATS_DECODE_END() LuaCppHelper::LuaStatsDecodeEnd(lchStatsDecodeStart)
+#else
+#define LCH_STATS_DECODE_BEGIN()
+#define LCH_STATS_DECODE_END()
+#endif
+
 namespace LuaCppHelper
 {
 
+#if defined(LCH_ENABLE_STATS)
+	/// @cond
+	// add the time spent decoding arguments to a per-thread counter, see lua_stats.h.
+	// plain calls rather than a guard object: a lua error longjmps past destructors,
+	// a begin without its end only leaves that decoding uncounted
+	long long LuaStatsDecodeBegin(void);
+	void LuaStatsDecodeEnd(long long start);
+	/// @endcond
+#endif
+
+	class LuaTableRef;
+	class LuaFunctionRef;
+	template <typename T> class LuaObjectType;
+
+	/**
+	* Keep frequently pushed field names in the registry, pushing a cached key is a registry
+	* array access instead of creating (long keys) or re-hashing (short keys) a lua string.
+	* The cache belongs to one lua_State, which must outlive it.
+	*/
+	class LuaKeyCache
+	{
+	public:
+		/**
+		* @param capacity the count of keys kept, later keys are pushed as plain strings.
+		*/
+		explicit LuaKeyCache(lua_State* L, size_t capacity = 256);
+		~LuaKeyCache(void);
+
+		/**
+		* Push a key, it is interned on first use while there is room.
+		*/
+		void Push(lua_State* L, const char* key, size_t keySize);
+
+		/**
+		* Release all the interned keys.
+		*/
+		void Clear(void);
+
+		size_t Size(void) const { return _refs.size(); }
+
+	private:
+		LuaKeyCache(const LuaKeyCache&);
+		LuaKeyCache& operator=(const LuaKeyCache&);
+
+		lua_State* _L;
+		size_t _capacity;
+		// the views point into the lua strings held by the registry
+		std::unordered_map<std::string_view, int> _refs;
+	};
+
 	struct LuaFunctionHelper
 	{
 		LuaFunctionHelper(LuaFunction func = LUA_NOREF) : _func(func) {}
 		LuaFunction _func;
 	};
 
+	/**
+	* A string checked out of lua without copying, the pointer stays valid while the value is on the stack.
+	*/
+	typedef std::pair<const char *, size_t>	LuaStringBuffer;
+
+	/**
+	* Keep a lua string alive in the registry so that its characters can be used after the call returns.
+	* The lua_State must outlive the LuaPinnedString, the string may be checked on any of its coroutines.
+	*/
+	class LuaPinnedString
+	{
+	public:
+		LuaPinnedString(void) : _L(nullptr), _ref(LUA_NOREF) {}
+		LuaPinnedString(lua_State* L, int index);
+		LuaPinnedString(LuaPinnedString&& rhs) noexcept;
+		LuaPinnedString& operator=(LuaPinnedString&& rhs) noexcept;
+		~LuaPinnedString(void) { Release(); }
+
+		std::string_view View(void) const { return _view; }
+		const char* Data(void) const { return _view.data(); }
+		size_t Size(void) const { return _view.size(); }
+
+		/**
+		* Unpin the string, the view is no longer valid.
+		*/
+		void Release(void);
+
+	private:
+		LuaPinnedString(const LuaPinnedString&);
+		LuaPinnedString& operator=(const LuaPinnedString&);
+
+		lua_State*			_L;
+		int					_ref;
+		std::string_view	_view;
+	};
+
+	/// @cond
+	typedef enum {
+		LuaTypeFlagHasGc = 1,		// pushed pointers are boxed in userdata so that "__gc" runs
+		LuaTypeFlagInline = 2		// the userdata block holds the object itself (LuaClass)
+	} LuaTypeFlag;
+	/// @endcond
+
+	/// @cond
+	// the value returned by LuaHelper::Call: nothing, the single result, or a tuple of the results
+	template <typename ...R>
+	struct LuaCallResult { typedef std::tuple<R...> Type; };
+	template <typename R>
+	struct LuaCallResult<R> { typedef R Type; };
+	template <>
+	struct LuaCallResult<> { typedef void Type; };
+
+	// the string types pointing into a lua string, valid only while the string stays referenced
+	template <typename T>
+	struct LuaIsBorrowedString : std::integral_constant<bool, std::is_same<T, const char*>::value
+		|| std::is_same<T, std::string_view>::value || std::is_same<T, LuaStringBuffer>::value> {};
+
+	// the types decoded from a lua table
+	template <typename T>
+	struct LuaIsTableType : std::is_same<T, LuaTable> {};
+	template <typename T>
+	struct LuaIsTableType<std::vector<T>> : std::true_type {};
+	template <typename T, size_t N>
+	struct LuaIsTableType<std::array<T, N>> : std::true_type {};
+	template <typename K, typename V>
+	struct LuaIsTableType<std::unordered_map<K, V>> : std::true_type {};
+	template <typename K, typename V>
+	struct LuaIsTableType<std::map<K, V>> : std::true_type {};
+	template <typename A, typename B>
+	struct LuaIsTableType<std::pair<A, B>> : std::true_type {};
+	template <typename ...T>
+	struct LuaIsTableType<std::tuple<T...>> : std::true_type {};
+	/// @endcond
+
 	/**
 	* LuaHelper is used to read paramters from lua_State or write results to lua_State
 	*/
 	class LuaHelper
 	{
+		friend class LuaTableRef;
+
 	public:
 		template <typename INTTYPE>
 		static void CheckInteger(lua_State* L, int index, INTTYPE& val)
@@ -51,10 +194,26 @@ namespace LuaCppHelper
 		}
 		static void CheckBoolean(lua_State* L, int index, bool& val);
 		static void CheckString(lua_State* L, int index, std::string& val);
+		static void CheckString(lua_State* L, int index, std::string_view& val);
+		static void CheckString(lua_State* L, int index, LuaStringBuffer& val);
+		static void CheckString(lua_State* L, int index, LuaPinnedString& val);
 		static void CheckLuaTable(lua_State* L, int index, LuaTable& val);
+		/**
+		* Decode a table whose every node comes out of the arena, release the arena after val is destroyed.
+		*/
+		static void CheckLuaTable(lua_State* L, int index, LuaTable& val, LuaArena& arena);
+		/**
+		* Refer to a table without decoding it, see LuaTableRef in lua_table_ref.h.
+		*/
+		static void CheckLuaTable(lua_State* L, int index, LuaTableRef& val);
 		static void CheckLuaObject(lua_State* L, int index, LuaObject& val);
+		/**
+		* Get a ref of the function at index from the LuaFunctionPool, release it with RemoveFunction.
+		* The ref already in val is kept if it refers to the same function.
+		*/
 		static void CheckLuaFunction(lua_State* L, int index, LuaFunctionHelper& val);
 		static void CheckLuaValue(lua_State* L, int index, LuaValue& val);
+		static void CheckLuaValue(lua_State* L, int index, LuaValue& val, LuaArena& arena);
 
 		template <typename INTTYPE>
 		static void PushInteger(lua_State* L, INTTYPE value)
@@ -84,18 +243,190 @@ namespace LuaCppHelper
 		static void PushBoolean(lua_State* L, bool value);
 		static void PushString(lua_State* L, const char * value);
 		static void PushString(lua_State* L, const std::string& value);
+		static void PushString(lua_State* L, std::string_view value);
 		static void PushLuaTable(lua_State* L, const LuaTable& value);
+		static void PushLuaTable(lua_State* L, const LuaTable& value, LuaKeyCache& cache);
 		static void PushLuaObject(lua_State* L, const LuaObject& value);
 		static void PushLuaFunction(lua_State* L, const LuaFunctionHelper& value);
 		static void PushLuaValue(lua_State* L, const LuaValue& value);
+		static void PushLuaValue(lua_State* L, const LuaValue& value, LuaKeyCache& cache);
 		static void PushLuaValueDict(lua_State* L, const LuaValueDict& dict);
+		static void PushLuaValueDict(lua_State* L, const LuaValueDict& dict, LuaKeyCache& cache);
 		static void PushLuaValueArray(lua_State* L, const LuaValueArray& array);
 
+		/**
+		* Push the error handler used by the calls of LuaHelper.
+		* It is a Traceback closure holding debug.traceback, created once per lua_State and kept in the registry.
+		*/
+		static void PushErrorHandler(lua_State* L);
+
+		/**
+		* The LuaTypeFlag bits of the object metatable at index, read from its "__gc" and "__inline" fields.
+		*/
+		static int MetatableFlags(lua_State* L, int index);
+
+		/**
+		* Push a userdata boxing a pointer to an object, its metatable is left to the caller.
+		* The box has a true user value, which tells it apart from a LuaClass block sharing the metatable.
+		*/
+		static void PushBox(lua_State* L, void* object);
+		static bool IsBox(lua_State* L, int index);
+
 		static int Traceback(lua_State* L);
 		static void CallFunction(lua_State* L, const LuaFunction func, int argc);
+		/**
+		* Release a ref, refs of the LuaFunctionPool are recycled by the pool, others are luaL_unref'ed.
+		*/
 		static void RemoveFunction(lua_State* L, const LuaFunction func);
 
+		/**
+		* Call a function with args and decode its results into results.
+		* The arguments are pushed inside the protected call, which runs with the cached error handler:
+		* a raising push, like a too deep container, fails the call like an error of the function does.
+		* Any error is logged with its traceback. The results are decoded after the call without raising:
+		* missing or nil results keep their current values, so do results of the wrong type, which make the call fail.
+		* Strings are copied, the results can't borrow them: the stack slots are gone once TryCall returns.
+		*
+		* @return false if func is LUA_NOREF, an error was raised or a result has the wrong type.
+		*/
+		template <typename ...R, typename ...ARGS>
+		static bool TryCall(lua_State* L, const LuaFunction func, std::tuple<R...>& results, ARGS&& ...args)
+		{
+			static_assert(!(LuaIsBorrowedString<R>::value || ...), "Results can't borrow strings, use std::string");
+			if (func == LUA_NOREF)
+			{
+				return false;
+			}
+			const int nresults = (int)sizeof...(R);
+			if (!lua_checkstack(L, nresults + 4))
+			{
+				LCH_LOG("[LUA ERROR]: %s", "stack overflow");
+				return false;
+			}
+			auto argv = std::forward_as_tuple(std::forward<ARGS>(args)...);
+			PushErrorHandler(L);															/* L: handler */
+			int errfunc = lua_gettop(L);
+			lua_pushcfunction(L, (ProtectedCallOf<sizeof...(R), decltype(argv)>(std::index_sequence_for<ARGS...>())));	/* L: handler, call */
+			lua_rawgeti(L, LUA_REGISTRYINDEX, func);										/* L: handler, call, func */
+			lua_pushlightuserdata(L, &argv);												/* L: handler, call, func, args */
+			if (lua_pcall(L, 2, nresults, errfunc) != LUA_OK)								/* L: handler, results... */
+			{
+				LCH_LOG("[LUA ERROR]: %s", lua_tostring(L, -1));							/* L: handler, traceback */
+				lua_pop(L, 2);																/* L: */
+				return false;
+			}
+			bool ok = TryResults(L, errfunc + 1, results, std::make_index_sequence<sizeof...(R)>());
+			lua_pop(L, nresults + 1);														/* L: */
+			return ok;
+		}
+
+		/**
+		* Call a function with args and return its results, a std::tuple if there are several of them.
+		* The results are value initialized if the call fails, see TryCall.
+		*
+		*   int sum = LuaHelper::Call<int>(L, onAdd, 1, 2);
+		*   std::tuple<bool, std::string> r = LuaHelper::Call<bool, std::string>(L, onQuery, "name");
+		*/
+		template <typename ...R, typename ...ARGS>
+		static typename LuaCallResult<R...>::Type Call(lua_State* L, const LuaFunction func, ARGS&& ...args)
+		{
+			std::tuple<R...> results;
+			if (!TryCall(L, func, results, std::forward<ARGS>(args)...))
+			{
+				results = std::tuple<R...>();
+			}
+			if constexpr (sizeof...(R) == 1)
+			{
+				return std::get<0>(std::move(results));
+			}
+			else if constexpr (sizeof...(R) > 1)
+			{
+				return results;
+			}
+		}
+
 	private:
+		static void DecodeLuaTable(lua_State* L, int index, LuaTable& val, LuaArena* arena);
+		static void DecodeLuaValue(lua_State* L, int index, LuaValue& val, LuaArena* arena);
+		static void EncodeLuaTable(lua_State* L, const LuaTable& value, LuaKeyCache* cache);
+		static void EncodeLuaValue(lua_State* L, const LuaValue& value, LuaKeyCache* cache);
+		static void EncodeLuaValueDict(lua_State* L, const LuaValueDict& dict, LuaKeyCache* cache);
+		static void EncodeKey(lua_State* L, const char* key, size_t keySize, LuaKeyCache* cache);
+		static void* ToObjectPointer(lua_State* L, int index);
+
+		// the body of the protected call of TryCall: push the arguments and call the function
+		template <int NRESULTS, typename ARGV, size_t ...INDEX>
+		static int ProtectedCall(lua_State* L)
+		{
+			ARGV& argv = *static_cast<ARGV*>(lua_touserdata(L, 2));
+			(void)argv;
+			lua_settop(L, 1);																/* L: func */
+			luaL_checkstack(L, (int)sizeof...(INDEX), "too many arguments");
+			(ResultImpl(L, std::get<INDEX>(argv)), ...);									/* L: func, args... */
+			lua_call(L, (int)sizeof...(INDEX), NRESULTS);									/* L: results... */
+			return NRESULTS;
+		}
+		template <int NRESULTS, typename ARGV, size_t ...INDEX>
+		static lua_CFunction ProtectedCallOf(std::index_sequence<INDEX...>)
+		{
+			return &ProtectedCall<NRESULTS, ARGV, INDEX...>;
+		}
+
+		template <typename ...R, size_t ...INDEX>
+		static bool TryResults(lua_State* L, int base, std::tuple<R...>& results, std::index_sequence<INDEX...>)
+		{
+			(void)L;
+			(void)base;
+			bool ok = true;
+			((ok = TryResult(L, base + (int)INDEX, (int)INDEX + 1, std::get<INDEX>(results)) && ok), ...);
+			return ok;
+		}
+
+		// the decoding of the results of TryCall, it never raises: a result of the wrong type is logged and left alone
+		template <typename T>
+		static bool TryResult(lua_State* L, int index, int position, T& val)
+		{
+			if (lua_isnoneornil(L, index))
+			{
+				return true;
+			}
+			if constexpr (std::is_integral<T>::value)
+			{
+				int isnum = 0;
+				lua_Integer value = lua_tointegerx(L, index, &isnum);
+				if (isnum)
+				{
+					val = (T)value;
+					return true;
+				}
+			}
+			else
+			{
+				// tables, objects, functions and containers are decoded by CheckImpl under a protected call
+				lua_pushcfunction(L, &ProtectedCheck<T>);									/* L: check */
+				lua_pushvalue(L, index);													/* L: check, result */
+				lua_pushlightuserdata(L, &val);												/* L: check, result, val */
+				if (lua_pcall(L, 2, 0, 0) == LUA_OK)										/* L: */
+				{
+					return true;
+				}
+				lua_pop(L, 1);																/* L: */
+			}
+			return ResultError(L, index, position);
+		}
+		static bool TryResult(lua_State* L, int index, int position, float& val);
+		static bool TryResult(lua_State* L, int index, int position, double& val);
+		static bool TryResult(lua_State* L, int index, int position, bool& val);
+		static bool TryResult(lua_State* L, int index, int position, std::string& val);
+		static bool ResultError(lua_State* L, int index, int position);
+
+		template <typename T>
+		static int ProtectedCheck(lua_State* L)
+		{
+			CheckImpl(L, 1, *static_cast<T*>(lua_touserdata(L, 2)), true);
+			return 0;
+		}
+
 		template <typename T>
 		static void CheckImpl(lua_State* L, int index, T& val, bool cannil)
 		{
@@ -108,11 +439,36 @@ namespace LuaCppHelper
 		static void CheckImpl(lua_State* L, int index, float& val, bool cannil);
 		static void CheckImpl(lua_State* L, int index, double& val, bool cannil);
 		static void CheckImpl(lua_State* L, int index, bool& val, bool cannil);
+		static void CheckImpl(lua_State* L, int index, const char*& val, bool cannil);
 		static void CheckImpl(lua_State* L, int index, std::string& val, bool cannil);
+		static void CheckImpl(lua_State* L, int index, std::string_view& val, bool cannil);
+		static void CheckImpl(lua_State* L, int index, LuaStringBuffer& val, bool cannil);
+		static void CheckImpl(lua_State* L, int index, LuaPinnedString& val, bool cannil);
 		static void CheckImpl(lua_State* L, int index, LuaTable& val, bool cannil);
+		static void CheckImpl(lua_State* L, int index, LuaTableRef& val, bool cannil);
 		static void CheckImpl(lua_State* L, int index, LuaObject& val, bool cannil);
 		static void CheckImpl(lua_State* L, int index, LuaFunctionHelper& val, bool cannil);
+		static void CheckImpl(lua_State* L, int index, LuaFunctionRef& val, bool cannil);
 		static void CheckImpl(lua_State* L, int index, LuaValue& val, bool cannil);
+		// objects bound with LuaClass or LuaObjectType, defined in lua_object.h
+		template <typename T>
+		static void CheckImpl(lua_State* L, int index, T*& val, bool cannil);
+		// containers are decoded straight from the table at index, pairs and tuples from an array of their elements,
+		// see the definitions after the class
+		template <typename T>
+		static void CheckImpl(lua_State* L, int index, std::vector<T>& val, bool cannil);
+		template <typename T, size_t N>
+		static void CheckImpl(lua_State* L, int index, std::array<T, N>& val, bool cannil);
+		template <typename K, typename V>
+		static void CheckImpl(lua_State* L, int index, std::unordered_map<K, V>& val, bool cannil);
+		template <typename K, typename V>
+		static void CheckImpl(lua_State* L, int index, std::map<K, V>& val, bool cannil);
+		template <typename A, typename B>
+		static void CheckImpl(lua_State* L, int index, std::pair<A, B>& val, bool cannil);
+		template <typename ...T>
+		static void CheckImpl(lua_State* L, int index, std::tuple<T...>& val, bool cannil);
+		template <typename T>
+		static void CheckImpl(lua_State* L, int index, std::optional<T>& val, bool cannil);
 		template <bool CANNIL, int MINARGC, int INDEX, typename T>
 		static void CheckImpl(lua_State* L, T&& val)
 		{
@@ -138,26 +494,161 @@ namespace LuaCppHelper
 		static void ResultImpl(lua_State* L, const bool& value);
 		static void ResultImpl(lua_State* L, const char * value);
 		static void ResultImpl(lua_State* L, const std::string& value);
+		static void ResultImpl(lua_State* L, const std::string_view& value);
+		static void ResultImpl(lua_State* L, const LuaStringBuffer& value);
 		static void ResultImpl(lua_State* L, const LuaTable& value);
 		static void ResultImpl(lua_State* L, const LuaObject& value);
 		static void ResultImpl(lua_State* L, const LuaFunctionHelper& value);
+		static void ResultImpl(lua_State* L, const LuaFunctionRef& value);
 		static void ResultImpl(lua_State* L, const LuaValue& value);
 		static void ResultImpl(lua_State* L, const LuaValueDict& dict);
 		static void ResultImpl(lua_State* L, const LuaValueArray& array);
+		template <typename T>
+		static void ResultImpl(lua_State* L, const std::vector<T>& value);
+		template <typename T, size_t N>
+		static void ResultImpl(lua_State* L, const std::array<T, N>& value);
+		template <typename K, typename V>
+		static void ResultImpl(lua_State* L, const std::unordered_map<K, V>& value);
+		template <typename K, typename V>
+		static void ResultImpl(lua_State* L, const std::map<K, V>& value);
+		template <typename A, typename B>
+		static void ResultImpl(lua_State* L, const std::pair<A, B>& value);
+		template <typename ...T>
+		static void ResultImpl(lua_State* L, const std::tuple<T...>& value);
+		template <typename T>
+		static void ResultImpl(lua_State* L, const std::optional<T>& value);
+
+		// the elements of the containers are decoded from a temporary slot, an element of the wrong type is reported
+		// against the argument arg of the outermost container, with its position
+		template <typename T>
+		static void CheckNested(lua_State* L, int index, int arg, T& val)
+		{
+			static_assert(!LuaIsBorrowedString<T>::value, "Elements can't borrow strings, use std::string");
+			(void)arg;
+			CheckImpl(L, index, val, false);
+		}
+		template <typename T>
+		static void CheckNested(lua_State* L, int index, int arg, std::vector<T>& val);
+		template <typename T, size_t N>
+		static void CheckNested(lua_State* L, int index, int arg, std::array<T, N>& val);
+		template <typename K, typename V>
+		static void CheckNested(lua_State* L, int index, int arg, std::unordered_map<K, V>& val) { CheckMap(L, index, arg, val); }
+		template <typename K, typename V>
+		static void CheckNested(lua_State* L, int index, int arg, std::map<K, V>& val) { CheckMap(L, index, arg, val); }
+		template <typename A, typename B>
+		static void CheckNested(lua_State* L, int index, int arg, std::pair<A, B>& val);
+		template <typename ...T>
+		static void CheckNested(lua_State* L, int index, int arg, std::tuple<T...>& val)
+		{
+			CheckTuple(L, index, arg, val, std::index_sequence_for<T...>());
+		}
+		template <typename T>
+		static void CheckNested(lua_State* L, int index, int arg, std::optional<T>& val);
+
+		// the lua type expected for a T if the value at index can't be decoded into one, nullptr otherwise
+		template <typename T>
+		static const char* ElementMismatch(lua_State* L, int index)
+		{
+			if constexpr (std::is_same<T, bool>::value)
+			{
+				return lua_isboolean(L, index) ? nullptr : "boolean";
+			}
+			else if constexpr (std::is_integral<T>::value)
+			{
+				int isnum = 0;
+				lua_tointegerx(L, index, &isnum);
+				return isnum ? nullptr : "integer";
+			}
+			else if constexpr (std::is_floating_point<T>::value)
+			{
+				return lua_isnumber(L, index) ? nullptr : "number";
+			}
+			else if constexpr (std::is_same<T, std::string>::value || std::is_same<T, LuaPinnedString>::value)
+			{
+				return lua_isstring(L, index) ? nullptr : "string";
+			}
+			else if constexpr (LuaIsTableType<T>::value)
+			{
+				return lua_istable(L, index) ? nullptr : "table";
+			}
+			else if constexpr (std::is_pointer<T>::value)
+			{
+				return lua_type(L, index) == LUA_TUSERDATA ? nullptr : "userdata";
+			}
+			else
+			{
+				(void)L;
+				(void)index;
+				return nullptr;
+			}
+		}
+		template <typename T>
+		static void CheckElement(lua_State* L, int index, int arg, lua_Integer n, T& val)
+		{
+			lua_rawgeti(L, index, n);														/* L: element */
+			int element = lua_gettop(L);
+			const char* expected = ElementMismatch<T>(L, element);
+			if (expected != nullptr)
+			{
+				luaL_argerror(L, arg, lua_pushfstring(L, "element #%I: %s expected, got %s", n, expected, luaL_typename(L, element)));
+			}
+			CheckNested(L, element, arg, val);
+			lua_pop(L, 1);																	/* L: */
+		}
+		template <typename T>
+		static void PushElement(lua_State* L, lua_Integer n, const T& value)
+		{
+			ResultImpl(L, value);															/* L: table, element */
+			lua_rawseti(L, -2, n);															/* L: table */
+		}
+		template <typename MAP>
+		static void CheckMap(lua_State* L, int index, int arg, MAP& val);
+		template <typename MAP>
+		static void PushMap(lua_State* L, const MAP& value);
+		template <typename TUPLE, size_t ...INDEX>
+		static void CheckTuple(lua_State* L, int index, int arg, TUPLE& val, std::index_sequence<INDEX...>);
+		template <typename TUPLE, size_t ...INDEX>
+		static void PushTuple(lua_State* L, const TUPLE& value, std::index_sequence<INDEX...>);
 
 	public:
+		/**
+		* Check the arguments from index 1, with CANNIL the arguments after MINARGC may be nil or missing
+		* and keep their current values then. A std::optional argument is reset when it is nil or missing,
+		* which needs neither CANNIL nor MINARGC.
+		*/
 		template <bool CANNIL, int MINARGC, typename ...ARGS>
 		static void Check(lua_State* L, ARGS&& ...args)
 		{
+			LCH_STATS_DECODE_BEGIN();
 			CheckImpl<CANNIL, MINARGC, 1>(L, std::forward<ARGS>(args)...);
+			LCH_STATS_DECODE_END();
 		}
 		template <typename ...ARGS>
 		static void Check(lua_State* L, ARGS&& ...args)
 		{
+			LCH_STATS_DECODE_BEGIN();
 			CheckImpl<false, 0, 1>(L, std::forward<ARGS>(args)...);
+			LCH_STATS_DECODE_END();
+		}
+
+		/**
+		* Check a single argument at index and return it, used by the generated bindings in lua_bind.h.
+		*/
+		template <typename T>
+		static T CheckArgument(lua_State* L, int index)
+		{
+			LCH_STATS_DECODE_BEGIN();
+			T val = T();
+			CheckImpl(L, index, val, false);
+			LCH_STATS_DECODE_END();
+			return val;
 		}
 
 		static int result(lua_State* L);
+		static int Result(lua_State*)
+		{
+			return 0;
+		}
 		template <typename T>
 		static int Result(lua_State* L, T&& value)
 		{
@@ -168,11 +659,282 @@ namespace LuaCppHelper
 		static int Result(lua_State* L, T&& value, ARGS&& ...args)
 		{
 			ResultImpl(L, value);
-			return result(L, std::forward<ARGS>(args)...) + 1;
+			return Result(L, std::forward<ARGS>(args)...) + 1;
 		}
 
 	public:
 		static const LuaValue NilValue;
 	};
 
+	template <typename T>
+	void LuaHelper::CheckImpl(lua_State* L, int index, std::vector<T>& val, bool cannil)
+	{
+		if (cannil && lua_isnoneornil(L, index))
+		{
+			return;
+		}
+		CheckNested(L, index, index, val);
+	}
+
+	template <typename T>
+	void LuaHelper::CheckNested(lua_State* L, int index, int arg, std::vector<T>& val)
+	{
+		luaL_checktype(L, index, LUA_TTABLE);
+		index = lua_absindex(L, index);
+		luaL_checkstack(L, 3, "table too deep");
+		size_t size = lua_rawlen(L, index);
+		if constexpr (std::is_same<T, bool>::value)
+		{
+			val.clear();
+			val.reserve(size);
+			for (size_t i = 0; i < size; ++i)
+			{
+				bool element = false;
+				CheckElement(L, index, arg, (lua_Integer)i + 1, element);
+				val.push_back(element);
+			}
+		}
+		else
+		{
+			// the elements already in val are decoded into, so strings and nested containers keep their capacity
+			val.resize(size);
+			for (size_t i = 0; i < size; ++i)
+			{
+				CheckElement(L, index, arg, (lua_Integer)i + 1, val[i]);
+			}
+		}
+	}
+
+	template <typename T, size_t N>
+	void LuaHelper::CheckImpl(lua_State* L, int index, std::array<T, N>& val, bool cannil)
+	{
+		if (cannil && lua_isnoneornil(L, index))
+		{
+			return;
+		}
+		CheckNested(L, index, index, val);
+	}
+
+	template <typename T, size_t N>
+	void LuaHelper::CheckNested(lua_State* L, int index, int arg, std::array<T, N>& val)
+	{
+		luaL_checktype(L, index, LUA_TTABLE);
+		index = lua_absindex(L, index);
+		luaL_checkstack(L, 3, "table too deep");
+		for (size_t i = 0; i < N; ++i)
+		{
+			CheckElement(L, index, arg, (lua_Integer)i + 1, val[i]);
+		}
+	}
+
+	template <typename K, typename V>
+	void LuaHelper::CheckImpl(lua_State* L, int index, std::unordered_map<K, V>& val, bool cannil)
+	{
+		if (cannil && lua_isnoneornil(L, index))
+		{
+			return;
+		}
+		CheckMap(L, index, index, val);
+	}
+
+	template <typename K, typename V>
+	void LuaHelper::CheckImpl(lua_State* L, int index, std::map<K, V>& val, bool cannil)
+	{
+		if (cannil && lua_isnoneornil(L, index))
+		{
+			return;
+		}
+		CheckMap(L, index, index, val);
+	}
+
+	template <typename MAP>
+	void LuaHelper::CheckMap(lua_State* L, int index, int arg, MAP& val)
+	{
+		typedef typename MAP::key_type KeyType;
+		typedef typename MAP::mapped_type ValueType;
+		luaL_checktype(L, index, LUA_TTABLE);
+		index = lua_absindex(L, index);
+		luaL_checkstack(L, 5, "table too deep");
+		val.clear();
+		lua_pushnil(L);																		/* L: nil */
+		while (lua_next(L, index) != 0)														/* L: key, value */
+		{
+			KeyType key = KeyType();
+			ValueType value = ValueType();
+			// the key is decoded from a copy, converting it in place would break lua_next
+			lua_pushvalue(L, -2);															/* L: key, value, key */
+			int top = lua_gettop(L);
+			const char* expected = ElementMismatch<KeyType>(L, top);
+			if (expected != nullptr)
+			{
+				luaL_argerror(L, arg, lua_pushfstring(L, "%s key expected, got %s", expected, luaL_typename(L, top)));
+			}
+			expected = ElementMismatch<ValueType>(L, top - 1);
+			if (expected != nullptr)
+			{
+				const char* field = lua_type(L, top) == LUA_TSTRING ? lua_pushfstring(L, "'%s'", lua_tostring(L, top))
+					: lua_isinteger(L, top) ? lua_pushfstring(L, "#%I", lua_tointeger(L, top)) : luaL_typename(L, top);
+				luaL_argerror(L, arg, lua_pushfstring(L, "field %s: %s expected, got %s", field, expected, luaL_typename(L, top - 1)));
+			}
+			CheckNested(L, top, arg, key);
+			CheckNested(L, top - 1, arg, value);
+			lua_pop(L, 2);																	/* L: key */
+			val.insert_or_assign(std::move(key), std::move(value));
+		}
+	}
+
+	template <typename A, typename B>
+	void LuaHelper::CheckImpl(lua_State* L, int index, std::pair<A, B>& val, bool cannil)
+	{
+		if (cannil && lua_isnoneornil(L, index))
+		{
+			return;
+		}
+		CheckNested(L, index, index, val);
+	}
+
+	template <typename A, typename B>
+	void LuaHelper::CheckNested(lua_State* L, int index, int arg, std::pair<A, B>& val)
+	{
+		luaL_checktype(L, index, LUA_TTABLE);
+		index = lua_absindex(L, index);
+		luaL_checkstack(L, 3, "table too deep");
+		CheckElement(L, index, arg, 1, val.first);
+		CheckElement(L, index, arg, 2, val.second);
+	}
+
+	template <typename ...T>
+	void LuaHelper::CheckImpl(lua_State* L, int index, std::tuple<T...>& val, bool cannil)
+	{
+		if (cannil && lua_isnoneornil(L, index))
+		{
+			return;
+		}
+		CheckTuple(L, index, index, val, std::index_sequence_for<T...>());
+	}
+
+	template <typename TUPLE, size_t ...INDEX>
+	void LuaHelper::CheckTuple(lua_State* L, int index, int arg, TUPLE& val, std::index_sequence<INDEX...>)
+	{
+		luaL_checktype(L, index, LUA_TTABLE);
+		index = lua_absindex(L, index);
+		luaL_checkstack(L, 3, "table too deep");
+		(void)arg;
+		(CheckElement(L, index, arg, (lua_Integer)INDEX + 1, std::get<INDEX>(val)), ...);
+	}
+
+	template <typename T>
+	void LuaHelper::CheckImpl(lua_State* L, int index, std::optional<T>& val, bool)
+	{
+		if (lua_isnoneornil(L, index))
+		{
+			val.reset();
+			return;
+		}
+		if (!val.has_value())
+		{
+			val.emplace();
+		}
+		CheckImpl(L, index, *val, false);
+	}
+
+	template <typename T>
+	void LuaHelper::CheckNested(lua_State* L, int index, int arg, std::optional<T>& val)
+	{
+		if (lua_isnoneornil(L, index))
+		{
+			val.reset();
+			return;
+		}
+		if (!val.has_value())
+		{
+			val.emplace();
+		}
+		CheckNested(L, index, arg, *val);
+	}
+
+	template <typename T>
+	void LuaHelper::ResultImpl(lua_State* L, const std::vector<T>& value)
+	{
+		luaL_checkstack(L, 2, "table too deep");
+		lua_createtable(L, value.size() < INT_MAX ? (int)value.size() : INT_MAX, 0);		/* L: table */
+		lua_Integer n = 0;
+		for (const auto& element : value)
+		{
+			PushElement(L, ++n, element);
+		}
+	}
+
+	template <typename T, size_t N>
+	void LuaHelper::ResultImpl(lua_State* L, const std::array<T, N>& value)
+	{
+		luaL_checkstack(L, 2, "table too deep");
+		lua_createtable(L, (int)N, 0);														/* L: table */
+		for (size_t i = 0; i < N; ++i)
+		{
+			PushElement(L, (lua_Integer)i + 1, value[i]);
+		}
+	}
+
+	template <typename K, typename V>
+	void LuaHelper::ResultImpl(lua_State* L, const std::unordered_map<K, V>& value)
+	{
+		PushMap(L, value);
+	}
+
+	template <typename K, typename V>
+	void LuaHelper::ResultImpl(lua_State* L, const std::map<K, V>& value)
+	{
+		PushMap(L, value);
+	}
+
+	template <typename MAP>
+	void LuaHelper::PushMap(lua_State* L, const MAP& value)
+	{
+		luaL_checkstack(L, 3, "table too deep");
+		lua_createtable(L, 0, value.size() < INT_MAX ? (int)value.size() : INT_MAX);		/* L: table */
+		for (const auto& pair : value)
+		{
+			ResultImpl(L, pair.first);														/* L: table, key */
+			ResultImpl(L, pair.second);														/* L: table, key, value */
+			lua_rawset(L, -3);																/* L: table */
+		}
+	}
+
+	template <typename A, typename B>
+	void LuaHelper::ResultImpl(lua_State* L, const std::pair<A, B>& value)
+	{
+		luaL_checkstack(L, 2, "table too deep");
+		lua_createtable(L, 2, 0);															/* L: table */
+		PushElement(L, 1, value.first);
+		PushElement(L, 2, value.second);
+	}
+
+	template <typename ...T>
+	void LuaHelper::ResultImpl(lua_State* L, const std::tuple<T...>& value)
+	{
+		PushTuple(L, value, std::index_sequence_for<T...>());
+	}
+
+	template <typename TUPLE, size_t ...INDEX>
+	void LuaHelper::PushTuple(lua_State* L, const TUPLE& value, std::index_sequence<INDEX...>)
+	{
+		luaL_checkstack(L, 2, "table too deep");
+		lua_createtable(L, (int)sizeof...(INDEX), 0);										/* L: table */
+		(PushElement(L, (lua_Integer)INDEX + 1, std::get<INDEX>(value)), ...);
+	}
+
+	template <typename T>
+	void LuaHelper::ResultImpl(lua_State* L, const std::optional<T>& value)
+	{
+		if (value.has_value())
+		{
+			ResultImpl(L, *value);
+		}
+		else
+		{
+			lua_pushnil(L);
+		}
+	}
+
 }
@@ -0,0 +1,989 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "lua_json.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LCH_JSON_SSE2 1
+#endif
+
+namespace LuaCppHelper
+{
+
+	namespace
+	{
+		// deeper documents are rejected instead of exhausting the C stack
+		const int MaxDepth = 200;
+
+		const double Pow10[] = {
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+			1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+		};
+
+		inline bool IsDigit(char c)
+		{
+			return (unsigned char)(c - '0') < 10;
+		}
+
+		inline int HexValue(char c)
+		{
+			if (IsDigit(c)) return c - '0';
+			if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+			if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+			return -1;
+		}
+
+		inline bool NeedsEscape(unsigned char c)
+		{
+			return c == '"' || c == '\\' || c < 0x20;
+		}
+
+		// skip the characters of a string body which need no special care:
+		// stop at '"', '\\' or a control character, or at end
+		inline const char* ScanString(const char* p, const char* end)
+		{
+#ifdef LCH_JSON_SSE2
+			const __m128i quote = _mm_set1_epi8('"');
+			const __m128i backslash = _mm_set1_epi8('\\');
+			const __m128i control = _mm_set1_epi8(0x1f);
+			while (end - p >= 16)
+			{
+				__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+				__m128i special = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash));
+				// c <= 0x1f <=> max(c, 0x1f) == 0x1f, unsigned
+				special = _mm_or_si128(special, _mm_cmpeq_epi8(_mm_max_epu8(chunk, control), control));
+				int mask = _mm_movemask_epi8(special);
+				if (mask != 0)
+				{
+#if defined(_MSC_VER) && !defined(__clang__)
+					unsigned long bit;
+					_BitScanForward(&bit, (unsigned long)mask);
+					return p + bit;
+#else
+					return p + __builtin_ctz((unsigned int)mask);
+#endif
+				}
+				p += 16;
+			}
+#endif
+			while (p != end && !NeedsEscape((unsigned char)*p))
+			{
+				++p;
+			}
+			return p;
+		}
+
+		void AppendUtf8(std::string& out, unsigned int code)
+		{
+			if (code < 0x80)
+			{
+				out += (char)code;
+			}
+			else if (code < 0x800)
+			{
+				out += (char)(0xc0 | (code >> 6));
+				out += (char)(0x80 | (code & 0x3f));
+			}
+			else if (code < 0x10000)
+			{
+				out += (char)(0xe0 | (code >> 12));
+				out += (char)(0x80 | ((code >> 6) & 0x3f));
+				out += (char)(0x80 | (code & 0x3f));
+			}
+			else
+			{
+				out += (char)(0xf0 | (code >> 18));
+				out += (char)(0x80 | ((code >> 12) & 0x3f));
+				out += (char)(0x80 | ((code >> 6) & 0x3f));
+				out += (char)(0x80 | (code & 0x3f));
+			}
+		}
+
+		void AppendInteger(std::string& out, long long value)
+		{
+			char buffer[24];
+			std::to_chars_result result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+			out.append(buffer, result.ptr);
+		}
+
+		bool AppendNumber(std::string& out, double value)
+		{
+			if (!std::isfinite(value))
+			{
+				return false;
+			}
+			char buffer[32];
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+			// the shortest text which reads back to the same double
+			char* end = std::to_chars(buffer, buffer + sizeof(buffer), value).ptr;
+#else
+			char* end = buffer + snprintf(buffer, sizeof(buffer), "%.17g", value);
+#endif
+			out.append(buffer, end);
+			// keep the float a float when it is decoded again
+			for (char* p = buffer; p != end; ++p)
+			{
+				if (*p == '.' || *p == 'e' || *p == 'E')
+				{
+					return true;
+				}
+			}
+			out += ".0";
+			return true;
+		}
+
+		void AppendString(std::string& out, const char* data, size_t size)
+		{
+			static const char hex[] = "0123456789abcdef";
+			const char* end = data + size;
+			out.reserve(out.size() + size + 2);
+			out += '"';
+			while (data != end)
+			{
+				const char* plain = ScanString(data, end);
+				out.append(data, plain);
+				if (plain == end)
+				{
+					break;
+				}
+				unsigned char c = (unsigned char)*plain;
+				switch (c)
+				{
+				case '"': out += "\\\""; break;
+				case '\\': out += "\\\\"; break;
+				case '\b': out += "\\b"; break;
+				case '\f': out += "\\f"; break;
+				case '\n': out += "\\n"; break;
+				case '\r': out += "\\r"; break;
+				case '\t': out += "\\t"; break;
+				default:
+				{
+					char escaped[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+					out.append(escaped, sizeof(escaped));
+				}
+				break;
+				}
+				data = plain + 1;
+			}
+			out += '"';
+		}
+
+		void SetError(std::string* error, const char* message, size_t offset)
+		{
+			if (error != nullptr)
+			{
+				char buffer[128];
+				snprintf(buffer, sizeof(buffer), "%s at offset %zu", message, offset);
+				*error = buffer;
+			}
+		}
+
+		/**
+		* Build a LuaValue tree. The elements and the members of the open containers wait on a stack,
+		* a table is only created when it is closed, with the exact size of its array or hash part.
+		*/
+		class ValueBuilder
+		{
+		public:
+			explicit ValueBuilder(LuaArena* arena) : _arena(arena) {}
+
+			void Null(void) { _values.emplace_back(); }
+			void Boolean(bool value) { _values.push_back(LuaValue::BooleanValue(value)); }
+			void Integer(long long value) { _values.push_back(LuaValue::IntValue(value)); }
+			void Number(double value) { _values.push_back(LuaValue::NumberValue(value)); }
+			void String(const char* data, size_t size)
+			{
+				_values.push_back(_arena != nullptr ? LuaValue::StringValue(data, size, *_arena) : LuaValue::StringValue(data, size));
+			}
+
+			void BeginArray(void) { _frames.push_back(_values.size()); }
+			void ArrayElement(long long) {}
+			void EndArray(void)
+			{
+				size_t start = _frames.back();
+				LuaTable table(_arena);
+				table.Reserve(_values.size() - start, 0);
+				for (size_t i = start; i < _values.size(); ++i)
+				{
+					table.Append(std::move(_values[i]));
+				}
+				EndTable(start, std::move(table));
+			}
+
+			void BeginObject(void) { _frames.push_back(_values.size()); }
+			// copied, the key may point into the scratch buffer of the parser
+			void Key(const char* data, size_t size) { _values.push_back(LuaValue::StringValue(data, size)); }
+			void ObjectMember(void) {}
+			void EndObject(void)
+			{
+				size_t start = _frames.back();
+				LuaTable table(_arena);
+				table.Reserve(0, (_values.size() - start) / 2);
+				for (size_t i = start; i + 1 < _values.size(); i += 2)
+				{
+					const LuaValue& key = _values[i];
+					if (_values[i + 1].getType() != LuaValueTypeNil)
+					{
+						table.Set(key.StringData(), key.StringSize(), std::move(_values[i + 1]));
+					}
+				}
+				EndTable(start, std::move(table));
+			}
+
+			LuaValue Result(void) { return std::move(_values.back()); }
+
+		private:
+			void EndTable(size_t start, LuaTable&& table)
+			{
+				_values.resize(start);
+				_frames.pop_back();
+				if (_arena != nullptr)
+				{
+					_values.push_back(LuaValue::TableValue(std::move(table), *_arena));
+				}
+				else
+				{
+					_values.push_back(LuaValue::TableValue(std::move(table)));
+				}
+			}
+
+			LuaArena*				_arena;
+			std::vector<LuaValue>	_values;
+			std::vector<size_t>		_frames;	// where the open containers start in _values
+		};
+
+		/**
+		* Build the value on the lua stack with the LuaHelper push functions.
+		*/
+		class StackBuilder
+		{
+		public:
+			explicit StackBuilder(lua_State* L) : _L(L) {}
+
+			void Null(void) { Reserve(); LuaHelper::PushNil(_L); }
+			void Boolean(bool value) { Reserve(); LuaHelper::PushBoolean(_L, value); }
+			void Integer(long long value) { Reserve(); LuaHelper::PushInteger(_L, value); }
+			void Number(double value) { Reserve(); LuaHelper::PushNumber(_L, value); }
+			void String(const char* data, size_t size) { Reserve(); LuaHelper::PushString(_L, std::string_view(data, size)); }
+
+			void BeginArray(void) { Reserve(); lua_newtable(_L); }
+			void ArrayElement(long long index) { lua_rawseti(_L, -2, index); }
+			void EndArray(void) {}
+
+			void BeginObject(void) { Reserve(); lua_newtable(_L); }
+			void Key(const char* data, size_t size) { String(data, size); }
+			void ObjectMember(void) { lua_rawset(_L, -3); }
+			void EndObject(void) {}
+
+		private:
+			void Reserve(void) { luaL_checkstack(_L, 2, "JSON too deep"); }
+
+			lua_State*	_L;
+		};
+
+		template <typename BUILDER>
+		class Parser
+		{
+		public:
+			Parser(const char* data, size_t size, BUILDER& builder)
+				: _begin(data), _p(data), _end(data + size), _builder(builder), _error(nullptr)
+			{
+			}
+
+			bool Parse(std::string* error)
+			{
+				SkipSpace();
+				if (ParseValue(0))
+				{
+					SkipSpace();
+					if (_p == _end)
+					{
+						return true;
+					}
+					Fail("unexpected trailing characters");
+				}
+				SetError(error, _error != nullptr ? _error : "malformed JSON", (size_t)(_p - _begin));
+				return false;
+			}
+
+		private:
+			bool Fail(const char* message)
+			{
+				if (_error == nullptr)
+				{
+					_error = message;
+				}
+				return false;
+			}
+
+			void SkipSpace(void)
+			{
+				while (_p != _end && (*_p == ' ' || *_p == '\n' || *_p == '\r' || *_p == '\t'))
+				{
+					++_p;
+				}
+			}
+
+			bool Match(const char* literal, size_t size)
+			{
+				if ((size_t)(_end - _p) < size || memcmp(_p, literal, size) != 0)
+				{
+					return Fail("invalid literal");
+				}
+				_p += size;
+				return true;
+			}
+
+			bool ParseValue(int depth)
+			{
+				if (_p == _end)
+				{
+					return Fail("unexpected end");
+				}
+				switch (*_p)
+				{
+				case '{': return depth < MaxDepth ? ParseObject(depth) : Fail("too deep");
+				case '[': return depth < MaxDepth ? ParseArray(depth) : Fail("too deep");
+				case '"':
+				{
+					const char* data;
+					size_t size;
+					if (!ParseString(data, size))
+					{
+						return false;
+					}
+					_builder.String(data, size);
+					return true;
+				}
+				case 't':
+					if (!Match("true", 4)) return false;
+					_builder.Boolean(true);
+					return true;
+				case 'f':
+					if (!Match("false", 5)) return false;
+					_builder.Boolean(false);
+					return true;
+				case 'n':
+					if (!Match("null", 4)) return false;
+					_builder.Null();
+					return true;
+				default:
+					return ParseNumber();
+				}
+			}
+
+			bool ParseArray(int depth)
+			{
+				++_p;
+				_builder.BeginArray();
+				SkipSpace();
+				if (_p != _end && *_p == ']')
+				{
+					++_p;
+					_builder.EndArray();
+					return true;
+				}
+				for (long long index = 1; ; ++index)
+				{
+					if (!ParseValue(depth + 1))
+					{
+						return false;
+					}
+					_builder.ArrayElement(index);
+					SkipSpace();
+					if (_p == _end)
+					{
+						return Fail("unexpected end");
+					}
+					if (*_p == ']')
+					{
+						++_p;
+						_builder.EndArray();
+						return true;
+					}
+					if (*_p != ',')
+					{
+						return Fail("expected ',' or ']'");
+					}
+					++_p;
+					SkipSpace();
+				}
+			}
+
+			bool ParseObject(int depth)
+			{
+				++_p;
+				_builder.BeginObject();
+				SkipSpace();
+				if (_p != _end && *_p == '}')
+				{
+					++_p;
+					_builder.EndObject();
+					return true;
+				}
+				for (;;)
+				{
+					const char* key;
+					size_t keySize;
+					if (_p == _end || *_p != '"')
+					{
+						return Fail("expected a key");
+					}
+					if (!ParseString(key, keySize))
+					{
+						return false;
+					}
+					_builder.Key(key, keySize);
+					SkipSpace();
+					if (_p == _end || *_p != ':')
+					{
+						return Fail("expected ':'");
+					}
+					++_p;
+					SkipSpace();
+					if (!ParseValue(depth + 1))
+					{
+						return false;
+					}
+					_builder.ObjectMember();
+					SkipSpace();
+					if (_p == _end)
+					{
+						return Fail("unexpected end");
+					}
+					if (*_p == '}')
+					{
+						++_p;
+						_builder.EndObject();
+						return true;
+					}
+					if (*_p != ',')
+					{
+						return Fail("expected ',' or '}'");
+					}
+					++_p;
+					SkipSpace();
+				}
+			}
+
+			// the result points into the input when there is no escape, into _scratch otherwise
+			bool ParseString(const char*& data, size_t& size)
+			{
+				const char* start = ++_p;
+				_p = ScanString(_p, _end);
+				if (_p != _end && *_p == '"')
+				{
+					data = start;
+					size = (size_t)(_p - start);
+					++_p;
+					return true;
+				}
+				_scratch.assign(start, _p);
+				for (;;)
+				{
+					if (_p == _end)
+					{
+						return Fail("unterminated string");
+					}
+					char c = *_p;
+					if (c == '"')
+					{
+						++_p;
+						break;
+					}
+					if (c != '\\')
+					{
+						return Fail("control character in string");
+					}
+					if (++_p == _end)
+					{
+						return Fail("unterminated string");
+					}
+					switch (*_p++)
+					{
+					case '"': _scratch += '"'; break;
+					case '\\': _scratch += '\\'; break;
+					case '/': _scratch += '/'; break;
+					case 'b': _scratch += '\b'; break;
+					case 'f': _scratch += '\f'; break;
+					case 'n': _scratch += '\n'; break;
+					case 'r': _scratch += '\r'; break;
+					case 't': _scratch += '\t'; break;
+					case 'u':
+					{
+						unsigned int code;
+						if (!ParseHex4(code))
+						{
+							return false;
+						}
+						if (code >= 0xd800 && code < 0xdc00)
+						{
+							// a high surrogate must be followed by a low one
+							unsigned int low;
+							if (_end - _p < 2 || _p[0] != '\\' || _p[1] != 'u')
+							{
+								return Fail("invalid surrogate pair");
+							}
+							_p += 2;
+							if (!ParseHex4(low) || low < 0xdc00 || low >= 0xe000)
+							{
+								return Fail("invalid surrogate pair");
+							}
+							code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+						}
+						AppendUtf8(_scratch, code);
+					}
+					break;
+					default:
+						return Fail("invalid escape");
+					}
+					const char* plain = _p;
+					_p = ScanString(_p, _end);
+					_scratch.append(plain, _p);
+				}
+				data = _scratch.data();
+				size = _scratch.size();
+				return true;
+			}
+
+			bool ParseHex4(unsigned int& code)
+			{
+				if (_end - _p < 4)
+				{
+					return Fail("invalid \\u escape");
+				}
+				code = 0;
+				for (int i = 0; i < 4; ++i)
+				{
+					int digit = HexValue(_p[i]);
+					if (digit < 0)
+					{
+						return Fail("invalid \\u escape");
+					}
+					code = (code << 4) | (unsigned int)digit;
+				}
+				_p += 4;
+				return true;
+			}
+
+			bool ParseNumber(void)
+			{
+				const char* start = _p;
+				bool negative = *_p == '-';
+				if (negative)
+				{
+					++_p;
+				}
+				if (_p == _end || !IsDigit(*_p))
+				{
+					return Fail("invalid value");
+				}
+				unsigned long long mantissa = 0;
+				int digits = 0;			// digits accumulated in mantissa
+				bool truncated = false;	// more digits than mantissa holds
+				int exponent = 0;
+				bool integer = true;
+				if (*_p == '0')
+				{
+					++_p;
+				}
+				else
+				{
+					for (; _p != _end && IsDigit(*_p); ++_p)
+					{
+						if (digits < 19)
+						{
+							mantissa = mantissa * 10 + (unsigned long long)(*_p - '0');
+							++digits;
+						}
+						else
+						{
+							truncated = true;
+							++exponent;
+						}
+					}
+				}
+				if (_p != _end && *_p == '.')
+				{
+					integer = false;
+					if (++_p == _end || !IsDigit(*_p))
+					{
+						return Fail("invalid number");
+					}
+					for (; _p != _end && IsDigit(*_p); ++_p)
+					{
+						if (digits < 19)
+						{
+							mantissa = mantissa * 10 + (unsigned long long)(*_p - '0');
+							// leading zeros don't use up the precision of the mantissa
+							digits += mantissa != 0 ? 1 : 0;
+							--exponent;
+						}
+						else
+						{
+							truncated = true;
+						}
+					}
+				}
+				if (_p != _end && (*_p == 'e' || *_p == 'E'))
+				{
+					integer = false;
+					if (++_p != _end && (*_p == '+' || *_p == '-'))
+					{
+						++_p;
+					}
+					if (_p == _end || !IsDigit(*_p))
+					{
+						return Fail("invalid number");
+					}
+					bool negativeExponent = _p[-1] == '-';
+					int value = 0;
+					for (; _p != _end && IsDigit(*_p); ++_p)
+					{
+						if (value < 100000)
+						{
+							value = value * 10 + (*_p - '0');
+						}
+					}
+					exponent += negativeExponent ? -value : value;
+				}
+
+				if (integer && !truncated)
+				{
+					if (!negative && mantissa <= 9223372036854775807ULL)
+					{
+						_builder.Integer((long long)mantissa);
+						return true;
+					}
+					if (negative && mantissa <= 9223372036854775808ULL)
+					{
+						_builder.Integer((long long)(0 - mantissa));
+						return true;
+					}
+				}
+				if (!truncated && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22)
+				{
+					// both the mantissa and the power of ten are exact doubles, one rounding only
+					double value = (double)mantissa;
+					value = exponent < 0 ? value / Pow10[-exponent] : value * Pow10[exponent];
+					_builder.Number(negative ? -value : value);
+					return true;
+				}
+				_scratch.assign(start, _p);
+				_builder.Number(strtod(_scratch.c_str(), nullptr));
+				return true;
+			}
+
+			const char*		_begin;
+			const char*		_p;
+			const char*		_end;
+			BUILDER&		_builder;
+			const char*		_error;
+			std::string		_scratch;
+		};
+
+		class ValueWriter
+		{
+		public:
+			ValueWriter(std::string& out) : _out(out), _error(nullptr) {}
+
+			bool Write(const LuaValue& value, int depth)
+			{
+				switch (value.getType())
+				{
+				case LuaValueTypeNil:
+					_out += "null";
+					return true;
+				case LuaValueTypeInt:
+					AppendInteger(_out, value.IntValue());
+					return true;
+				case LuaValueTypeFloat:
+					return AppendNumber(_out, value.NumberValue()) || Fail("number can't be encoded");
+				case LuaValueTypeBoolean:
+					_out += value.BooleanValue() ? "true" : "false";
+					return true;
+				case LuaValueTypeString:
+					AppendString(_out, value.StringData(), value.StringSize());
+					return true;
+				case LuaValueTypeTable:
+					return depth < MaxDepth ? WriteTable(value.TableValue(), depth) : Fail("too deep");
+				default:
+					return Fail("value can't be encoded");
+				}
+			}
+
+			const char* Error(void) const { return _error; }
+
+		private:
+			bool Fail(const char* message)
+			{
+				_error = message;
+				return false;
+			}
+
+			bool WriteTable(const LuaTable& table, int depth)
+			{
+				size_t count = table.Size();
+				bool array = count > 0;
+				long long maxKey = (long long)table.ArraySize();
+				for (LuaTableHashIterator it = table.HashBegin(); array && it != table.HashEnd(); ++it)
+				{
+					array = it->key.getType() == LuaValueTypeInt && it->key.IntValue() >= 1;
+					maxKey = array && it->key.IntValue() > maxKey ? it->key.IntValue() : maxKey;
+				}
+				if (array && (unsigned long long)maxKey <= count * 2)
+				{
+					_out += '[';
+					for (long long key = 1; key <= maxKey; ++key)
+					{
+						if (key > 1)
+						{
+							_out += ',';
+						}
+						const LuaValue* element = table.Find(key);
+						if (!Write(element != nullptr ? *element : LuaHelper::NilValue, depth + 1))
+						{
+							return false;
+						}
+					}
+					_out += ']';
+					return true;
+				}
+				_out += '{';
+				bool first = true;
+				long long key = 1;
+				for (LuaTableArrayIterator it = table.ArrayBegin(); it != table.ArrayEnd(); ++it, ++key)
+				{
+					_out += first ? "\"" : ",\"";
+					first = false;
+					AppendInteger(_out, key);
+					_out += "\":";
+					if (!Write(*it, depth + 1))
+					{
+						return false;
+					}
+				}
+				for (LuaTableHashIterator it = table.HashBegin(); it != table.HashEnd(); ++it)
+				{
+					if (!first)
+					{
+						_out += ',';
+					}
+					first = false;
+					if (it->key.getType() == LuaValueTypeInt)
+					{
+						_out += '"';
+						AppendInteger(_out, it->key.IntValue());
+						_out += '"';
+					}
+					else
+					{
+						AppendString(_out, it->key.StringData(), it->key.StringSize());
+					}
+					_out += ':';
+					if (!Write(it->value, depth + 1))
+					{
+						return false;
+					}
+				}
+				_out += '}';
+				return true;
+			}
+
+			std::string&	_out;
+			const char*		_error;
+		};
+
+		class StackWriter
+		{
+		public:
+			StackWriter(lua_State* L, std::string& out) : _L(L), _out(out), _error(nullptr) {}
+
+			bool Write(int index, int depth)
+			{
+				switch (lua_type(_L, index))
+				{
+				case LUA_TNIL:
+					_out += "null";
+					return true;
+				case LUA_TBOOLEAN:
+					_out += lua_toboolean(_L, index) ? "true" : "false";
+					return true;
+				case LUA_TNUMBER:
+					if (lua_isinteger(_L, index))
+					{
+						AppendInteger(_out, lua_tointeger(_L, index));
+						return true;
+					}
+					return AppendNumber(_out, lua_tonumber(_L, index)) || Fail("number can't be encoded");
+				case LUA_TSTRING:
+				{
+					size_t size;
+					const char* data = lua_tolstring(_L, index, &size);
+					AppendString(_out, data, size);
+					return true;
+				}
+				case LUA_TTABLE:
+					return depth < MaxDepth ? WriteTable(lua_absindex(_L, index), depth) : Fail("too deep or cyclic");
+				default:
+					return Fail("value can't be encoded");
+				}
+			}
+
+			const char* Error(void) const { return _error; }
+
+		private:
+			bool Fail(const char* message)
+			{
+				_error = message;
+				return false;
+			}
+
+			bool WriteTable(int index, int depth)
+			{
+				luaL_checkstack(_L, 3, "JSON too deep");
+				size_t count = 0;
+				bool array = true;
+				lua_Integer maxKey = 0;
+				lua_pushnil(_L);												/* L: nil */
+				while (lua_next(_L, index))										/* L: key, value */
+				{
+					lua_pop(_L, 1);												/* L: key */
+					++count;
+					if (array && lua_isinteger(_L, -1) && lua_tointeger(_L, -1) >= 1)
+					{
+						maxKey = lua_tointeger(_L, -1) > maxKey ? lua_tointeger(_L, -1) : maxKey;
+					}
+					else
+					{
+						array = false;
+					}
+				}
+				if (count > 0 && array && (unsigned long long)maxKey <= count * 2)
+				{
+					_out += '[';
+					for (lua_Integer key = 1; key <= maxKey; ++key)
+					{
+						if (key > 1)
+						{
+							_out += ',';
+						}
+						lua_rawgeti(_L, index, key);							/* L: value */
+						bool ok = Write(-1, depth + 1);
+						lua_pop(_L, 1);											/* L: */
+						if (!ok)
+						{
+							return false;
+						}
+					}
+					_out += ']';
+					return true;
+				}
+				_out += '{';
+				bool first = true;
+				lua_pushnil(_L);												/* L: nil */
+				while (lua_next(_L, index))										/* L: key, value */
+				{
+					if (!first)
+					{
+						_out += ',';
+					}
+					first = false;
+					// the key is never converted in place, lua_next would lose its position
+					switch (lua_type(_L, -2))
+					{
+					case LUA_TSTRING:
+					{
+						size_t size;
+						const char* data = lua_tolstring(_L, -2, &size);
+						AppendString(_out, data, size);
+					}
+					break;
+					case LUA_TNUMBER:
+						_out += '"';
+						if (lua_isinteger(_L, -2))
+						{
+							AppendInteger(_out, lua_tointeger(_L, -2));
+						}
+						else if (!AppendNumber(_out, lua_tonumber(_L, -2)))
+						{
+							lua_pop(_L, 2);
+							return Fail("key can't be encoded");
+						}
+						_out += '"';
+						break;
+					default:
+						lua_pop(_L, 2);											/* L: */
+						return Fail("key can't be encoded");
+					}
+					_out += ':';
+					if (!Write(-1, depth + 1))
+					{
+						lua_pop(_L, 2);											/* L: */
+						return false;
+					}
+					lua_pop(_L, 1);												/* L: key */
+				}
+				_out += '}';
+				return true;
+			}
+
+			lua_State*		_L;
+			std::string&	_out;
+			const char*		_error;
+		};
+	}
+
+	bool LuaJson::Decode(const char * data, size_t size, LuaValue & value, LuaArena * arena, std::string * error)
+	{
+		ValueBuilder builder(arena);
+		Parser<ValueBuilder> parser(data, size, builder);
+		if (!parser.Parse(error))
+		{
+			return false;
+		}
+		value = builder.Result();
+		return true;
+	}
+
+	bool LuaJson::Push(lua_State * L, const char * data, size_t size, std::string * error)
+	{
+		int top = lua_gettop(L);
+		StackBuilder builder(L);
+		Parser<StackBuilder> parser(data, size, builder);
+		if (!parser.Parse(error))
+		{
+			lua_settop(L, top);
+			return false;
+		}
+		return true;
+	}
+
+	bool LuaJson::Encode(const LuaValue & value, std::string & out, std::string * error)
+	{
+		ValueWriter writer(out);
+		if (!writer.Write(value, 0))
+		{
+			SetError(error, writer.Error(), out.size());
+			return false;
+		}
+		return true;
+	}
+
+	bool LuaJson::Encode(lua_State * L, int index, std::string & out, std::string * error)
+	{
+		StackWriter writer(L, out);
+		if (!writer.Write(lua_absindex(L, index), 0))
+		{
+			SetError(error, writer.Error(), out.size());
+			return false;
+		}
+		return true;
+	}
+
+}
@@ -0,0 +1,54 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "lua_helper.h"
+
+namespace LuaCppHelper
+{
+
+	/**
+	* LuaJson converts between JSON text and LuaValue trees or lua stack values without an intermediate DOM.
+	*
+	* Decoding: objects become tables with string keys, arrays become tables with keys 1..n,
+	* integers that fit in 64 bits stay integers, other numbers become floats, null becomes nil.
+	* String bodies are scanned 16 bytes at a time where SSE2 is available.
+	*
+	* Encoding: a table with integer keys only, like a LuaValueArray, is written as an array
+	* (holes become null as long as at most half of the slots are missing), any other table,
+	* the empty table included, is written as an object whose integer keys are turned into strings.
+	* Functions, objects, userdata, infinities and NaN can't be encoded.
+	*/
+	class LuaJson
+	{
+	public:
+		/**
+		* Decode a JSON text into value.
+		*
+		* @param arena allocate the tables and long strings from an arena, nullptr means the heap.
+		* @param error receives a message with the offset of the error, may be nullptr.
+		* @return false on malformed input.
+		*/
+		static bool Decode(const char* data, size_t size, LuaValue& value, LuaArena* arena = nullptr, std::string* error = nullptr);
+
+		/**
+		* Decode a JSON text straight onto the lua stack.
+		*
+		* @return false on malformed input, nothing is pushed then.
+		*/
+		static bool Push(lua_State* L, const char* data, size_t size, std::string* error = nullptr);
+
+		/**
+		* Append the JSON text of value to out.
+		*
+		* @return false if value holds something JSON can't represent, out is partially written then.
+		*/
+		static bool Encode(const LuaValue& value, std::string& out, std::string* error = nullptr);
+
+		/**
+		* Append the JSON text of the value at index to out.
+		*/
+		static bool Encode(lua_State* L, int index, std::string& out, std::string* error = nullptr);
+	};
+
+}
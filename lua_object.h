@@ -0,0 +1,287 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#pragma once
+
+#include <new>
+#include <string>
+#include "lua_helper.h"
+
+namespace LuaCppHelper
+{
+
+	/// @cond
+	// mirrors LUAI_USER_ALIGNMENT_T, the alignment lua guarantees for userdata blocks
+	typedef union {
+		double		number;
+		void*		pointer;
+		long long	integer;
+		long		l;
+	} LuaUserdataAlignment;
+	/// @endcond
+
+	/**
+	* LuaTypeRegistry caches the metatable of T and its flags in the registry,
+	* keyed by the address of a static of LuaTypeRegistry<T>, so no string is hashed after registration.
+	*/
+	template <typename T>
+	class LuaTypeRegistry
+	{
+	public:
+		static const void* MetatableKey(void) { return &Ids()[0]; }
+		static const void* FlagsKey(void) { return &Ids()[1]; }
+
+		/**
+		* Bind the metatable at index to T for this lua_State.
+		*/
+		static void Bind(lua_State* L, int index, int flags)
+		{
+			index = lua_absindex(L, index);
+			lua_pushvalue(L, index);
+			lua_rawsetp(L, LUA_REGISTRYINDEX, MetatableKey());
+			lua_pushinteger(L, flags);
+			lua_rawsetp(L, LUA_REGISTRYINDEX, FlagsKey());
+		}
+
+		/**
+		* Push the metatable of T.
+		*
+		* @return false if T isn't registered, nothing is pushed then.
+		*/
+		static bool PushMetatable(lua_State* L)
+		{
+			if (lua_rawgetp(L, LUA_REGISTRYINDEX, MetatableKey()) == LUA_TNIL)
+			{
+				lua_pop(L, 1);
+				return false;
+			}
+			return true;
+		}
+
+		static int Flags(lua_State* L)
+		{
+			lua_rawgetp(L, LUA_REGISTRYINDEX, FlagsKey());
+			int flags = (int)lua_tointeger(L, -1);
+			lua_pop(L, 1);
+			return flags;
+		}
+
+		/**
+		* Check whether the value at index has the metatable of T.
+		*/
+		static bool Is(lua_State* L, int index)
+		{
+			if (!lua_getmetatable(L, index))
+			{
+				return false;
+			}
+			lua_rawgetp(L, LUA_REGISTRYINDEX, MetatableKey());
+			bool same = lua_rawequal(L, -1, -2) != 0;
+			lua_pop(L, 2);
+			return same;
+		}
+
+		/**
+		* Get the object held by the userdata at index: the block itself for LuaClass types,
+		* the pointer it boxes for objects pushed by LuaObjectType<T>::Push, nullptr if it isn't a T.
+		*/
+		static void* ToObject(lua_State* L, int index)
+		{
+			if (lua_type(L, index) != LUA_TUSERDATA || !Is(L, index))
+			{
+				return nullptr;
+			}
+			void* block = lua_touserdata(L, index);
+			if (LuaHelper::IsBox(L, index) || !(Flags(L) & LuaTypeFlagInline))
+			{
+				return *static_cast<void**>(block);
+			}
+			return block;
+		}
+
+		static int TypeError(lua_State* L, int index)
+		{
+			const char* name = "object";
+			if (PushMetatable(L))
+			{
+				lua_getfield(L, -1, "__name");
+				if (lua_type(L, -1) == LUA_TSTRING)
+				{
+					name = lua_tostring(L, -1);
+				}
+			}
+			return luaL_argerror(L, index, lua_pushfstring(L, "%s expected, got %s", name, luaL_typename(L, index)));
+		}
+
+	private:
+		static const char* Ids(void)
+		{
+			static const char ids[2] = { 0, 0 };
+			return ids;
+		}
+	};
+
+	/**
+	* LuaClass binds a C++ type whose objects live directly inside lua userdata blocks:
+	* New() constructs T in place, the registered "__gc" runs ~T(), Check() hands back T*.
+	* Register() must be called once per lua_State before the type is used.
+	*
+	*   LuaClass<Vec3>::Register(L, "Vec3", vec3_methods);
+	*   Vec3* v = LuaClass<Vec3>::New(L, 1.0f, 2.0f, 3.0f);	// pushed onto the stack
+	*
+	* Bindings can also take T* parameters, LuaHelper::Check and LuaBinder decode them through LuaObjectType.
+	*/
+	template <typename T>
+	class LuaClass
+	{
+		static_assert(alignof(T) <= alignof(LuaUserdataAlignment), "Unsupported alignment");
+
+	public:
+		/**
+		* Create the metatable of T, methods are reachable through "__index".
+		*
+		* @param name the name of the metatable, also used as "__name".
+		* @param methods the methods and metamethods of T, may be nullptr.
+		*/
+		static void Register(lua_State* L, const char* name, const luaL_Reg* methods = nullptr)
+		{
+			int flags = LuaTypeFlagInline;
+			luaL_newmetatable(L, name);							/* L: mt */
+			if (methods != nullptr)
+			{
+				luaL_setfuncs(L, methods, 0);					/* L: mt */
+			}
+			lua_pushvalue(L, -1);								/* L: mt, mt */
+			lua_setfield(L, -2, "__index");						/* L: mt */
+			if (!std::is_trivially_destructible<T>::value)
+			{
+				lua_pushcfunction(L, &LuaClass<T>::Destroy);	/* L: mt, gc */
+				lua_setfield(L, -2, "__gc");					/* L: mt */
+				flags |= LuaTypeFlagHasGc;
+			}
+			// tell the LuaObject based functions the block holds the object, not a pointer to it
+			lua_pushboolean(L, 1);								/* L: mt, true */
+			lua_setfield(L, -2, "__inline");					/* L: mt */
+			LuaTypeRegistry<T>::Bind(L, -1, flags);				/* L: mt */
+			lua_pop(L, 1);										/* L: */
+		}
+
+		/**
+		* Construct a T inside a new userdata and push it onto the stack.
+		*
+		* @return the object, owned by lua.
+		*/
+		template <typename ...ARGS>
+		static T* New(lua_State* L, ARGS&& ...args)
+		{
+			// raise before constructing, a T without its metatable would never be destroyed
+			void* block = lua_newuserdata(L, sizeof(T));		/* L: ud */
+			if (!LuaTypeRegistry<T>::PushMetatable(L))			/* L: ud, mt */
+			{
+				luaL_error(L, "LuaClass is not registered");
+			}
+			T* object = new (block) T(std::forward<ARGS>(args)...);
+			lua_setmetatable(L, -2);							/* L: ud */
+			return object;
+		}
+
+		/**
+		* Get the object at index, raise a lua error if it isn't a T.
+		*/
+		static T* Check(lua_State* L, int index)
+		{
+			T* object = Test(L, index);
+			if (object == nullptr)
+			{
+				LuaTypeRegistry<T>::TypeError(L, index);
+			}
+			return object;
+		}
+
+		/**
+		* Get the object at index, nullptr if it isn't a T.
+		* A pointer to a T pushed by LuaObjectType<T>::Push is accepted too, its box shares the metatable.
+		*/
+		static T* Test(lua_State* L, int index)
+		{
+			if (lua_type(L, index) != LUA_TUSERDATA || !LuaTypeRegistry<T>::Is(L, index))
+			{
+				return nullptr;
+			}
+			void* block = lua_touserdata(L, index);
+			return static_cast<T*>(LuaHelper::IsBox(L, index) ? *static_cast<void**>(block) : block);
+		}
+
+	private:
+		static int Destroy(lua_State* L)
+		{
+			// a box only points to an object owned by C++
+			if (!LuaHelper::IsBox(L, 1))
+			{
+				static_cast<T*>(lua_touserdata(L, 1))->~T();
+			}
+			return 0;
+		}
+	};
+
+	/**
+	* LuaObjectType is the typed counterpart of PushLuaObject/CheckLuaObject for objects owned by C++:
+	* the metatable named at registration is resolved once, later pushes and checks only use LuaTypeRegistry.
+	* Objects are boxed in pointer sized userdata, lightuserdata is never used: all of them share one metatable.
+	* The boxes of a LuaClass type share its metatable, its "__gc" skips them: C++ keeps owning the object.
+	*/
+	template <typename T>
+	class LuaObjectType
+	{
+	public:
+		/**
+		* Resolve the metatable registered under name, it is created if it doesn't exist yet.
+		*/
+		static void Register(lua_State* L, const char* name)
+		{
+			luaL_newmetatable(L, name);							/* L: mt */
+			LuaTypeRegistry<T>::Bind(L, -1, LuaHelper::MetatableFlags(L, -1));	/* L: mt */
+			lua_pop(L, 1);										/* L: */
+		}
+
+		/**
+		* Push object boxed in a userdata, nil for nullptr.
+		*/
+		static void Push(lua_State* L, T* object)
+		{
+			if (object == nullptr)
+			{
+				lua_pushnil(L);												/* L: nil */
+				return;
+			}
+			LuaHelper::PushBox(L, object);									/* L: ud */
+			if (LuaTypeRegistry<T>::PushMetatable(L))						/* L: ud, mt */
+			{
+				lua_setmetatable(L, -2);									/* L: ud */
+			}
+		}
+
+		/**
+		* Get the object at index, raise a lua error if it isn't a T.
+		*/
+		static T* Check(lua_State* L, int index)
+		{
+			T* object = static_cast<T*>(LuaTypeRegistry<T>::ToObject(L, index));
+			if (object == nullptr)
+			{
+				LuaTypeRegistry<T>::TypeError(L, index);
+			}
+			return object;
+		}
+	};
+
+	template <typename T>
+	void LuaHelper::CheckImpl(lua_State* L, int index, T*& val, bool cannil)
+	{
+		if (cannil && lua_isnoneornil(L, index))
+		{
+			return;
+		}
+		val = LuaObjectType<T>::Check(L, index);
+	}
+
+}
@@ -0,0 +1,355 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#include <algorithm>
+#include "lua_profiler.h"
+
+namespace LuaCppHelper
+{
+
+	namespace
+	{
+		const char ProfilerKey = 0;
+
+		// the count of running profilers, the wrapped C functions skip everything else while it's 0
+		std::atomic<int> g_running(0);
+
+		const int WrappedLine = -2;
+		const unsigned int Nil = 0xffffffff;
+
+		size_t RoundUpPowerOf2(size_t value)
+		{
+			size_t result = 1;
+			while (result < value)
+			{
+				result <<= 1;
+			}
+			return result;
+		}
+	}
+
+	LuaProfiler::LuaProfiler(lua_State * L, size_t capacity, int maxDepth)
+		: _mask(RoundUpPowerOf2(capacity > 0 ? capacity : 1) - 1)
+		, _head(0)
+		, _tail(0)
+		, _dropped(0)
+		, _running(false)
+		, _maxDepth(maxDepth > 0 && maxDepth < LuaProfilerMaxDepth ? maxDepth : LuaProfilerMaxDepth)
+		, _last(0)
+		, _cTime(0)
+		, _childTime(0)
+	{
+		_ring.reset(new Sample[_mask + 1]);
+		lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);		/* L: main */
+		_L = lua_tothread(L, -1);
+		lua_pop(L, 1);												/* L: */
+		lua_pushlightuserdata(_L, this);							/* L: profiler */
+		lua_rawsetp(_L, LUA_REGISTRYINDEX, &ProfilerKey);			/* L: */
+	}
+
+	LuaProfiler::~LuaProfiler(void)
+	{
+		Stop();
+		lua_pushnil(_L);											/* L: nil */
+		lua_rawsetp(_L, LUA_REGISTRYINDEX, &ProfilerKey);			/* L: */
+	}
+
+	LuaProfiler * LuaProfiler::Get(lua_State * L)
+	{
+		lua_rawgetp(L, LUA_REGISTRYINDEX, &ProfilerKey);			/* L: profiler */
+		LuaProfiler* profiler = static_cast<LuaProfiler*>(lua_touserdata(L, -1));
+		lua_pop(L, 1);												/* L: */
+		return profiler;
+	}
+
+	void LuaProfiler::Wrap(lua_State * L, int index, const char * prefix)
+	{
+		index = lua_absindex(L, index);
+		lua_pushnil(L);															/* L: nil */
+		while (lua_next(L, index))												/* L: key, value */
+		{
+			bool wrap = lua_type(L, -2) == LUA_TSTRING && lua_iscfunction(L, -1);
+			// the closure only keeps the function pointer, so C closures with upvalues stay as they are
+			if (wrap && lua_getupvalue(L, -1, 1) != nullptr)					/* L: key, value, upvalue */
+			{
+				lua_pop(L, 1);													/* L: key, value */
+				wrap = false;
+			}
+			if (wrap)
+			{
+				lua_pushcfunction(L, lua_tocfunction(L, -1));					/* L: key, value, func */
+				lua_pushfstring(L, "[C] %s.%s", prefix, lua_tostring(L, -3));	/* L: key, value, func, name */
+				lua_pushcclosure(L, &LuaProfiler::Probe, 2);					/* L: key, value, probe */
+				lua_pushvalue(L, -3);											/* L: key, value, probe, key */
+				lua_insert(L, -2);												/* L: key, value, key, probe */
+				lua_rawset(L, index);											/* L: key, value */
+			}
+			lua_pop(L, 1);														/* L: key */
+		}
+	}
+
+	int LuaProfiler::LuaStart(lua_State * L)
+	{
+		LuaProfiler* profiler = Get(L);
+		if (profiler == nullptr)
+		{
+			return luaL_error(L, "no LuaProfiler for this lua_State");
+		}
+		lua_Integer instructions = luaL_optinteger(L, 1, 1000);
+		luaL_argcheck(L, instructions > 0, 1, "instruction count must be positive");
+		profiler->Start(L, (int)instructions);
+		return 0;
+	}
+
+	int LuaProfiler::LuaStop(lua_State * L)
+	{
+		LuaProfiler* profiler = Get(L);
+		if (profiler != nullptr)
+		{
+			profiler->Stop();
+		}
+		return 0;
+	}
+
+	int LuaProfiler::LuaFolded(lua_State * L)
+	{
+		LuaProfiler* profiler = Get(L);
+		if (profiler == nullptr)
+		{
+			return luaL_error(L, "no LuaProfiler for this lua_State");
+		}
+		std::string folded = profiler->Folded();
+		lua_pushlstring(L, folded.c_str(), folded.size());
+		return 1;
+	}
+
+	void LuaProfiler::Start(lua_State * L, int instructions)
+	{
+		if (!_running.exchange(true))
+		{
+			g_running.fetch_add(1);
+		}
+		_last = Now();
+		_cTime = 0;
+		lua_sethook(_L, &LuaProfiler::Hook, LUA_MASKCOUNT, instructions);
+		if (L != nullptr && L != _L)
+		{
+			lua_sethook(L, &LuaProfiler::Hook, LUA_MASKCOUNT, instructions);
+		}
+	}
+
+	void LuaProfiler::Stop(void)
+	{
+		if (_running.exchange(false))
+		{
+			g_running.fetch_sub(1);
+		}
+		// the other hooked threads unhook themselves at their next hook
+		lua_sethook(_L, nullptr, 0, 0);
+	}
+
+	size_t LuaProfiler::Collect(void)
+	{
+		std::lock_guard<std::mutex> lock(_collectMutex);
+		size_t tail = _tail.load(std::memory_order_relaxed);
+		size_t head = _head.load(std::memory_order_acquire);
+		if (tail == head)
+		{
+			return 0;
+		}
+		std::string stack;
+		std::lock_guard<std::mutex> namesLock(_namesMutex);
+		for (size_t i = tail; i != head; ++i)
+		{
+			const Sample& sample = _ring[i & _mask];
+			stack.clear();
+			// folded stacks start at the root
+			for (int frame = sample.depth - 1; frame >= 0; --frame)
+			{
+				stack += _names[sample.frames[frame]];
+				if (frame > 0)
+				{
+					stack += ';';
+				}
+			}
+			_folded[stack] += sample.weight;
+		}
+		// the producer may reuse the slots from now on
+		_tail.store(head, std::memory_order_release);
+		return head - tail;
+	}
+
+	std::string LuaProfiler::Folded(void)
+	{
+		Collect();
+		std::lock_guard<std::mutex> lock(_collectMutex);
+		std::string folded;
+		for (std::map<std::string, unsigned long long>::const_iterator it = _folded.begin(); it != _folded.end(); ++it)
+		{
+			folded += it->first;
+			folded += ' ';
+			folded += std::to_string(it->second);
+			folded += '\n';
+		}
+		return folded;
+	}
+
+	void LuaProfiler::Clear(void)
+	{
+		std::lock_guard<std::mutex> lock(_collectMutex);
+		_folded.clear();
+		_tail.store(_head.load(std::memory_order_acquire), std::memory_order_release);
+		_dropped.store(0, std::memory_order_relaxed);
+	}
+
+	void LuaProfiler::Hook(lua_State * L, lua_Debug *)
+	{
+		LuaProfiler* profiler = Get(L);
+		if (profiler == nullptr || !profiler->IsRunning())
+		{
+			lua_sethook(L, nullptr, 0, 0);
+			return;
+		}
+		long long now = Now();
+		long long elapsed = now - profiler->_last - (long long)profiler->_cTime;
+		profiler->_last = now;
+		profiler->_cTime = 0;
+		Sample& sample = profiler->_scratch;
+		sample.weight = elapsed > 0 ? (unsigned long long)elapsed : 0;
+		sample.depth = 0;
+		profiler->CaptureStack(L, 0, sample);
+		profiler->Push(sample);
+	}
+
+	int LuaProfiler::Probe(lua_State * L)
+	{
+		lua_CFunction func = lua_tocfunction(L, lua_upvalueindex(1));
+		LuaProfiler* profiler = g_running.load(std::memory_order_relaxed) > 0 ? Get(L) : nullptr;
+		if (profiler == nullptr || !profiler->IsRunning())
+		{
+			return func(L);
+		}
+		unsigned long long outerChildTime = profiler->_childTime;
+		profiler->_childTime = 0;
+		long long start = Now();
+		int results = func(L);
+		unsigned long long elapsed = (unsigned long long)(Now() - start);
+		// the wrapped functions called by this one have their own samples
+		unsigned long long self = elapsed > profiler->_childTime ? elapsed - profiler->_childTime : 0;
+		profiler->_childTime = outerChildTime + elapsed;
+		profiler->_cTime += self;
+		FrameKey key = { (const void*)func, WrappedLine };
+		std::unordered_map<FrameKey, unsigned int, FrameKeyHash>::const_iterator it = profiler->_ids.find(key);
+		Sample& sample = profiler->_scratch;
+		sample.weight = self;
+		sample.frames[0] = it != profiler->_ids.end() ? it->second : profiler->InternName(key, lua_tostring(L, lua_upvalueindex(2)));
+		sample.depth = 1;
+		// level 0 is the probe itself
+		profiler->CaptureStack(L, 1, sample);
+		profiler->Push(sample);
+		return results;
+	}
+
+	long long LuaProfiler::Now(void)
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	int LuaProfiler::CaptureStack(lua_State * L, int level, Sample & sample)
+	{
+		lua_Debug frame;
+		while (sample.depth < _maxDepth && lua_getstack(L, level, &frame))
+		{
+			sample.frames[sample.depth++] = Intern(L, frame);
+			++level;
+		}
+		return sample.depth;
+	}
+
+	unsigned int LuaProfiler::Intern(lua_State * L, lua_Debug & frame)
+	{
+		lua_getinfo(L, "Snf", &frame);											/* L: func */
+		FrameKey key;
+		if (frame.what[0] == 'C' && lua_tocfunction(L, -1) == &LuaProfiler::Probe)
+		{
+			// a wrapped function calling back into lua, name it as its own samples are named
+			lua_getupvalue(L, -1, 1);											/* L: func, wrapped */
+			key.identity = (const void*)lua_tocfunction(L, -1);
+			key.line = WrappedLine;
+			lua_pop(L, 1);														/* L: func */
+			std::unordered_map<FrameKey, unsigned int, FrameKeyHash>::const_iterator it = _ids.find(key);
+			unsigned int id = it != _ids.end() ? it->second : Nil;
+			if (id == Nil)
+			{
+				lua_getupvalue(L, -1, 2);										/* L: func, name */
+				id = InternName(key, lua_tostring(L, -1));
+				lua_pop(L, 1);													/* L: func */
+			}
+			lua_pop(L, 1);														/* L: */
+			return id;
+		}
+		if (frame.what[0] == 'C')
+		{
+			key.identity = (const void*)lua_tocfunction(L, -1);
+			key.line = -1;
+		}
+		else
+		{
+			// the source string lives as long as the prototype, unlike closures it's shared by all instances
+			key.identity = frame.source;
+			key.line = frame.linedefined;
+		}
+		lua_pop(L, 1);															/* L: */
+		std::unordered_map<FrameKey, unsigned int, FrameKeyHash>::const_iterator it = _ids.find(key);
+		if (it != _ids.end())
+		{
+			return it->second;
+		}
+		std::string name;
+		if (frame.what[0] == 'C')
+		{
+			name = "[C] ";
+			name += frame.name != nullptr ? frame.name : "?";
+		}
+		else if (frame.what[0] == 'm')
+		{
+			name = "main chunk@";
+			name += frame.short_src;
+		}
+		else
+		{
+			name = frame.name != nullptr ? frame.name : "?";
+			name += '@';
+			name += frame.short_src;
+			name += ':';
+			name += std::to_string(frame.linedefined);
+		}
+		return InternName(key, name);
+	}
+
+	unsigned int LuaProfiler::InternName(const FrameKey & key, const std::string & name)
+	{
+		std::lock_guard<std::mutex> lock(_namesMutex);
+		unsigned int id = (unsigned int)_names.size();
+		_names.push_back(name);
+		// ';' separates the frames of a folded stack
+		std::replace(_names.back().begin(), _names.back().end(), ';', ':');
+		_ids[key] = id;
+		return id;
+	}
+
+	void LuaProfiler::Push(const Sample & sample)
+	{
+		size_t head = _head.load(std::memory_order_relaxed);
+		if (head - _tail.load(std::memory_order_acquire) > _mask)
+		{
+			_dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		Sample& slot = _ring[head & _mask];
+		slot.weight = sample.weight;
+		slot.depth = sample.depth;
+		std::copy(sample.frames, sample.frames + sample.depth, slot.frames);
+		_head.store(head + 1, std::memory_order_release);
+	}
+
+}
@@ -0,0 +1,151 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "lua_helper.h"
+
+namespace LuaCppHelper
+{
+
+	/**
+	* The deepest stack a sample keeps, the outermost frames of deeper stacks are cut.
+	*/
+	static const int LuaProfilerMaxDepth = 32;
+
+	/**
+	* LuaProfiler samples the lua stacks of one lua_State and aggregates them into folded stacks for flame graphs.
+	*
+	* A count hook takes a sample every given count of VM instructions, the sample is weighted by the nanoseconds
+	* since the previous one. The hook only runs inside lua code, so C functions are measured by wrapping them:
+	* Wrap replaces the C functions of a module table by closures which add a "[C] prefix.name" leaf with their own time.
+	*
+	*   LuaProfiler profiler(L);
+	*   profiler.Start(L, 1000);
+	*   ...
+	*   profiler.Stop();
+	*   std::string folded = profiler.Folded();	// "main;update;[C] lch_example.add 123456\n..."
+	*
+	* Scripts control it through LuaStart, LuaStop and LuaFolded once the host registers them in a luaL_Reg table.
+	*
+	* The hook writes fixed-size samples into a single producer ring buffer without locking,
+	* Collect drains it from any thread. Samples are dropped instead of blocking when the ring is full.
+	* The hook is installed on the main thread and on the thread passed to Start, coroutines created
+	* afterwards inherit it, older coroutines aren't sampled.
+	*/
+	class LuaProfiler
+	{
+	public:
+		/**
+		* @param capacity the count of samples the ring buffer holds, rounded up to a power of 2.
+		* @param maxDepth the frames kept per sample, at most LuaProfilerMaxDepth.
+		*/
+		explicit LuaProfiler(lua_State* L, size_t capacity = 16384, int maxDepth = LuaProfilerMaxDepth);
+		~LuaProfiler(void);
+
+		/**
+		* Get the profiler of the state of L, nullptr if there is none.
+		*/
+		static LuaProfiler* Get(lua_State* L);
+
+		/**
+		* Wrap the C functions without upvalues of the table at index, they are named prefix.key.
+		* A wrapped function costs one flag check while the profiler isn't running.
+		*/
+		static void Wrap(lua_State* L, int index, const char* prefix);
+
+		/**
+		* start([instructions]), stop() and folded() for lua.
+		*/
+		static int LuaStart(lua_State* L);
+		static int LuaStop(lua_State* L);
+		static int LuaFolded(lua_State* L);
+
+		/**
+		* Start sampling every instructions VM instructions.
+		*
+		* @param L the running thread, hooked along with the main thread.
+		*/
+		void Start(lua_State* L, int instructions = 1000);
+		void Stop(void);
+		bool IsRunning(void) const { return _running.load(std::memory_order_relaxed); }
+
+		/**
+		* Move the buffered samples into the aggregate.
+		*
+		* @return the count of collected samples.
+		*/
+		size_t Collect(void);
+
+		/**
+		* Collect, then return the aggregate as folded stacks, one "frame;frame;frame nanoseconds" line per stack.
+		*/
+		std::string Folded(void);
+
+		/**
+		* Forget the aggregate, the buffered samples and the dropped count.
+		*/
+		void Clear(void);
+
+		size_t DroppedCount(void) const { return _dropped.load(std::memory_order_relaxed); }
+
+	private:
+		LuaProfiler(const LuaProfiler&);
+		LuaProfiler& operator=(const LuaProfiler&);
+
+		struct Sample
+		{
+			unsigned long long	weight;		// nanoseconds
+			int					depth;
+			unsigned int		frames[LuaProfilerMaxDepth];	// innermost first
+		};
+
+		struct FrameKey
+		{
+			const void*			identity;	// the source of a lua function, the C function
+			int					line;		// the line the lua function is defined at
+			bool operator==(const FrameKey& rhs) const { return identity == rhs.identity && line == rhs.line; }
+		};
+
+		struct FrameKeyHash
+		{
+			size_t operator()(const FrameKey& key) const { return std::hash<const void*>()(key.identity) * 31 + (size_t)key.line; }
+		};
+
+		static void Hook(lua_State* L, lua_Debug* ar);
+		static int Probe(lua_State* L);
+		static long long Now(void);
+
+		// the producer side runs on the thread which runs the lua_State
+		int CaptureStack(lua_State* L, int level, Sample& sample);
+		unsigned int Intern(lua_State* L, lua_Debug& frame);
+		unsigned int InternName(const FrameKey& key, const std::string& name);
+		void Push(const Sample& sample);
+
+		lua_State*							_L;
+		std::unique_ptr<Sample[]>			_ring;
+		size_t								_mask;
+		std::atomic<size_t>					_head;		// written by the producer
+		std::atomic<size_t>					_tail;		// written by Collect
+		std::atomic<size_t>					_dropped;
+		std::atomic<bool>					_running;
+		int									_maxDepth;
+		long long							_last;		// time of the previous sample
+		unsigned long long					_cTime;		// time of the wrapped C functions since the previous sample
+		unsigned long long					_childTime;	// time of the wrapped C functions called by the current one
+		Sample								_scratch;	// the sample being captured, kept off the lua C stack
+		std::unordered_map<FrameKey, unsigned int, FrameKeyHash>	_ids;
+		std::mutex							_namesMutex;	// taken by the producer only for a new frame
+		std::vector<std::string>			_names;
+		std::mutex							_collectMutex;
+		std::map<std::string, unsigned long long>	_folded;
+	};
+
+}
@@ -0,0 +1,478 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#include <cstdint>
+#include "lua_serialize.h"
+
+namespace LuaCppHelper
+{
+
+	namespace
+	{
+		const char Magic[3] = { 'L', 'C', 'H' };
+		// deeper input is treated as malformed instead of exhausting the C stack
+		const int MaxDepth = 200;
+		const size_t MinBufferSize = 256;
+
+		unsigned long long NumberBits(double value)
+		{
+			unsigned long long bits;
+			memcpy(&bits, &value, sizeof(bits));
+			return bits;
+		}
+	}
+
+	LuaBinaryWriter::LuaBinaryWriter(void)
+		: _size(0)
+		, _stream(nullptr)
+		, _flushSize(0)
+	{
+	}
+
+	LuaBinaryWriter::LuaBinaryWriter(std::ostream & stream, size_t flushSize)
+		: _buffer(flushSize < MinBufferSize ? MinBufferSize : flushSize)
+		, _size(0)
+		, _stream(&stream)
+		, _flushSize(_buffer.size())
+	{
+	}
+
+	LuaBinaryWriter::~LuaBinaryWriter(void)
+	{
+		Flush();
+	}
+
+	void LuaBinaryWriter::WriteNumber(double value)
+	{
+		unsigned long long bits = NumberBits(value);
+		Reserve(8);
+		for (int i = 0; i < 8; ++i)
+		{
+			_buffer[_size++] = (char)(bits >> (i * 8));
+		}
+	}
+
+	void LuaBinaryWriter::WriteBytes(const void * data, size_t size)
+	{
+		if (_stream != nullptr && size >= _flushSize)
+		{
+			// too large to be worth buffering
+			Flush();
+			_stream->write(static_cast<const char*>(data), (std::streamsize)size);
+			return;
+		}
+		Reserve(size);
+		memcpy(_buffer.data() + _size, data, size);
+		_size += size;
+	}
+
+	bool LuaBinaryWriter::Flush(void)
+	{
+		if (_stream == nullptr)
+		{
+			return true;
+		}
+		if (_size > 0)
+		{
+			_stream->write(_buffer.data(), (std::streamsize)_size);
+			_size = 0;
+		}
+		return !_stream->fail();
+	}
+
+	void LuaBinaryWriter::Grow(size_t size)
+	{
+		if (_stream != nullptr)
+		{
+			Flush();
+			if (_buffer.size() >= size)
+			{
+				return;
+			}
+		}
+		size_t capacity = _buffer.size() < MinBufferSize ? MinBufferSize : _buffer.size() * 2;
+		while (capacity - _size < size)
+		{
+			capacity *= 2;
+		}
+		_buffer.resize(capacity);
+	}
+
+	bool LuaBinaryReader::ReadVarint(unsigned long long & value)
+	{
+		value = 0;
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			if (_data == _end)
+			{
+				return false;
+			}
+			unsigned char byte = (unsigned char)*_data++;
+			value |= (unsigned long long)(byte & 0x7f) << shift;
+			if (byte < 0x80)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool LuaBinaryReader::ReadNumber(double & value)
+	{
+		const char* data;
+		if (!ReadBytes(data, 8))
+		{
+			return false;
+		}
+		unsigned long long bits = 0;
+		for (int i = 0; i < 8; ++i)
+		{
+			bits |= (unsigned long long)(unsigned char)data[i] << (i * 8);
+		}
+		memcpy(&value, &bits, sizeof(value));
+		return true;
+	}
+
+	LuaSerializer::LuaSerializer(LuaBinaryWriter & writer, const LuaSerializePolicy & policy)
+		: _writer(writer)
+		, _policy(policy)
+	{
+		_writer.WriteBytes(Magic, sizeof(Magic));
+		_writer.WriteByte(LuaSerializeVersion);
+	}
+
+	bool LuaSerializer::Write(const LuaValue & value)
+	{
+		return WriteValue(value) && !_writer.Failed();
+	}
+
+	bool LuaSerializer::WriteValue(const LuaValue & value)
+	{
+		switch (value.getType())
+		{
+		case LuaValueTypeNil:
+			_writer.WriteByte(LuaBinaryTagNil);
+			return true;
+		case LuaValueTypeInt:
+			_writer.WriteByte(LuaBinaryTagInt);
+			_writer.WriteInteger(value.IntValue());
+			return true;
+		case LuaValueTypeFloat:
+			_writer.WriteByte(LuaBinaryTagFloat);
+			_writer.WriteNumber(value.NumberValue());
+			return true;
+		case LuaValueTypeBoolean:
+			_writer.WriteByte(value.BooleanValue() ? LuaBinaryTagTrue : LuaBinaryTagFalse);
+			return true;
+		case LuaValueTypeString:
+			_writer.WriteByte(LuaBinaryTagString);
+			_writer.WriteString(value.StringData(), value.StringSize());
+			return true;
+		case LuaValueTypeTable:
+			return WriteTable(value.TableValue());
+		case LuaValueTypeFunction:
+		case LuaValueTypeObject:
+		{
+			bool function = value.getType() == LuaValueTypeFunction;
+			LuaSerializeMode mode = function ? _policy.functionMode : _policy.objectMode;
+			if (mode == LuaSerializeNil)
+			{
+				_writer.WriteByte(LuaBinaryTagNil);
+				return true;
+			}
+			if (mode == LuaSerializeFail || (mode == LuaSerializeCustom && !_policy.write))
+			{
+				return false;
+			}
+			_writer.WriteByte(function ? LuaBinaryTagFunction : LuaBinaryTagObject);
+			if (mode == LuaSerializeCustom)
+			{
+				return _policy.write(value, _writer);
+			}
+			if (function)
+			{
+				_writer.WriteInteger(value.FunctionValue());
+			}
+			else
+			{
+				_writer.WriteVarint((unsigned long long)(uintptr_t)value.ObjectValue().first);
+				_writer.WriteString(value.ObjectValue().second.c_str(), value.ObjectValue().second.size());
+			}
+			return true;
+		}
+		}
+		return false;
+	}
+
+	bool LuaSerializer::WriteTable(const LuaTable & table)
+	{
+		size_t arraySize = table.ArraySize();
+		if (table.HashSize() == 0 && arraySize > 0)
+		{
+			LuaValueType type = table.ArrayBegin()->getType();
+			bool packed = type == LuaValueTypeInt || type == LuaValueTypeFloat;
+			for (LuaTableArrayIterator it = table.ArrayBegin(); packed && it != table.ArrayEnd(); ++it)
+			{
+				packed = it->getType() == type;
+			}
+			if (packed && type == LuaValueTypeInt)
+			{
+				_writer.WriteByte(LuaBinaryTagIntArray);
+				_writer.WriteVarint(arraySize);
+				for (LuaTableArrayIterator it = table.ArrayBegin(); it != table.ArrayEnd(); ++it)
+				{
+					_writer.WriteInteger(it->IntValue());
+				}
+				return true;
+			}
+			if (packed)
+			{
+				_writer.WriteByte(LuaBinaryTagFloatArray);
+				_writer.WriteVarint(arraySize);
+				for (LuaTableArrayIterator it = table.ArrayBegin(); it != table.ArrayEnd(); ++it)
+				{
+					_writer.WriteNumber(it->NumberValue());
+				}
+				return true;
+			}
+		}
+		_writer.WriteByte(LuaBinaryTagTable);
+		_writer.WriteVarint(arraySize);
+		_writer.WriteVarint(table.HashSize());
+		for (LuaTableArrayIterator it = table.ArrayBegin(); it != table.ArrayEnd(); ++it)
+		{
+			if (!WriteValue(*it))
+			{
+				return false;
+			}
+		}
+		for (LuaTableHashIterator it = table.HashBegin(); it != table.HashEnd(); ++it)
+		{
+			if (!WriteValue(it->key) || !WriteValue(it->value))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	LuaDeserializer::LuaDeserializer(const void * data, size_t size, const LuaSerializePolicy & policy)
+		: _reader(data, size)
+		, _policy(policy)
+		, _arena(nullptr)
+		, _zeroCopy(false)
+		, _failed(false)
+	{
+		const char* magic;
+		unsigned char version;
+		_failed = !_reader.ReadBytes(magic, sizeof(Magic))
+			|| memcmp(magic, Magic, sizeof(Magic)) != 0
+			|| !_reader.ReadByte(version)
+			|| version != LuaSerializeVersion;
+	}
+
+	bool LuaDeserializer::Read(LuaValue & value)
+	{
+		if (_failed || _reader.AtEnd())
+		{
+			return false;
+		}
+		if (!ReadValue(value, 0))
+		{
+			_failed = true;
+			return false;
+		}
+		return true;
+	}
+
+	bool LuaDeserializer::ReadValue(LuaValue & value, int depth)
+	{
+		unsigned char tag;
+		if (depth > MaxDepth || !_reader.ReadByte(tag))
+		{
+			return false;
+		}
+		switch (tag)
+		{
+		case LuaBinaryTagNil:
+			value = LuaValue();
+			return true;
+		case LuaBinaryTagFalse:
+		case LuaBinaryTagTrue:
+			value = LuaValue::BooleanValue(tag == LuaBinaryTagTrue);
+			return true;
+		case LuaBinaryTagInt:
+		{
+			long long intValue;
+			if (!_reader.ReadInteger(intValue))
+			{
+				return false;
+			}
+			value = LuaValue::IntValue(intValue);
+			return true;
+		}
+		case LuaBinaryTagFloat:
+		{
+			double numberValue;
+			if (!_reader.ReadNumber(numberValue))
+			{
+				return false;
+			}
+			value = LuaValue::NumberValue(numberValue);
+			return true;
+		}
+		case LuaBinaryTagString:
+		{
+			const char* data;
+			size_t size;
+			if (!_reader.ReadString(data, size))
+			{
+				return false;
+			}
+			value = MakeString(data, size);
+			return true;
+		}
+		case LuaBinaryTagTable:
+			return ReadTable(value, depth);
+		case LuaBinaryTagIntArray:
+		case LuaBinaryTagFloatArray:
+			return ReadPackedArray(value, tag == LuaBinaryTagFloatArray);
+		case LuaBinaryTagFunction:
+		case LuaBinaryTagObject:
+		{
+			bool function = tag == LuaBinaryTagFunction;
+			LuaSerializeMode mode = function ? _policy.functionMode : _policy.objectMode;
+			if (mode == LuaSerializeCustom)
+			{
+				return _policy.read && _policy.read(function ? LuaValueTypeFunction : LuaValueTypeObject, _reader, value);
+			}
+			if (mode != LuaSerializeRaw)
+			{
+				return false;
+			}
+			if (function)
+			{
+				long long func;
+				if (!_reader.ReadInteger(func))
+				{
+					return false;
+				}
+				value = LuaValue::FunctionValue((LuaFunction)func);
+				return true;
+			}
+			unsigned long long pointer;
+			const char* name;
+			size_t nameSize;
+			if (!_reader.ReadVarint(pointer) || !_reader.ReadString(name, nameSize))
+			{
+				return false;
+			}
+			value = LuaValue::ObjectValue((void*)(uintptr_t)pointer, std::string(name, nameSize));
+			return true;
+		}
+		}
+		return false;
+	}
+
+	bool LuaDeserializer::ReadTable(LuaValue & value, int depth)
+	{
+		unsigned long long arraySize;
+		unsigned long long hashSize;
+		// every element takes one byte at least, larger counts can only come from malformed input
+		if (!_reader.ReadVarint(arraySize) || !_reader.ReadVarint(hashSize)
+			|| arraySize > _reader.Remaining() || hashSize > _reader.Remaining() / 2)
+		{
+			return false;
+		}
+		LuaTable table(_arena);
+		table.Reserve((size_t)arraySize, (size_t)hashSize);
+		for (unsigned long long i = 0; i < arraySize; ++i)
+		{
+			LuaValue element;
+			if (!ReadValue(element, depth + 1))
+			{
+				return false;
+			}
+			table.Append(std::move(element));
+		}
+		for (unsigned long long i = 0; i < hashSize; ++i)
+		{
+			LuaValue key;
+			LuaValue element;
+			if (!ReadValue(key, depth + 1) || !ReadValue(element, depth + 1))
+			{
+				return false;
+			}
+			if (key.getType() == LuaValueTypeInt)
+			{
+				table.Set(key.IntValue(), std::move(element));
+			}
+			else if (key.getType() == LuaValueTypeString)
+			{
+				table.Set(key.StringData(), key.StringSize(), std::move(element));
+			}
+			else
+			{
+				return false;
+			}
+		}
+		value = MakeTable(std::move(table));
+		return true;
+	}
+
+	bool LuaDeserializer::ReadPackedArray(LuaValue & value, bool floats)
+	{
+		unsigned long long size;
+		if (!_reader.ReadVarint(size) || size > (floats ? _reader.Remaining() / 8 : _reader.Remaining()))
+		{
+			return false;
+		}
+		LuaTable table(_arena);
+		table.Reserve((size_t)size, 0);
+		for (unsigned long long i = 0; i < size; ++i)
+		{
+			if (floats)
+			{
+				double numberValue;
+				if (!_reader.ReadNumber(numberValue))
+				{
+					return false;
+				}
+				table.Append(LuaValue::NumberValue(numberValue));
+			}
+			else
+			{
+				long long intValue;
+				if (!_reader.ReadInteger(intValue))
+				{
+					return false;
+				}
+				table.Append(LuaValue::IntValue(intValue));
+			}
+		}
+		value = MakeTable(std::move(table));
+		return true;
+	}
+
+	LuaValue LuaDeserializer::MakeString(const char * data, size_t size) const
+	{
+		if (_zeroCopy && size > LuaValueInlineStringSize)
+		{
+			return LuaValue::ExternalStringValue(data, size);
+		}
+		if (_arena != nullptr)
+		{
+			return LuaValue::StringValue(data, size, *_arena);
+		}
+		return LuaValue::StringValue(data, size);
+	}
+
+	LuaValue LuaDeserializer::MakeTable(LuaTable && table) const
+	{
+		if (_arena != nullptr)
+		{
+			return LuaValue::TableValue(std::move(table), *_arena);
+		}
+		return LuaValue::TableValue(std::move(table));
+	}
+
+}
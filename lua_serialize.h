@@ -0,0 +1,297 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#pragma once
+
+#include <functional>
+#include <ostream>
+#include <vector>
+#include "lua_table.h"
+
+namespace LuaCppHelper
+{
+
+	/**
+	* The version written in the header of every stream, bumped when the encoding changes.
+	*/
+	static const unsigned char LuaSerializeVersion = 1;
+
+	/// @cond
+	// one byte in front of every value
+	typedef enum {
+		LuaBinaryTagNil,
+		LuaBinaryTagFalse,
+		LuaBinaryTagTrue,
+		LuaBinaryTagInt,			// zigzag varint
+		LuaBinaryTagFloat,			// 8 bytes, little endian IEEE 754
+		LuaBinaryTagString,			// varint length, characters
+		LuaBinaryTagTable,			// varint array count, varint hash count, array values, key value pairs
+		LuaBinaryTagIntArray,		// varint count, untagged zigzag varints: a table of integers 1..n
+		LuaBinaryTagFloatArray,		// varint count, untagged 8 byte floats: a table of floats 1..n
+		LuaBinaryTagFunction,		// written by the LuaSerializePolicy
+		LuaBinaryTagObject			// written by the LuaSerializePolicy
+	} LuaBinaryTag;
+	/// @endcond
+
+	/**
+	* A growable output buffer, optionally flushed into a std::ostream.
+	* Integers are written as varints, floats as 8 little endian bytes.
+	*/
+	class LuaBinaryWriter
+	{
+	public:
+		LuaBinaryWriter(void);
+
+		/**
+		* Write into a stream, the buffer is flushed whenever it grows past flushSize and by the destructor.
+		*/
+		explicit LuaBinaryWriter(std::ostream& stream, size_t flushSize = 64 * 1024);
+		~LuaBinaryWriter(void);
+
+		void WriteByte(unsigned char value)
+		{
+			Reserve(1);
+			_buffer[_size++] = (char)value;
+		}
+		void WriteVarint(unsigned long long value)
+		{
+			Reserve(10);
+			while (value >= 0x80)
+			{
+				_buffer[_size++] = (char)(value | 0x80);
+				value >>= 7;
+			}
+			_buffer[_size++] = (char)value;
+		}
+		void WriteInteger(long long value)
+		{
+			// zigzag, small negative numbers stay short
+			WriteVarint(((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63));
+		}
+		void WriteNumber(double value);
+		void WriteBytes(const void* data, size_t size);
+		void WriteString(const char* data, size_t size)
+		{
+			WriteVarint(size);
+			WriteBytes(data, size);
+		}
+
+		/**
+		* Make room for size more bytes.
+		*/
+		void Reserve(size_t size)
+		{
+			if (_buffer.size() - _size < size)
+			{
+				Grow(size);
+			}
+		}
+
+		/**
+		* Write the buffered bytes into the stream, a writer without stream keeps them.
+		*
+		* @return false if the stream failed.
+		*/
+		bool Flush(void);
+
+		/**
+		* Check whether the stream failed, the bytes written since are lost. A writer without stream never fails.
+		*/
+		bool Failed(void) const { return _stream != nullptr && _stream->fail(); }
+
+		const char* Data(void) const { return _buffer.data(); }
+		size_t Size(void) const { return _size; }
+		void Clear(void) { _size = 0; }
+
+	private:
+		LuaBinaryWriter(const LuaBinaryWriter&);
+		LuaBinaryWriter& operator=(const LuaBinaryWriter&);
+
+		void Grow(size_t size);
+
+		std::vector<char>	_buffer;	// sized to the capacity, _size bytes are used
+		size_t				_size;
+		std::ostream*		_stream;
+		size_t				_flushSize;
+	};
+
+	/**
+	* Read from a memory block, e.g. a memory mapped file. Nothing is copied:
+	* the memory must stay valid as long as the views handed out by ReadBytes are used.
+	*/
+	class LuaBinaryReader
+	{
+	public:
+		LuaBinaryReader(const void* data, size_t size)
+			: _data(static_cast<const char*>(data)), _end(static_cast<const char*>(data) + size)
+		{
+		}
+
+		bool ReadByte(unsigned char& value)
+		{
+			if (_data == _end)
+			{
+				return false;
+			}
+			value = (unsigned char)*_data++;
+			return true;
+		}
+		bool ReadVarint(unsigned long long& value);
+		bool ReadInteger(long long& value)
+		{
+			unsigned long long raw;
+			if (!ReadVarint(raw))
+			{
+				return false;
+			}
+			value = (long long)(raw >> 1) ^ -(long long)(raw & 1);
+			return true;
+		}
+		bool ReadNumber(double& value);
+
+		/**
+		* Get a view of the next size bytes and skip them.
+		*/
+		bool ReadBytes(const char*& data, size_t size)
+		{
+			if ((size_t)(_end - _data) < size)
+			{
+				return false;
+			}
+			data = _data;
+			_data += size;
+			return true;
+		}
+		bool ReadString(const char*& data, size_t& size)
+		{
+			unsigned long long length;
+			if (!ReadVarint(length) || length > Remaining())
+			{
+				return false;
+			}
+			size = (size_t)length;
+			return ReadBytes(data, size);
+		}
+
+		size_t Remaining(void) const { return (size_t)(_end - _data); }
+		bool AtEnd(void) const { return _data == _end; }
+
+	private:
+		const char*	_data;
+		const char*	_end;
+	};
+
+	/// @cond
+	typedef enum {
+		LuaSerializeFail,		// the value can't be serialized, Write() returns false
+		LuaSerializeNil,		// the value is written as nil
+		LuaSerializeRaw,		// the ref or the pointer and typename are written as is, only valid inside the same process
+		LuaSerializeCustom		// the hooks of the policy write and read the payload
+	} LuaSerializeMode;
+	/// @endcond
+
+	/**
+	* What to do with the values which don't survive leaving the process, functions and objects.
+	* The default fails on them. Custom hooks write the payload after the tag and read it back,
+	* e.g. a function name resolved on load, or an object id looked up in a registry.
+	*/
+	struct LuaSerializePolicy
+	{
+		LuaSerializePolicy(void) : functionMode(LuaSerializeFail), objectMode(LuaSerializeFail) {}
+
+		LuaSerializeMode	functionMode;
+		LuaSerializeMode	objectMode;
+		// called with a LuaValueTypeFunction or LuaValueTypeObject value
+		std::function<bool(const LuaValue& value, LuaBinaryWriter& writer)>		write;
+		// called with LuaValueTypeFunction or LuaValueTypeObject, must fill value
+		std::function<bool(LuaValueType type, LuaBinaryReader& reader, LuaValue& value)>	read;
+	};
+
+	/**
+	* LuaSerializer writes LuaValue trees in the binary format: a header with the version,
+	* then any count of values. Tables whose elements are all integers or all floats keys 1..n
+	* are written as packed arrays without per element tags.
+	*
+	*   LuaBinaryWriter writer;
+	*   LuaSerializer serializer(writer);
+	*   serializer.Write(value);
+	*   send(writer.Data(), writer.Size());
+	*/
+	class LuaSerializer
+	{
+	public:
+		/**
+		* Write the header into writer.
+		*/
+		explicit LuaSerializer(LuaBinaryWriter& writer, const LuaSerializePolicy& policy = LuaSerializePolicy());
+
+		/**
+		* Append a value. The stream of the writer is only written when the buffer flushes,
+		* call Flush() on the writer after the last value to learn whether all of it got out.
+		*
+		* @return false if the policy refused a value or the stream of the writer failed, the output is incomplete then.
+		*/
+		bool Write(const LuaValue& value);
+
+	private:
+		bool WriteValue(const LuaValue& value);
+		bool WriteTable(const LuaTable& table);
+
+		LuaBinaryWriter&	_writer;
+		LuaSerializePolicy	_policy;
+	};
+
+	/**
+	* LuaDeserializer reads the values written by LuaSerializer one after another.
+	*
+	*   LuaDeserializer deserializer(data, size);
+	*   LuaValue value;
+	*   while (deserializer.Read(value)) { ... }
+	*/
+	class LuaDeserializer
+	{
+	public:
+		/**
+		* Read the header, check IsValid() afterwards.
+		*
+		* @param data the serialized bytes, they must outlive the deserializer.
+		* @param size the count of bytes.
+		*/
+		LuaDeserializer(const void* data, size_t size, const LuaSerializePolicy& policy = LuaSerializePolicy());
+
+		/**
+		* Let strings longer than the inline size refer to the input instead of being copied,
+		* the input must then outlive the decoded values (copies of them own their characters).
+		*/
+		void SetZeroCopy(bool zeroCopy) { _zeroCopy = zeroCopy; }
+
+		/**
+		* Allocate the decoded tables and copied strings from an arena, nullptr means the heap.
+		*/
+		void SetArena(LuaArena* arena) { _arena = arena; }
+
+		/**
+		* Read the next value.
+		*
+		* @return false at the end of the input or on malformed input, see Failed().
+		*/
+		bool Read(LuaValue& value);
+
+		bool IsValid(void) const { return !_failed; }
+		bool Failed(void) const { return _failed; }
+		bool AtEnd(void) const { return _reader.AtEnd(); }
+
+	private:
+		bool ReadValue(LuaValue& value, int depth);
+		bool ReadTable(LuaValue& value, int depth);
+		bool ReadPackedArray(LuaValue& value, bool floats);
+		LuaValue MakeString(const char* data, size_t size) const;
+		LuaValue MakeTable(LuaTable&& table) const;
+
+		LuaBinaryReader		_reader;
+		LuaSerializePolicy	_policy;
+		LuaArena*			_arena;
+		bool				_zeroCopy;
+		bool				_failed;
+	};
+
+}
@@ -0,0 +1,377 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#include <stdexcept>
+#include "lua_function_ref.h"
+#include "lua_state_pool.h"
+extern "C"
+{
+#include "lualib.h"
+}
+
+namespace LuaCppHelper
+{
+
+	namespace
+	{
+		struct CallContext
+		{
+			const std::string*	function;
+			const LuaValueList*	args;
+			LuaValueList*		results;
+		};
+
+		bool ContainsFunction(const LuaValue& value)
+		{
+			if (value.getType() == LuaValueTypeFunction)
+			{
+				return true;
+			}
+			if (value.getType() != LuaValueTypeTable)
+			{
+				return false;
+			}
+			const LuaTable& table = value.TableValue();
+			for (LuaTableArrayIterator it = table.ArrayBegin(); it != table.ArrayEnd(); ++it)
+			{
+				if (ContainsFunction(*it))
+				{
+					return true;
+				}
+			}
+			for (LuaTableHashIterator it = table.HashBegin(); it != table.HashEnd(); ++it)
+			{
+				if (ContainsFunction(it->value))
+				{
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// replace the functions of value by nil, or by refs handed over to the caller when keep is set:
+		// the values leave the worker thread, the refs they own must be released before on this thread
+		void StripFunctions(lua_State* L, LuaValue& value, bool keep)
+		{
+			if (value.getType() == LuaValueTypeFunction)
+			{
+				LuaValue stripped;
+				if (keep)
+				{
+					LuaFunctionPool::Get(L).Retain(value.FunctionValue());
+					stripped = LuaValue::FunctionValue(value.FunctionValue());
+				}
+				value = std::move(stripped);
+				return;
+			}
+			if (!ContainsFunction(value))
+			{
+				return;
+			}
+			const LuaTable& table = value.TableValue();
+			LuaTable stripped;
+			stripped.Reserve(table.ArraySize(), table.HashSize());
+			for (LuaTableArrayIterator it = table.ArrayBegin(); it != table.ArrayEnd(); ++it)
+			{
+				LuaValue element(*it);
+				StripFunctions(L, element, keep);
+				stripped.Append(std::move(element));
+			}
+			for (LuaTableHashIterator it = table.HashBegin(); it != table.HashEnd(); ++it)
+			{
+				LuaValue element(it->value);
+				StripFunctions(L, element, keep);
+				if (it->key.getType() == LuaValueTypeInt)
+				{
+					stripped.Set(it->key.IntValue(), std::move(element));
+				}
+				else
+				{
+					stripped.Set(it->key.StringData(), it->key.StringSize(), std::move(element));
+				}
+			}
+			value = LuaValue::TableValue(std::move(stripped));
+		}
+	}
+
+	LuaStatePool::LuaStatePool(size_t workers, std::function<void(lua_State*)> init, size_t maxPending)
+		: _pending(0)
+		, _stealable(0)
+		, _next(0)
+		, _maxPending(maxPending > 0 ? maxPending : 1)
+		, _stopping(false)
+	{
+		if (workers == 0)
+		{
+			workers = 1;
+		}
+		for (size_t i = 0; i < workers; ++i)
+		{
+			_workers.push_back(std::unique_ptr<Worker>(new Worker()));
+		}
+		for (size_t i = 0; i < workers; ++i)
+		{
+			_workers[i]->thread = std::thread(&LuaStatePool::Run, this, i, init);
+		}
+	}
+
+	LuaStatePool::~LuaStatePool(void)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stopping = true;
+		}
+		_wake.notify_all();
+		_space.notify_all();
+		for (size_t i = 0; i < _workers.size(); ++i)
+		{
+			_workers[i]->thread.join();
+		}
+	}
+
+	std::future<LuaValueList> LuaStatePool::Submit(const std::string & function, LuaValueList args, int worker)
+	{
+		std::future<LuaValueList> future;
+		TrySubmit(function, std::move(args), future, worker, true);
+		return future;
+	}
+
+	std::future<LuaValueList> LuaStatePool::Submit(std::function<LuaValueList(lua_State*)> job, int worker)
+	{
+		bool queued;
+		return Enqueue([job](lua_State* L, bool) { return job(L); }, worker, true, queued);
+	}
+
+	bool LuaStatePool::TrySubmit(const std::string & function, LuaValueList args, std::future<LuaValueList>& future, int worker)
+	{
+		return TrySubmit(function, std::move(args), future, worker, false);
+	}
+
+	bool LuaStatePool::TrySubmit(const std::string & function, LuaValueList args, std::future<LuaValueList>& future, int worker, bool wait)
+	{
+		if (worker == AnyWorker)
+		{
+			for (size_t i = 0; i < args.size(); ++i)
+			{
+				if (ContainsFunction(args[i]))
+				{
+					std::promise<LuaValueList> promise;
+					promise.set_exception(std::make_exception_ptr(std::invalid_argument("function arguments need a pinned job")));
+					future = promise.get_future();
+					return true;
+				}
+			}
+		}
+		bool queued;
+		future = Enqueue([function, args](lua_State* L, bool pinned) { return CallFunction(L, function, args, pinned); }, worker, wait, queued);
+		return queued;
+	}
+
+	std::future<LuaValueList> LuaStatePool::Enqueue(std::function<LuaValueList(lua_State*, bool)> run, int worker, bool wait, bool & queued)
+	{
+		Job job;
+		job.run = std::move(run);
+		job.pinned = worker != AnyWorker;
+		std::future<LuaValueList> future = job.promise.get_future();
+		queued = true;
+		if (job.pinned && (worker < 0 || (size_t)worker >= _workers.size()))
+		{
+			job.promise.set_exception(std::make_exception_ptr(std::out_of_range("no such worker")));
+			return future;
+		}
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			if (_pending >= _maxPending)
+			{
+				if (!wait)
+				{
+					queued = false;
+					return std::future<LuaValueList>();
+				}
+				_space.wait(lock, [this]() { return _pending < _maxPending || _stopping; });
+			}
+			++_pending;
+		}
+		bool pinned = job.pinned;
+		Worker& target = *_workers[pinned ? (size_t)worker : _next++ % _workers.size()];
+		{
+			std::lock_guard<std::mutex> lock(target.mutex);
+			if (pinned)
+			{
+				target.pinned.push_back(std::move(job));
+			}
+			else
+			{
+				target.jobs.push_back(std::move(job));
+				++_stealable;
+			}
+		}
+		{
+			// the waiting workers check the queues under _mutex, taking it orders the notification after their check
+			std::lock_guard<std::mutex> lock(_mutex);
+		}
+		if (pinned)
+		{
+			_wake.notify_all();
+		}
+		else
+		{
+			_wake.notify_one();
+		}
+		return future;
+	}
+
+	bool LuaStatePool::Pop(size_t index, Job & job)
+	{
+		Worker& worker = *_workers[index];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		// pinned jobs first, nobody else can run them
+		if (!worker.pinned.empty())
+		{
+			job = std::move(worker.pinned.front());
+			worker.pinned.pop_front();
+			return true;
+		}
+		if (!worker.jobs.empty())
+		{
+			job = std::move(worker.jobs.front());
+			worker.jobs.pop_front();
+			--_stealable;
+			return true;
+		}
+		return false;
+	}
+
+	bool LuaStatePool::Steal(size_t index, Job & job)
+	{
+		for (size_t i = 1; i < _workers.size() && _stealable > 0; ++i)
+		{
+			Worker& victim = *_workers[(index + i) % _workers.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			// the owner works from the front, thieves take the most recent job at the back
+			if (!victim.jobs.empty())
+			{
+				job = std::move(victim.jobs.back());
+				victim.jobs.pop_back();
+				--_stealable;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void LuaStatePool::Run(size_t index, std::function<void(lua_State*)> init)
+	{
+		lua_State* L = luaL_newstate();
+		luaL_openlibs(L);
+		if (init)
+		{
+			init(L);
+			lua_settop(L, 0);
+		}
+		Worker& worker = *_workers[index];
+		for (;;)
+		{
+			Job job;
+			if (Pop(index, job) || Steal(index, job))
+			{
+				Execute(L, job);
+				{
+					std::lock_guard<std::mutex> lock(_mutex);
+					--_pending;
+				}
+				_space.notify_one();
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(_mutex);
+			auto ready = [this, &worker]()
+			{
+				std::lock_guard<std::mutex> queueLock(worker.mutex);
+				return _stealable > 0 || !worker.pinned.empty();
+			};
+			if (ready())
+			{
+				continue;
+			}
+			if (_stopping)
+			{
+				break;
+			}
+			_wake.wait(lock, [this, &ready]() { return _stopping || ready(); });
+		}
+		lua_close(L);
+	}
+
+	void LuaStatePool::Execute(lua_State * L, Job & job)
+	{
+		try
+		{
+			job.promise.set_value(job.run(L, job.pinned));
+		}
+		catch (...)
+		{
+			job.promise.set_exception(std::current_exception());
+		}
+		lua_settop(L, 0);
+	}
+
+	LuaValueList LuaStatePool::CallFunction(lua_State * L, const std::string & function, const LuaValueList & args, bool pinned)
+	{
+		LuaValueList results;
+		CallContext context = { &function, &args, &results };
+		int top = lua_gettop(L);
+		LuaHelper::PushErrorHandler(L);											/* L: handler */
+		lua_pushcfunction(L, &LuaStatePool::CallThunk);							/* L: handler, thunk */
+		lua_pushlightuserdata(L, &context);										/* L: handler, thunk, context */
+		if (lua_pcall(L, 1, 0, top + 1) != LUA_OK)								/* L: handler, [traceback] */
+		{
+			std::string message = lua_type(L, -1) == LUA_TSTRING ? lua_tostring(L, -1) : "error object is not a string";
+			lua_settop(L, top);													/* L: */
+			throw std::runtime_error(message);
+		}
+		lua_settop(L, top);														/* L: */
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			StripFunctions(L, results[i], pinned);
+		}
+		return results;
+	}
+
+	int LuaStatePool::CallThunk(lua_State * L)
+	{
+		CallContext& context = *static_cast<CallContext*>(lua_touserdata(L, 1));
+		const std::string& function = *context.function;
+		const LuaValueList& args = *context.args;
+		lua_pushglobaltable(L);													/* L: context, globals */
+		for (size_t start = 0; ; )
+		{
+			size_t dot = function.find('.', start);
+			size_t end = dot == std::string::npos ? function.size() : dot;
+			lua_pushlstring(L, function.c_str() + start, end - start);			/* L: context, table, name */
+			lua_gettable(L, -2);												/* L: context, table, field */
+			lua_remove(L, -2);													/* L: context, field */
+			if (dot == std::string::npos)
+			{
+				break;
+			}
+			start = dot + 1;
+		}
+		if (!lua_isfunction(L, -1))
+		{
+			return luaL_error(L, "%s is not a function", function.c_str());
+		}
+		luaL_checkstack(L, (int)args.size(), "too many arguments");
+		for (size_t i = 0; i < args.size(); ++i)
+		{
+			LuaHelper::PushLuaValue(L, args[i]);								/* L: context, func, args... */
+		}
+		lua_call(L, (int)args.size(), LUA_MULTRET);								/* L: context, results... */
+		int count = lua_gettop(L) - 1;
+		context.results->resize((size_t)count);
+		for (int i = 0; i < count; ++i)
+		{
+			LuaHelper::CheckLuaValue(L, i + 2, (*context.results)[i]);
+		}
+		return 0;
+	}
+
+}
@@ -0,0 +1,118 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "lua_helper.h"
+
+namespace LuaCppHelper
+{
+
+	typedef std::vector<LuaValue>	LuaValueList;
+
+	/**
+	* LuaStatePool runs jobs on N worker threads, each owning an independent lua_State
+	* initialized the same way. Jobs submitted to any worker are balanced by work stealing:
+	* a worker takes its own jobs in order and steals from the back of the other queues when idle.
+	* A job pinned to a worker runs on that worker only, its state can be relied on between jobs.
+	*
+	* Functions: a LuaValueTypeFunction is a registry ref of one state only.
+	* - the arguments of a job which isn't pinned must not contain functions,
+	*   the future of such a job holds a std::invalid_argument;
+	* - the results of a pinned job keep their function refs, they are valid in jobs pinned to the
+	*   same worker, which must release them with LuaHelper::RemoveFunction;
+	* - the function refs in the results of other jobs are released and replaced by nil.
+	*
+	* Lua errors are reported as a std::runtime_error holding the traceback in the future.
+	*/
+	class LuaStatePool
+	{
+	public:
+		static const int AnyWorker = -1;
+
+		/**
+		* Start the workers.
+		*
+		* @param workers the count of threads and states.
+		* @param init called on every state by its worker after luaL_openlibs, e.g. to require modules.
+		* @param maxPending the count of unfinished jobs from which Submit blocks and TrySubmit fails.
+		*/
+		LuaStatePool(size_t workers, std::function<void(lua_State*)> init = nullptr, size_t maxPending = 4096);
+
+		/**
+		* Run the remaining jobs, then stop the workers and close their states.
+		*/
+		~LuaStatePool(void);
+
+		size_t WorkerCount(void) const { return _workers.size(); }
+		size_t PendingCount(void) const { return _pending; }
+
+		/**
+		* Call a global function, "module.function" paths are resolved field by field.
+		* Blocks while maxPending jobs are unfinished.
+		*
+		* @param worker the worker to run on, AnyWorker lets the pool choose.
+		* @return the future of all the results of the call.
+		*/
+		std::future<LuaValueList> Submit(const std::string& function, LuaValueList args, int worker = AnyWorker);
+
+		/**
+		* Run any job on a state, e.g. to keep data in a pinned state or release function refs.
+		* The job runs unprotected: it must not raise lua errors, C++ exceptions go to the future.
+		*/
+		std::future<LuaValueList> Submit(std::function<LuaValueList(lua_State*)> job, int worker = AnyWorker);
+
+		/**
+		* Like Submit, but fail instead of blocking when maxPending jobs are unfinished.
+		*/
+		bool TrySubmit(const std::string& function, LuaValueList args, std::future<LuaValueList>& future, int worker = AnyWorker);
+
+	private:
+		LuaStatePool(const LuaStatePool&);
+		LuaStatePool& operator=(const LuaStatePool&);
+
+		struct Job
+		{
+			std::function<LuaValueList(lua_State*, bool)>	run;	// the flag tells whether the job is pinned
+			std::promise<LuaValueList>						promise;
+			bool											pinned;
+		};
+
+		struct Worker
+		{
+			std::thread				thread;
+			std::mutex				mutex;
+			std::deque<Job>			jobs;		// may be stolen
+			std::deque<Job>			pinned;		// only run by this worker
+		};
+
+		bool TrySubmit(const std::string& function, LuaValueList args, std::future<LuaValueList>& future, int worker, bool wait);
+		std::future<LuaValueList> Enqueue(std::function<LuaValueList(lua_State*, bool)> run, int worker, bool wait, bool& queued);
+		bool Pop(size_t index, Job& job);
+		bool Steal(size_t index, Job& job);
+		void Run(size_t index, std::function<void(lua_State*)> init);
+		void Execute(lua_State* L, Job& job);
+
+		static LuaValueList CallFunction(lua_State* L, const std::string& function, const LuaValueList& args, bool pinned);
+		static int CallThunk(lua_State* L);
+
+		std::vector<std::unique_ptr<Worker> >	_workers;
+		std::mutex								_mutex;
+		std::condition_variable					_wake;		// a job was queued or the pool stops
+		std::condition_variable					_space;		// a job finished
+		std::atomic<size_t>						_pending;	// submitted and not finished
+		std::atomic<size_t>						_stealable;	// queued and not pinned
+		std::atomic<size_t>						_next;		// round robin of the jobs for any worker
+		size_t									_maxPending;
+		bool									_stopping;
+	};
+
+}
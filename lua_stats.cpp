@@ -0,0 +1,342 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#include "lua_stats.h"
+#if defined(LCH_ENABLE_STATS)
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#endif
+
+namespace LuaCppHelper
+{
+
+#if defined(LCH_ENABLE_STATS)
+	namespace
+	{
+		struct Counters
+		{
+			std::atomic<unsigned long long>	calls;
+			std::atomic<unsigned long long>	returns;
+			std::atomic<unsigned long long>	totalNs;
+			std::atomic<unsigned long long>	decodeNs;
+			std::atomic<unsigned long long>	histogram[LuaStatsBuckets];
+		};
+
+		// the counters of one thread, the slots are created by the thread on first use and read by Snapshot
+		struct ThreadBlock
+		{
+			std::atomic<Counters*>	slots[LuaStatsMaxBindings];
+			bool					inUse;		// guarded by Registry::mutex
+		};
+
+		struct Registry
+		{
+			std::mutex							mutex;
+			std::vector<std::string>			names;
+			std::unordered_map<std::string, int>	ids;
+			std::vector<ThreadBlock*>			blocks;		// never freed, the block of an exited thread goes to the next thread
+		};
+
+		Registry& GetRegistry(void)
+		{
+			static Registry* registry = new Registry();
+			return *registry;
+		}
+
+		std::atomic<bool> g_enabled(true);
+
+		// all the decode time of this thread, it only grows: a probe takes the difference over its call,
+		// so nothing has to be restored when a lua error unwinds past it
+		thread_local unsigned long long t_decodeNs = 0;
+		// the part of t_decodeNs already counted by probes which returned, subtracted by the probes around them
+		thread_local unsigned long long t_probedDecodeNs = 0;
+
+		class ThreadHolder
+		{
+		public:
+			ThreadHolder(void) : _block(nullptr) {}
+			~ThreadHolder(void)
+			{
+				if (_block != nullptr)
+				{
+					std::lock_guard<std::mutex> lock(GetRegistry().mutex);
+					_block->inUse = false;
+				}
+			}
+
+			Counters& Get(int id)
+			{
+				if (_block == nullptr)
+				{
+					Acquire();
+				}
+				Counters* counters = _block->slots[id].load(std::memory_order_relaxed);
+				if (counters == nullptr)
+				{
+					counters = new Counters();
+					for (int i = 0; i < LuaStatsBuckets; ++i)
+					{
+						counters->histogram[i].store(0, std::memory_order_relaxed);
+					}
+					counters->calls.store(0, std::memory_order_relaxed);
+					counters->returns.store(0, std::memory_order_relaxed);
+					counters->totalNs.store(0, std::memory_order_relaxed);
+					counters->decodeNs.store(0, std::memory_order_relaxed);
+					// release so that Snapshot sees the zeroed counters
+					_block->slots[id].store(counters, std::memory_order_release);
+				}
+				return *counters;
+			}
+
+		private:
+			void Acquire(void)
+			{
+				Registry& registry = GetRegistry();
+				std::lock_guard<std::mutex> lock(registry.mutex);
+				for (size_t i = 0; i < registry.blocks.size(); ++i)
+				{
+					if (!registry.blocks[i]->inUse)
+					{
+						_block = registry.blocks[i];
+						_block->inUse = true;
+						return;
+					}
+				}
+				_block = new ThreadBlock();
+				for (int i = 0; i < LuaStatsMaxBindings; ++i)
+				{
+					_block->slots[i].store(nullptr, std::memory_order_relaxed);
+				}
+				_block->inUse = true;
+				registry.blocks.push_back(_block);
+			}
+
+			ThreadBlock*	_block;
+		};
+
+		thread_local ThreadHolder t_holder;
+
+		long long Now(void)
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		// only the owning thread writes, a plain load and store is enough and avoids a locked instruction
+		void Add(std::atomic<unsigned long long>& counter, unsigned long long value)
+		{
+			counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+		}
+
+		int Bucket(unsigned long long ns)
+		{
+			int bucket = 0;
+			while (ns > 1 && bucket < LuaStatsBuckets - 1)
+			{
+				ns >>= 1;
+				++bucket;
+			}
+			return bucket;
+		}
+	}
+
+	long long LuaStatsDecodeBegin(void)
+	{
+		return g_enabled.load(std::memory_order_relaxed) ? Now() : 0;
+	}
+
+	void LuaStatsDecodeEnd(long long start)
+	{
+		if (start != 0)
+		{
+			t_decodeNs += (unsigned long long)(Now() - start);
+		}
+	}
+
+	void LuaStats::Instrument(lua_State * L, int index, const char * prefix)
+	{
+		index = lua_absindex(L, index);
+		lua_pushnil(L);															/* L: nil */
+		while (lua_next(L, index))												/* L: key, value */
+		{
+			bool wrap = lua_type(L, -2) == LUA_TSTRING && lua_iscfunction(L, -1);
+			// the closure only keeps the function pointer, so C closures with upvalues stay as they are
+			if (wrap && lua_getupvalue(L, -1, 1) != nullptr)					/* L: key, value, upvalue */
+			{
+				lua_pop(L, 1);													/* L: key, value */
+				wrap = false;
+			}
+			int id = wrap ? Define(std::string(prefix) + "." + lua_tostring(L, -2)) : -1;
+			if (id >= 0)
+			{
+				lua_pushcfunction(L, lua_tocfunction(L, -1));					/* L: key, value, func */
+				lua_pushinteger(L, id);											/* L: key, value, func, id */
+				lua_pushcclosure(L, &LuaStats::Probe, 2);						/* L: key, value, probe */
+				lua_pushvalue(L, -3);											/* L: key, value, probe, key */
+				lua_insert(L, -2);												/* L: key, value, key, probe */
+				// replacing the value of an existing key doesn't disturb lua_next
+				lua_rawset(L, index);											/* L: key, value */
+			}
+			lua_pop(L, 1);														/* L: key */
+		}
+	}
+
+	int LuaStats::Define(const std::string & name)
+	{
+		Registry& registry = GetRegistry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		std::unordered_map<std::string, int>::iterator it = registry.ids.find(name);
+		if (it != registry.ids.end())
+		{
+			return it->second;
+		}
+		if (registry.names.size() >= (size_t)LuaStatsMaxBindings)
+		{
+			return -1;
+		}
+		int id = (int)registry.names.size();
+		registry.names.push_back(name);
+		registry.ids[name] = id;
+		return id;
+	}
+
+	void LuaStats::SetEnabled(bool enabled)
+	{
+		g_enabled.store(enabled, std::memory_order_relaxed);
+	}
+
+	bool LuaStats::IsEnabled(void)
+	{
+		return g_enabled.load(std::memory_order_relaxed);
+	}
+
+	std::vector<LuaBindingStats> LuaStats::Snapshot(void)
+	{
+		Registry& registry = GetRegistry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		std::vector<LuaBindingStats> snapshot;
+		for (size_t id = 0; id < registry.names.size(); ++id)
+		{
+			LuaBindingStats stats;
+			memset(stats.histogram, 0, sizeof(stats.histogram));
+			stats.calls = stats.raised = stats.totalNs = stats.decodeNs = 0;
+			unsigned long long returns = 0;
+			for (size_t i = 0; i < registry.blocks.size(); ++i)
+			{
+				const Counters* counters = registry.blocks[i]->slots[id].load(std::memory_order_acquire);
+				if (counters == nullptr)
+				{
+					continue;
+				}
+				// returns is read first, a call in flight can't make it exceed calls
+				returns += counters->returns.load(std::memory_order_relaxed);
+				stats.calls += counters->calls.load(std::memory_order_relaxed);
+				stats.totalNs += counters->totalNs.load(std::memory_order_relaxed);
+				stats.decodeNs += counters->decodeNs.load(std::memory_order_relaxed);
+				for (int bucket = 0; bucket < LuaStatsBuckets; ++bucket)
+				{
+					stats.histogram[bucket] += counters->histogram[bucket].load(std::memory_order_relaxed);
+				}
+			}
+			if (stats.calls == 0)
+			{
+				continue;
+			}
+			stats.name = registry.names[id];
+			stats.raised = stats.calls > returns ? stats.calls - returns : 0;
+			snapshot.push_back(stats);
+		}
+		return snapshot;
+	}
+
+	int LuaStats::Probe(lua_State * L)
+	{
+		lua_CFunction func = lua_tocfunction(L, lua_upvalueindex(1));
+		if (!g_enabled.load(std::memory_order_relaxed))
+		{
+			return func(L);
+		}
+		Counters& counters = t_holder.Get((int)lua_tointeger(L, lua_upvalueindex(2)));
+		Add(counters.calls, 1);
+		// only locals: an error or a yield longjmps past the rest, and the counters stay consistent.
+		// the decoding of nested bindings which returned is theirs, of those which raised it stays with this one
+		unsigned long long decodeStart = t_decodeNs;
+		unsigned long long probedStart = t_probedDecodeNs;
+		long long start = Now();
+		int results = func(L);
+		unsigned long long elapsed = (unsigned long long)(Now() - start);
+		unsigned long long decodeNs = (t_decodeNs - decodeStart) - (t_probedDecodeNs - probedStart);
+		t_probedDecodeNs += decodeNs;
+		Add(counters.returns, 1);
+		Add(counters.totalNs, elapsed);
+		Add(counters.decodeNs, decodeNs);
+		Add(counters.histogram[Bucket(elapsed)], 1);
+		return results;
+	}
+#else
+	void LuaStats::Instrument(lua_State *, int, const char *)
+	{
+	}
+
+	int LuaStats::Define(const std::string &)
+	{
+		return -1;
+	}
+
+	void LuaStats::SetEnabled(bool)
+	{
+	}
+
+	bool LuaStats::IsEnabled(void)
+	{
+		return false;
+	}
+
+	std::vector<LuaBindingStats> LuaStats::Snapshot(void)
+	{
+		return std::vector<LuaBindingStats>();
+	}
+
+	int LuaStats::Probe(lua_State *)
+	{
+		return 0;
+	}
+#endif
+
+	void LuaStats::Push(lua_State * L)
+	{
+		std::vector<LuaBindingStats> snapshot = Snapshot();
+		lua_createtable(L, 0, (int)snapshot.size());							/* L: stats */
+		for (size_t i = 0; i < snapshot.size(); ++i)
+		{
+			const LuaBindingStats& stats = snapshot[i];
+			lua_createtable(L, 0, 6);											/* L: stats, binding */
+			lua_pushinteger(L, (lua_Integer)stats.calls);
+			lua_setfield(L, -2, "calls");
+			lua_pushinteger(L, (lua_Integer)stats.raised);
+			lua_setfield(L, -2, "raised");
+			lua_pushinteger(L, (lua_Integer)stats.totalNs);
+			lua_setfield(L, -2, "total_ns");
+			lua_pushinteger(L, (lua_Integer)stats.decodeNs);
+			lua_setfield(L, -2, "decode_ns");
+			lua_pushinteger(L, (lua_Integer)(stats.totalNs > stats.decodeNs ? stats.totalNs - stats.decodeNs : 0));
+			lua_setfield(L, -2, "body_ns");
+			lua_createtable(L, LuaStatsBuckets, 0);								/* L: stats, binding, histogram */
+			for (int bucket = 0; bucket < LuaStatsBuckets; ++bucket)
+			{
+				lua_pushinteger(L, (lua_Integer)stats.histogram[bucket]);
+				lua_rawseti(L, -2, bucket + 1);
+			}
+			lua_setfield(L, -2, "histogram");									/* L: stats, binding */
+			lua_setfield(L, -2, stats.name.c_str());							/* L: stats */
+		}
+	}
+
+	int LuaStats::LuaSnapshot(lua_State * L)
+	{
+		Push(L);
+		return 1;
+	}
+
+}
@@ -0,0 +1,85 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "lua_helper.h"
+
+namespace LuaCppHelper
+{
+
+	/**
+	* The count of latency buckets, bucket i counts the calls which took [2^i, 2^(i+1)) nanoseconds,
+	* the last bucket also counts the slower calls.
+	*/
+	static const int LuaStatsBuckets = 32;
+
+	/**
+	* The most bindings LuaStats can tell apart, later bindings are left unwrapped.
+	*/
+	static const int LuaStatsMaxBindings = 1024;
+
+	/**
+	* The totals of one binding over all threads.
+	*/
+	struct LuaBindingStats
+	{
+		std::string			name;
+		unsigned long long	calls;
+		unsigned long long	raised;			// calls left by a lua error or a yield, their times aren't counted
+		unsigned long long	totalNs;		// time of the returned calls
+		unsigned long long	decodeNs;		// the part of totalNs spent in LuaHelper::Check and LuaHelper::CheckArgument
+		unsigned long long	histogram[LuaStatsBuckets];
+	};
+
+	/**
+	* LuaStats measures the lua_CFunctions of a module: Instrument replaces each of them by a closure
+	* counting the calls and timing the whole call and its argument decoding.
+	* The counters live in per-thread blocks written by their thread only, reading a snapshot takes no lock on the call path.
+	*
+	*   luaL_newlib(L, lch_example_functions);
+	*   LuaStats::Instrument(L, -1, "lch_example");
+	*
+	* Everything is compiled out unless LCH_ENABLE_STATS is defined, Instrument then leaves the functions alone
+	* and Snapshot is empty. When compiled in, SetEnabled(false) reduces a wrapped call to one extra indirection.
+	*/
+	class LuaStats
+	{
+	public:
+		/**
+		* Wrap the C functions without upvalues of the table at index, they are named prefix.key.
+		*/
+		static void Instrument(lua_State* L, int index, const char* prefix);
+
+		/**
+		* Get the id of a binding name, the same name always gets the same id.
+		*
+		* @return -1 if there is no room for another binding.
+		*/
+		static int Define(const std::string& name);
+
+		static void SetEnabled(bool enabled);
+		static bool IsEnabled(void);
+
+		/**
+		* Sum the counters of all threads, the bindings which were never called are left out.
+		*/
+		static std::vector<LuaBindingStats> Snapshot(void);
+
+		/**
+		* Push the snapshot as a table keyed by binding name, each entry has the fields
+		* calls, raised, total_ns, decode_ns, body_ns and histogram, an array of LuaStatsBuckets counts.
+		*/
+		static void Push(lua_State* L);
+
+		/**
+		* stats() for lua, return the snapshot as Push does.
+		*/
+		static int LuaSnapshot(lua_State* L);
+
+	private:
+		static int Probe(lua_State* L);
+	};
+
+}
@@ -0,0 +1,392 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#include "lua_table.h"
+
+namespace LuaCppHelper
+{
+
+	namespace
+	{
+		const size_t NoSlot = (size_t)-1;
+		const size_t MinHashCapacity = 4;
+
+		size_t HashInteger(long long key)
+		{
+			unsigned long long x = (unsigned long long)key;
+			x ^= x >> 33;
+			x *= 0xff51afd7ed558ccdULL;
+			x ^= x >> 33;
+			return (size_t)x;
+		}
+
+		size_t HashString(const char* key, size_t keySize)
+		{
+			// FNV-1a
+			unsigned long long x = 14695981039346656037ULL;
+			for (size_t i = 0; i < keySize; ++i)
+			{
+				x ^= (unsigned char)key[i];
+				x *= 1099511628211ULL;
+			}
+			return (size_t)x;
+		}
+
+		size_t HashKey(const LuaValue& key)
+		{
+			if (key.getType() == LuaValueTypeInt)
+			{
+				return HashInteger(key.IntValue());
+			}
+			return HashString(key.StringData(), key.StringSize());
+		}
+
+		bool IsIntegerKey(const LuaValue& key, long long intKey)
+		{
+			return key.getType() == LuaValueTypeInt && key.IntValue() == intKey;
+		}
+
+		bool IsStringKey(const LuaValue& key, const char* stringKey, size_t keySize)
+		{
+			return key.getType() == LuaValueTypeString
+				&& key.StringSize() == keySize
+				&& memcmp(key.StringData(), stringKey, keySize) == 0;
+		}
+	}
+
+	LuaTable::LuaTable(void)
+		: _hashSize(0)
+	{
+	}
+
+	LuaTable::LuaTable(LuaArena* arena)
+		: _array(LuaArenaAllocator<LuaValue>(arena))
+		, _hash(LuaArenaAllocator<LuaTableNode>(arena))
+		, _hashSize(0)
+	{
+	}
+
+	LuaTable::LuaTable(const LuaValueDict& dict, const LuaValueArray& array)
+		: _hashSize(0)
+	{
+		Reserve(0, dict.size());
+		for (LuaValueArrayIterator it = array.begin(); it != array.end(); ++it)
+		{
+			Set(it->first, it->second);
+		}
+		for (LuaValueDictIterator it = dict.begin(); it != dict.end(); ++it)
+		{
+			Set(it->first, it->second);
+		}
+	}
+
+	void LuaTable::Reserve(size_t arraySize, size_t hashSize)
+	{
+		_array.reserve(arraySize);
+		size_t capacity = MinHashCapacity;
+		while (capacity * 3 < hashSize * 4)
+		{
+			capacity <<= 1;
+		}
+		if (hashSize > 0 && capacity > _hash.size())
+		{
+			Rehash(capacity);
+		}
+	}
+
+	void LuaTable::Clear(void)
+	{
+		_maps.Reset();
+		_array.clear();
+		for (size_t i = 0; i < _hash.size(); ++i)
+		{
+			_hash[i].key = LuaValue();
+			_hash[i].value = LuaValue();
+		}
+		_hashSize = 0;
+	}
+
+	void LuaTable::Set(long long key, const LuaValue& value)
+	{
+		Set(key, LuaValue(value));
+	}
+
+	void LuaTable::Set(long long key, LuaValue&& value)
+	{
+		_maps.Reset();
+		if (key >= 1 && (unsigned long long)key <= _array.size())
+		{
+			_array[(size_t)key - 1] = std::move(value);
+			return;
+		}
+		if (key >= 1 && (unsigned long long)key == _array.size() + 1)
+		{
+			Append(std::move(value));
+			return;
+		}
+		size_t slot = FindSlot(key);
+		if (slot != NoSlot)
+		{
+			_hash[slot].value = std::move(value);
+			return;
+		}
+		InsertSlot(LuaValue::IntValue(key), HashInteger(key)) = std::move(value);
+	}
+
+	void LuaTable::Set(const std::string& key, const LuaValue& value)
+	{
+		Set(key.c_str(), key.size(), LuaValue(value));
+	}
+
+	void LuaTable::Set(const std::string& key, LuaValue&& value)
+	{
+		Set(key.c_str(), key.size(), std::move(value));
+	}
+
+	void LuaTable::Set(const char* key, size_t keySize, LuaValue&& value)
+	{
+		_maps.Reset();
+		size_t slot = FindSlot(key, keySize);
+		if (slot != NoSlot)
+		{
+			_hash[slot].value = std::move(value);
+			return;
+		}
+		LuaArena* arena = Arena();
+		LuaValue stringKey = arena != nullptr ? LuaValue::StringValue(key, keySize, *arena) : LuaValue::StringValue(key, keySize);
+		InsertSlot(std::move(stringKey), HashString(key, keySize)) = std::move(value);
+	}
+
+	void LuaTable::Append(const LuaValue& value)
+	{
+		Append(LuaValue(value));
+	}
+
+	void LuaTable::Append(LuaValue&& value)
+	{
+		_maps.Reset();
+		_array.push_back(std::move(value));
+		if (_hashSize > 0)
+		{
+			MigrateToArray();
+		}
+	}
+
+	const LuaValue* LuaTable::Find(long long key) const
+	{
+		if (key >= 1 && (unsigned long long)key <= _array.size())
+		{
+			return &_array[(size_t)key - 1];
+		}
+		size_t slot = FindSlot(key);
+		return slot == NoSlot ? nullptr : &_hash[slot].value;
+	}
+
+	const LuaValue* LuaTable::Find(const std::string& key) const
+	{
+		return Find(key.c_str(), key.size());
+	}
+
+	const LuaValue* LuaTable::Find(const char* key, size_t keySize) const
+	{
+		size_t slot = FindSlot(key, keySize);
+		return slot == NoSlot ? nullptr : &_hash[slot].value;
+	}
+
+	bool LuaTable::Erase(long long key)
+	{
+		_maps.Reset();
+		if (key >= 1 && (unsigned long long)key <= _array.size())
+		{
+			// the keys behind the hole are no longer dense, move them to the hash part
+			for (size_t i = (size_t)key; i < _array.size(); ++i)
+			{
+				long long tailKey = (long long)i + 1;
+				InsertSlot(LuaValue::IntValue(tailKey), HashInteger(tailKey)) = std::move(_array[i]);
+			}
+			_array.resize((size_t)key - 1);
+			return true;
+		}
+		size_t slot = FindSlot(key);
+		if (slot == NoSlot)
+		{
+			return false;
+		}
+		EraseSlot(slot);
+		return true;
+	}
+
+	bool LuaTable::Erase(const std::string& key)
+	{
+		_maps.Reset();
+		size_t slot = FindSlot(key.c_str(), key.size());
+		if (slot == NoSlot)
+		{
+			return false;
+		}
+		EraseSlot(slot);
+		return true;
+	}
+
+	LuaValueDict LuaTable::ToDict(void) const
+	{
+		LuaValueDict dict;
+		for (LuaTableHashIterator it = HashBegin(); it != HashEnd(); ++it)
+		{
+			if (it->key.getType() == LuaValueTypeString)
+			{
+				dict.insert(std::make_pair(std::string(it->key.StringValue()), it->value));
+			}
+		}
+		return dict;
+	}
+
+	LuaValueArray LuaTable::ToArray(void) const
+	{
+		LuaValueArray array;
+		long long key = 1;
+		for (LuaTableArrayIterator it = ArrayBegin(); it != ArrayEnd(); ++it, ++key)
+		{
+			array.insert(array.end(), std::make_pair(key, *it));
+		}
+		for (LuaTableHashIterator it = HashBegin(); it != HashEnd(); ++it)
+		{
+			if (it->key.getType() == LuaValueTypeInt)
+			{
+				array.insert(std::make_pair(it->key.IntValue(), it->value));
+			}
+		}
+		return array;
+	}
+
+	const LuaValueDict& LuaTable::DictView(void) const
+	{
+		LuaValueDict* dict = _maps.dict.load(std::memory_order_acquire);
+		return dict != nullptr ? *dict : LuaTableMapCache::Install(_maps.dict, ToDict());
+	}
+
+	const LuaValueArray& LuaTable::ArrayView(void) const
+	{
+		LuaValueArray* array = _maps.array.load(std::memory_order_acquire);
+		return array != nullptr ? *array : LuaTableMapCache::Install(_maps.array, ToArray());
+	}
+
+	size_t LuaTable::FindSlot(long long key) const
+	{
+		if (_hashSize == 0)
+		{
+			return NoSlot;
+		}
+		size_t mask = _hash.size() - 1;
+		for (size_t slot = HashInteger(key) & mask; ; slot = (slot + 1) & mask)
+		{
+			const LuaValue& slotKey = _hash[slot].key;
+			if (slotKey.getType() == LuaValueTypeNil)
+			{
+				return NoSlot;
+			}
+			if (IsIntegerKey(slotKey, key))
+			{
+				return slot;
+			}
+		}
+	}
+
+	size_t LuaTable::FindSlot(const char* key, size_t keySize) const
+	{
+		if (_hashSize == 0)
+		{
+			return NoSlot;
+		}
+		size_t mask = _hash.size() - 1;
+		for (size_t slot = HashString(key, keySize) & mask; ; slot = (slot + 1) & mask)
+		{
+			const LuaValue& slotKey = _hash[slot].key;
+			if (slotKey.getType() == LuaValueTypeNil)
+			{
+				return NoSlot;
+			}
+			if (IsStringKey(slotKey, key, keySize))
+			{
+				return slot;
+			}
+		}
+	}
+
+	LuaValue& LuaTable::InsertSlot(LuaValue&& key, size_t hash)
+	{
+		// keep the load factor under 3/4 so that probe sequences stay short
+		if ((_hashSize + 1) * 4 > _hash.size() * 3)
+		{
+			Rehash(_hash.empty() ? MinHashCapacity : _hash.size() * 2);
+		}
+		size_t mask = _hash.size() - 1;
+		size_t slot = hash & mask;
+		while (_hash[slot].key.getType() != LuaValueTypeNil)
+		{
+			slot = (slot + 1) & mask;
+		}
+		_hash[slot].key = std::move(key);
+		++_hashSize;
+		return _hash[slot].value;
+	}
+
+	void LuaTable::EraseSlot(size_t slot)
+	{
+		// backward shift deletion, no tombstones are left behind
+		size_t mask = _hash.size() - 1;
+		size_t hole = slot;
+		for (size_t next = (hole + 1) & mask; _hash[next].key.getType() != LuaValueTypeNil; next = (next + 1) & mask)
+		{
+			size_t home = HashKey(_hash[next].key) & mask;
+			bool reachable = hole <= next ? (hole < home && home <= next) : (hole < home || home <= next);
+			if (reachable)
+			{
+				continue;
+			}
+			_hash[hole].key = std::move(_hash[next].key);
+			_hash[hole].value = std::move(_hash[next].value);
+			hole = next;
+		}
+		_hash[hole].key = LuaValue();
+		_hash[hole].value = LuaValue();
+		--_hashSize;
+	}
+
+	void LuaTable::Rehash(size_t capacity)
+	{
+		// value initialized nodes, copying a prototype node would go through LuaValue::Copy
+		LuaTableHashPart nodes(_hash.get_allocator());
+		nodes.resize(capacity);
+		nodes.swap(_hash);
+		size_t mask = capacity - 1;
+		for (size_t i = 0; i < nodes.size(); ++i)
+		{
+			if (nodes[i].key.getType() == LuaValueTypeNil)
+			{
+				continue;
+			}
+			size_t slot = HashKey(nodes[i].key) & mask;
+			while (_hash[slot].key.getType() != LuaValueTypeNil)
+			{
+				slot = (slot + 1) & mask;
+			}
+			_hash[slot].key = std::move(nodes[i].key);
+			_hash[slot].value = std::move(nodes[i].value);
+		}
+	}
+
+	void LuaTable::MigrateToArray(void)
+	{
+		for (;;)
+		{
+			size_t slot = FindSlot((long long)_array.size() + 1);
+			if (slot == NoSlot)
+			{
+				break;
+			}
+			_array.push_back(std::move(_hash[slot].value));
+			EraseSlot(slot);
+		}
+	}
+
+}
@@ -0,0 +1,205 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "lua_value.h"
+#include "lua_arena.h"
+
+namespace LuaCppHelper
+{
+
+	/// @cond
+	struct LuaTableNode
+	{
+		LuaValue key;		// LuaValueTypeNil marks an empty slot
+		LuaValue value;
+	};
+	/// @endcond
+
+	typedef std::vector<LuaValue, LuaArenaAllocator<LuaValue> >	LuaTableArrayPart;
+	typedef std::vector<LuaTableNode, LuaArenaAllocator<LuaTableNode> >	LuaTableHashPart;
+	typedef LuaTableArrayPart::const_iterator	LuaTableArrayIterator;
+
+	/// @cond
+	// the map based views of a table, built on first use and dropped when the table changes, copies start empty.
+	// concurrent const readers race to install a view, the loser deletes its copy.
+	class LuaTableMapCache
+	{
+	public:
+		LuaTableMapCache(void) : dict(nullptr), array(nullptr) {}
+		LuaTableMapCache(const LuaTableMapCache&) : dict(nullptr), array(nullptr) {}
+		LuaTableMapCache(LuaTableMapCache&& rhs) noexcept : dict(nullptr), array(nullptr) { rhs.Reset(); }
+		LuaTableMapCache& operator=(const LuaTableMapCache&) { Reset(); return *this; }
+		LuaTableMapCache& operator=(LuaTableMapCache&& rhs) noexcept { Reset(); rhs.Reset(); return *this; }
+		~LuaTableMapCache(void) { Reset(); }
+
+		void Reset(void)
+		{
+			delete dict.exchange(nullptr, std::memory_order_acq_rel);
+			delete array.exchange(nullptr, std::memory_order_acq_rel);
+		}
+
+		template<typename T>
+		static const T& Install(std::atomic<T*>& slot, T&& built)
+		{
+			T* view = slot.load(std::memory_order_acquire);
+			if (view == nullptr)
+			{
+				std::unique_ptr<T> own(new T(std::move(built)));
+				if (slot.compare_exchange_strong(view, own.get(), std::memory_order_acq_rel, std::memory_order_acquire))
+				{
+					view = own.release();
+				}
+			}
+			return *view;
+		}
+
+		std::atomic<LuaValueDict*>	dict;
+		std::atomic<LuaValueArray*>	array;
+	};
+	/// @endcond
+
+	/**
+	* Iterate over the occupied slots of the hash part of a LuaTable.
+	*/
+	class LuaTableHashIterator
+	{
+	public:
+		LuaTableHashIterator(const LuaTableNode* node, const LuaTableNode* end)
+			: _node(node), _end(end)
+		{
+			SkipEmpty();
+		}
+
+		const LuaTableNode& operator*() const { return *_node; }
+		const LuaTableNode* operator->() const { return _node; }
+		LuaTableHashIterator& operator++() { ++_node; SkipEmpty(); return *this; }
+		bool operator==(const LuaTableHashIterator& rhs) const { return _node == rhs._node; }
+		bool operator!=(const LuaTableHashIterator& rhs) const { return _node != rhs._node; }
+
+	private:
+		void SkipEmpty()
+		{
+			while (_node != _end && _node->key.getType() == LuaValueTypeNil) ++_node;
+		}
+
+		const LuaTableNode* _node;
+		const LuaTableNode* _end;
+	};
+
+	/**
+	* A table laid out like a lua table: integer keys 1..n live in a contiguous array part,
+	* string keys and the other integer keys live in an open-addressing hash part.
+	*/
+	class LuaTable
+	{
+	public:
+		LuaTable(void);
+
+		/**
+		* Construct an empty LuaTable whose parts and long string keys are allocated from an arena.
+		*
+		* @param arena the arena which must outlive the table, nullptr means the heap.
+		*/
+		explicit LuaTable(LuaArena* arena);
+
+		/**
+		* Construct a LuaTable from the map based representation.
+		*
+		* @param dict the string keyed values.
+		* @param array the integer keyed values.
+		*/
+		LuaTable(const LuaValueDict& dict, const LuaValueArray& array);
+
+		/**
+		* Reserve room so that the given counts of elements can be set without reallocation.
+		*
+		* @param arraySize the count of dense integer keys starting from 1.
+		* @param hashSize the count of string keys and sparse integer keys.
+		*/
+		void Reserve(size_t arraySize, size_t hashSize);
+
+		/**
+		* Remove all elements, the capacity is kept.
+		*/
+		void Clear(void);
+
+		size_t Size(void) const { return _array.size() + _hashSize; }
+		size_t ArraySize(void) const { return _array.size(); }
+		size_t HashSize(void) const { return _hashSize; }
+		size_t ArrayCapacity(void) const { return _array.capacity(); }
+		size_t HashCapacity(void) const { return _hash.size(); }
+		bool Empty(void) const { return Size() == 0; }
+		LuaArena* Arena(void) const { return _array.get_allocator().Arena(); }
+
+		/**
+		* Set the value of a key, an existing value is replaced.
+		*/
+		void Set(long long key, const LuaValue& value);
+		void Set(long long key, LuaValue&& value);
+		void Set(const std::string& key, const LuaValue& value);
+		void Set(const std::string& key, LuaValue&& value);
+		void Set(const char* key, size_t keySize, LuaValue&& value);
+
+		/**
+		* Append a value at key ArraySize() + 1.
+		*/
+		void Append(const LuaValue& value);
+		void Append(LuaValue&& value);
+
+		/**
+		* Find the value of a key.
+		*
+		* @return a pointer to the value, nullptr if the key doesn't exist.
+		*/
+		const LuaValue* Find(long long key) const;
+		const LuaValue* Find(const std::string& key) const;
+		const LuaValue* Find(const char* key, size_t keySize) const;
+
+		/**
+		* Remove a key.
+		*
+		* @return whether the key existed.
+		*/
+		bool Erase(long long key);
+		bool Erase(const std::string& key);
+
+		/**
+		* The element at ArrayBegin() + i has the key i + 1.
+		*/
+		LuaTableArrayIterator ArrayBegin(void) const { return _array.begin(); }
+		LuaTableArrayIterator ArrayEnd(void) const { return _array.end(); }
+		LuaTableHashIterator HashBegin(void) const { return LuaTableHashIterator(_hash.data(), _hash.data() + _hash.size()); }
+		LuaTableHashIterator HashEnd(void) const { return LuaTableHashIterator(_hash.data() + _hash.size(), _hash.data() + _hash.size()); }
+
+		/**
+		* Convert to the map based representation.
+		*/
+		LuaValueDict ToDict(void) const;
+		LuaValueArray ToArray(void) const;
+
+		/**
+		* The map based representation built once and kept until the table changes,
+		* the references stay valid until then. Concurrent calls on a const table are safe.
+		*/
+		const LuaValueDict& DictView(void) const;
+		const LuaValueArray& ArrayView(void) const;
+
+	private:
+		size_t FindSlot(long long key) const;
+		size_t FindSlot(const char* key, size_t keySize) const;
+		LuaValue& InsertSlot(LuaValue&& key, size_t hash);
+		void EraseSlot(size_t slot);
+		void Rehash(size_t capacity);
+		void MigrateToArray(void);
+
+		LuaTableArrayPart			_array;
+		LuaTableHashPart			_hash;
+		size_t						_hashSize;
+		mutable LuaTableMapCache	_maps;
+	};
+
+}
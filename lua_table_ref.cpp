@@ -0,0 +1,167 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#include "lua_table_ref.h"
+
+namespace LuaCppHelper
+{
+
+	LuaTableRef::LuaTableRef(lua_State * L, int index)
+		: _L(L)
+		, _index(lua_absindex(L, index))
+		, _ref(LUA_NOREF)
+	{
+		luaL_argcheck(L, lua_istable(L, _index), _index, "Need a Table");
+	}
+
+	LuaTableRef::LuaTableRef(LuaTableRef && rhs) noexcept
+		: _L(rhs._L)
+		, _index(rhs._index)
+		, _ref(rhs._ref)
+	{
+		rhs._L = nullptr;
+		rhs._ref = LUA_NOREF;
+	}
+
+	LuaTableRef & LuaTableRef::operator=(LuaTableRef && rhs) noexcept
+	{
+		if (this != &rhs)
+		{
+			Unpin();
+			_L = rhs._L;
+			_index = rhs._index;
+			_ref = rhs._ref;
+			rhs._L = nullptr;
+			rhs._ref = LUA_NOREF;
+		}
+		return *this;
+	}
+
+	void LuaTableRef::Pin(void)
+	{
+		if (_L == nullptr || _ref != LUA_NOREF)
+		{
+			return;
+		}
+		lua_pushvalue(_L, _index);
+		_ref = luaL_ref(_L, LUA_REGISTRYINDEX);
+		_index = 0;
+		// keep the main thread, the coroutine the table was checked on may be collected first
+		lua_rawgeti(_L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);		/* L: main */
+		lua_State * L = lua_tothread(_L, -1);
+		lua_pop(_L, 1);												/* L: */
+		_L = L;
+	}
+
+	void LuaTableRef::Unpin(void)
+	{
+		if (_ref == LUA_NOREF)
+		{
+			return;
+		}
+		luaL_unref(_L, LUA_REGISTRYINDEX, _ref);
+		_ref = LUA_NOREF;
+		_L = nullptr;
+	}
+
+	void LuaTableRef::Push(void) const
+	{
+		if (_ref != LUA_NOREF)
+		{
+			lua_rawgeti(_L, LUA_REGISTRYINDEX, _ref);
+		}
+		else
+		{
+			lua_pushvalue(_L, _index);
+		}
+	}
+
+	size_t LuaTableRef::Size(void) const
+	{
+		int index = Acquire();
+		size_t size = lua_rawlen(_L, index);
+		Release();
+		return size;
+	}
+
+	LuaTableRef::Iterator LuaTableRef::begin(void) const
+	{
+		return Iterator(*this);
+	}
+
+	int LuaTableRef::Acquire(void) const
+	{
+		if (_ref != LUA_NOREF)
+		{
+			lua_rawgeti(_L, LUA_REGISTRYINDEX, _ref);
+			return lua_gettop(_L);
+		}
+		return _index;
+	}
+
+	void LuaTableRef::Release(void) const
+	{
+		if (_ref != LUA_NOREF)
+		{
+			lua_pop(_L, 1);
+		}
+	}
+
+	LuaTableRef::Iterator::Iterator(const LuaTableRef & table)
+		: _L(table._L)
+	{
+		_top = lua_gettop(_L);
+		_table = table.Acquire();
+		_base = lua_gettop(_L);
+		lua_pushnil(_L);
+		Next();
+	}
+
+	LuaTableRef::Iterator::Iterator(Iterator && rhs) noexcept
+		: _L(rhs._L)
+		, _table(rhs._table)
+		, _base(rhs._base)
+		, _top(rhs._top)
+	{
+		rhs._L = nullptr;
+	}
+
+	LuaTableRef::Iterator::~Iterator(void)
+	{
+		// leaving the loop early keeps the key and the value on the stack
+		if (_L != nullptr)
+		{
+			lua_settop(_L, _top);
+		}
+	}
+
+	LuaTableRef::Iterator & LuaTableRef::Iterator::operator++(void)
+	{
+		lua_settop(_L, _base + 1);
+		Next();
+		return *this;
+	}
+
+	void LuaTableRef::Iterator::Next(void)
+	{
+		if (lua_next(_L, _table) == 0)
+		{
+			lua_settop(_L, _top);
+			_L = nullptr;
+		}
+	}
+
+	void LuaHelper::CheckLuaTable(lua_State * L, int index, LuaTableRef & val)
+	{
+		val = LuaTableRef(L, index);
+	}
+
+	void LuaHelper::CheckImpl(lua_State * L, int index, LuaTableRef & val, bool cannil)
+	{
+		if (cannil && lua_isnoneornil(L, index))
+		{
+			return;
+		}
+		CheckLuaTable(L, index, val);
+	}
+
+}
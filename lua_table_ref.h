@@ -0,0 +1,193 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#pragma once
+
+#include "lua_helper.h"
+
+namespace LuaCppHelper
+{
+
+	/**
+	* LuaTableRef refers to a lua table without converting it, entries are only decoded when they are read.
+	* It refers to a stack slot by default, which is valid during the C function it was checked in.
+	* Pin() moves the reference into the registry and onto the main thread so that it can be kept longer,
+	* even after the coroutine it was checked on is gone.
+	*/
+	class LuaTableRef
+	{
+	public:
+		class Iterator;
+		struct IteratorEnd {};
+
+		LuaTableRef(void) : _L(nullptr), _index(0), _ref(LUA_NOREF) {}
+		LuaTableRef(lua_State* L, int index);
+		LuaTableRef(LuaTableRef&& rhs) noexcept;
+		LuaTableRef& operator=(LuaTableRef&& rhs) noexcept;
+		~LuaTableRef(void) { Unpin(); }
+
+		bool IsValid(void) const { return _L != nullptr; }
+		bool IsPinned(void) const { return _ref != LUA_NOREF; }
+		lua_State* State(void) const { return _L; }
+
+		/**
+		* Keep the table in the registry, the reference stays valid after the stack slot is gone.
+		* A pinned reference is used through the main thread.
+		*/
+		void Pin(void);
+
+		/**
+		* Release the registry reference, the LuaTableRef becomes invalid if it was pinned.
+		*/
+		void Unpin(void);
+
+		/**
+		* Push the table onto the stack.
+		*/
+		void Push(void) const;
+
+		/**
+		* Get the length of the table as lua_rawlen does.
+		*/
+		size_t Size(void) const;
+
+		/**
+		* Check whether a key has a non nil value.
+		*/
+		template <typename K>
+		bool Contains(const K& key) const
+		{
+			int index = Acquire();
+			PushKey(key);
+			bool found = lua_rawget(_L, index) != LUA_TNIL;
+			lua_pop(_L, 1);
+			Release();
+			return found;
+		}
+
+		/**
+		* Decode the value of a key, raise a lua error if it can't be converted to T.
+		*/
+		template <typename T, typename K>
+		T Get(const K& key) const
+		{
+			T val = T();
+			int index = Acquire();
+			PushKey(key);
+			lua_rawget(_L, index);
+			LuaHelper::CheckImpl(_L, lua_gettop(_L), val, false);
+			lua_pop(_L, 1);
+			Release();
+			return val;
+		}
+
+		/**
+		* Decode the value of a key, return def if the value is nil.
+		*/
+		template <typename T, typename K>
+		T Get(const K& key, const T& def) const
+		{
+			T val = def;
+			int index = Acquire();
+			PushKey(key);
+			if (lua_rawget(_L, index) != LUA_TNIL)
+			{
+				LuaHelper::CheckImpl(_L, lua_gettop(_L), val, false);
+			}
+			lua_pop(_L, 1);
+			Release();
+			return val;
+		}
+
+		/**
+		* Get a nested table, which is pushed onto the stack and referred to by the returned LuaTableRef.
+		* Pop it when done, or Pin() the returned LuaTableRef first to keep it longer.
+		*/
+		template <typename K>
+		LuaTableRef GetTable(const K& key) const
+		{
+			int index = Acquire();
+			PushKey(key);
+			lua_rawget(_L, index);
+			if (index != _index)
+			{
+				// the nested table takes the slot of the pinned table pushed by Acquire
+				lua_remove(_L, index);
+			}
+			return LuaTableRef(_L, lua_gettop(_L));
+		}
+
+		/**
+		* Iterate as lua_next does, the key and the value of the current entry stay on the stack.
+		* Don't modify the table or leave values on the stack during the iteration.
+		*/
+		Iterator begin(void) const;
+		IteratorEnd end(void) const { return IteratorEnd(); }
+
+		class Iterator
+		{
+		public:
+			Iterator(Iterator&& rhs) noexcept;
+			~Iterator(void);
+
+			int KeyType(void) const { return lua_type(_L, KeyIndex()); }
+			int ValueType(void) const { return lua_type(_L, ValueIndex()); }
+			int KeyIndex(void) const { return _base + 1; }
+			int ValueIndex(void) const { return _base + 2; }
+
+			template <typename T>
+			T Key(void) const
+			{
+				T val = T();
+				// strings are decoded from a copy, lua_next breaks if the key itself is converted
+				lua_pushvalue(_L, KeyIndex());
+				LuaHelper::CheckImpl(_L, lua_gettop(_L), val, false);
+				lua_pop(_L, 1);
+				return val;
+			}
+
+			template <typename T>
+			T Value(void) const
+			{
+				T val = T();
+				LuaHelper::CheckImpl(_L, ValueIndex(), val, false);
+				return val;
+			}
+
+			const Iterator& operator*(void) const { return *this; }
+			Iterator& operator++(void);
+			bool operator!=(const IteratorEnd&) const { return _L != nullptr; }
+			bool operator==(const IteratorEnd&) const { return _L == nullptr; }
+
+		private:
+			friend class LuaTableRef;
+			Iterator(const LuaTableRef& table);
+			Iterator(const Iterator&);
+			Iterator& operator=(const Iterator&);
+
+			void Next(void);
+
+			lua_State*	_L;
+			int			_table;
+			int			_base;		// stack top before the key and the value
+			int			_top;		// stack top before the iteration, restored at the end
+		};
+
+	private:
+		LuaTableRef(const LuaTableRef&);
+		LuaTableRef& operator=(const LuaTableRef&);
+
+		int Acquire(void) const;
+		void Release(void) const;
+
+		void PushKey(long long key) const { lua_pushinteger(_L, key); }
+		void PushKey(int key) const { lua_pushinteger(_L, key); }
+		void PushKey(const char* key) const { lua_pushstring(_L, key); }
+		void PushKey(const std::string& key) const { lua_pushlstring(_L, key.c_str(), key.size()); }
+		void PushKey(std::string_view key) const { lua_pushlstring(_L, key.data(), key.size()); }
+
+		lua_State*	_L;
+		int			_index;
+		int			_ref;
+	};
+
+}
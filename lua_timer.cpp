@@ -0,0 +1,307 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#include <algorithm>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include "lua_timer.h"
+
+namespace LuaCppHelper
+{
+
+	namespace
+	{
+		unsigned int LowestBit(unsigned long long bits)
+		{
+#if defined(_MSC_VER)
+			unsigned long index;
+			_BitScanForward64(&index, bits);
+			return (unsigned int)index;
+#else
+			return (unsigned int)__builtin_ctzll(bits);
+#endif
+		}
+
+	}
+
+	LuaTimerWheel::LuaTimerWheel(lua_State * L)
+		: _free(Nil)
+		, _now(0)
+		, _count(0)
+		, _advancing(false)
+	{
+		// keep the main thread, a coroutine creating the wheel may be gone before it
+		lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);		/* L: main */
+		_L = lua_tothread(L, -1);
+		lua_pop(L, 1);												/* L: */
+		std::fill(_slots, _slots + LevelCount * SlotCount, Nil);
+		std::fill(_occupied, _occupied + LevelCount, 0ull);
+	}
+
+	LuaTimerWheel::~LuaTimerWheel(void)
+	{
+		for (size_t i = 0; i < _timers.size(); ++i)
+		{
+			Timer& timer = _timers[i];
+			if (timer.state != TimerStateFree)
+			{
+				LuaHelper::RemoveFunction(_L, timer.func);
+			}
+		}
+	}
+
+	LuaTimerId LuaTimerWheel::Add(unsigned long long delay, LuaFunction func, std::vector<LuaValue>&& args, unsigned long long interval)
+	{
+		unsigned int index = _free;
+		if (index == Nil)
+		{
+			index = (unsigned int)_timers.size();
+			_timers.push_back(Timer());
+			_timers[index].generation = 1;
+		}
+		else
+		{
+			_free = _timers[index].next;
+		}
+		Timer& timer = _timers[index];
+		timer.expires = _now + (delay > 0 ? delay : 1);
+		timer.interval = interval;
+		timer.args = std::move(args);
+		timer.func = func;
+		timer.state = TimerStatePending;
+		Link(index);
+		++_count;
+		return ((LuaTimerId)timer.generation << 32) | (index + 1);
+	}
+
+	bool LuaTimerWheel::Cancel(LuaTimerId id)
+	{
+		unsigned int index = Find(id);
+		if (index == Nil)
+		{
+			return false;
+		}
+		if (_timers[index].state == TimerStatePending)
+		{
+			Unlink(index);
+			Release(index);
+		}
+		else
+		{
+			// the batch releases it when it comes to it
+			_timers[index].state = TimerStateCancelled;
+		}
+		return true;
+	}
+
+	bool LuaTimerWheel::IsPending(LuaTimerId id) const
+	{
+		return Find(id) != Nil;
+	}
+
+	LuaDispatchStats LuaTimerWheel::Advance(unsigned long long ticks, lua_State * L)
+	{
+		LuaDispatchStats stats;
+		if (_advancing)
+		{
+			return stats;
+		}
+		if (_count == 0)
+		{
+			_now += ticks;
+			return stats;
+		}
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		if (L == nullptr)
+		{
+			L = _L;
+		}
+		_advancing = true;
+		int top = lua_gettop(L);
+		LuaHelper::PushErrorHandler(L);											/* L: handler */
+		unsigned long long end = _now + ticks;
+		while (_now < end)
+		{
+			// jump to the next non empty slot of the lowest level, or to its wrap where the upper levels move down
+			unsigned int offset = (unsigned int)_now & (SlotCount - 1);
+			unsigned long long later = offset + 1 < SlotCount ? _occupied[0] & (~0ull << (offset + 1)) : 0;
+			unsigned long long next = later != 0 ? _now - offset + LowestBit(later) : _now - offset + SlotCount;
+			if (next > end)
+			{
+				_now = end;
+				break;
+			}
+			_now = next;
+			if ((_now & (SlotCount - 1)) == 0)
+			{
+				// the lower level wrapped, move the next slot of each upper level down
+				for (unsigned int level = 1; level < LevelCount; ++level)
+				{
+					unsigned int index = (unsigned int)(_now >> (LevelBits * level)) & (SlotCount - 1);
+					Cascade(level * SlotCount + index);
+					if (index != 0)
+					{
+						break;
+					}
+				}
+			}
+			unsigned int slot = (unsigned int)_now & (SlotCount - 1);
+			for (unsigned int index = _slots[slot]; index != Nil; index = _timers[index].next)
+			{
+				_timers[index].state = TimerStateFiring;
+				_batch.push_back(index);
+			}
+			_slots[slot] = Nil;
+			_occupied[0] &= ~(1ull << slot);
+			if (!_batch.empty())
+			{
+				// the slot is a stack, fire in the order of insertion
+				std::reverse(_batch.begin(), _batch.end());
+				Fire(L, top + 1, stats);
+			}
+			if (_count == 0)
+			{
+				_now = end;
+				break;
+			}
+		}
+		lua_settop(L, top);														/* L: */
+		_advancing = false;
+		stats.elapsed = std::chrono::steady_clock::now() - start;
+		return stats;
+	}
+
+	unsigned int LuaTimerWheel::Find(LuaTimerId id) const
+	{
+		unsigned int index = (unsigned int)(id & 0xffffffff) - 1;
+		if (index >= _timers.size())
+		{
+			return Nil;
+		}
+		const Timer& timer = _timers[index];
+		if (timer.generation != (unsigned int)(id >> 32) || (timer.state != TimerStatePending && timer.state != TimerStateFiring))
+		{
+			return Nil;
+		}
+		return index;
+	}
+
+	void LuaTimerWheel::Link(unsigned int index)
+	{
+		Timer& timer = _timers[index];
+		unsigned long long delta = timer.expires - _now;
+		unsigned long long at = timer.expires;
+		unsigned int level = 0;
+		while (level + 1 < LevelCount && delta >= (1ull << (LevelBits * (level + 1))))
+		{
+			++level;
+		}
+		if (delta >= (1ull << (LevelBits * LevelCount)))
+		{
+			// beyond the wheel, wait in the farthest slot and get placed again from there
+			at = _now + (1ull << (LevelBits * LevelCount)) - 1;
+		}
+		unsigned int slot = level * SlotCount + ((unsigned int)(at >> (LevelBits * level)) & (SlotCount - 1));
+		unsigned int& head = _slots[slot];
+		_occupied[level] |= 1ull << (slot & (SlotCount - 1));
+		timer.slot = slot;
+		timer.prev = Nil;
+		timer.next = head;
+		if (head != Nil)
+		{
+			_timers[head].prev = index;
+		}
+		head = index;
+	}
+
+	void LuaTimerWheel::Unlink(unsigned int index)
+	{
+		Timer& timer = _timers[index];
+		if (timer.prev != Nil)
+		{
+			_timers[timer.prev].next = timer.next;
+		}
+		else
+		{
+			_slots[timer.slot] = timer.next;
+			if (timer.next == Nil)
+			{
+				_occupied[timer.slot / SlotCount] &= ~(1ull << (timer.slot & (SlotCount - 1)));
+			}
+		}
+		if (timer.next != Nil)
+		{
+			_timers[timer.next].prev = timer.prev;
+		}
+	}
+
+	void LuaTimerWheel::Cascade(unsigned int slot)
+	{
+		unsigned int index = _slots[slot];
+		_slots[slot] = Nil;
+		_occupied[slot / SlotCount] &= ~(1ull << (slot & (SlotCount - 1)));
+		while (index != Nil)
+		{
+			unsigned int next = _timers[index].next;
+			Link(index);
+			index = next;
+		}
+	}
+
+	void LuaTimerWheel::Release(unsigned int index)
+	{
+		Timer& timer = _timers[index];
+		LuaHelper::RemoveFunction(_L, timer.func);
+		std::vector<LuaValue>().swap(timer.args);
+		timer.func = LUA_NOREF;
+		timer.state = TimerStateFree;
+		++timer.generation;
+		timer.next = _free;
+		_free = index;
+		--_count;
+	}
+
+	void LuaTimerWheel::Fire(lua_State * L, int errfunc, LuaDispatchStats & stats)
+	{
+		for (size_t i = 0; i < _batch.size(); ++i)
+		{
+			unsigned int index = _batch[i];
+			if (_timers[index].state == TimerStateCancelled)
+			{
+				Release(index);
+				continue;
+			}
+			++stats.events;
+			{
+				// Add may reallocate _timers during the call, so the reference ends here
+				const Timer& timer = _timers[index];
+				luaL_checkstack(L, (int)timer.args.size() + 1, "too many arguments");
+				lua_rawgeti(L, LUA_REGISTRYINDEX, timer.func);					/* L: handler, func */
+				for (size_t j = 0; j < timer.args.size(); ++j)
+				{
+					LuaHelper::PushLuaValue(L, timer.args[j]);					/* L: handler, func, args... */
+				}
+				++stats.calls;
+				if (lua_pcall(L, (int)timer.args.size(), 0, errfunc) != LUA_OK)	/* L: handler */
+				{
+					LCH_LOG("[LUA ERROR]: %s", lua_tostring(L, -1));			/* L: handler, traceback */
+					lua_pop(L, 1);												/* L: handler */
+					++stats.errors;
+				}
+			}
+			Timer& timer = _timers[index];
+			if (timer.state == TimerStateFiring && timer.interval > 0)
+			{
+				timer.expires = _now + timer.interval;
+				timer.state = TimerStatePending;
+				Link(index);
+			}
+			else
+			{
+				Release(index);
+			}
+		}
+		_batch.clear();
+	}
+
+}
@@ -0,0 +1,105 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#pragma once
+
+#include <vector>
+#include "lua_event.h"
+
+namespace LuaCppHelper
+{
+
+	/**
+	* Identifies a timer of a LuaTimerWheel, ids of finished timers are never reused.
+	*/
+	typedef unsigned long long LuaTimerId;
+
+	/**
+	* LuaTimerWheel schedules lua callbacks on a hierarchical timing wheel counted in ticks:
+	* 5 levels of 64 slots cover 2^30 ticks, later timers wait in the last level and are placed again when they come closer.
+	* Add and Cancel are O(1), a tick only touches the timers which expire or move down one level,
+	* runs of empty ticks are skipped up to the next slot of the lowest level which holds timers.
+	*
+	* The wheel owns the function refs, they are released with LuaHelper::RemoveFunction when the timer finished
+	* or is cancelled. The functions in the bound arguments are released with the arguments, LuaValue owns their refs.
+	* Callbacks may add and cancel timers, a repeating timer cancelled by its own callback isn't rescheduled.
+	*/
+	class LuaTimerWheel
+	{
+	public:
+		explicit LuaTimerWheel(lua_State* L);
+		~LuaTimerWheel(void);
+
+		/**
+		* Call func with args after delay ticks, then every interval ticks if interval isn't 0.
+		*
+		* @param delay the ticks to wait, a delay of 0 is run by the next tick.
+		*/
+		LuaTimerId Add(unsigned long long delay, LuaFunction func, std::vector<LuaValue>&& args = std::vector<LuaValue>(), unsigned long long interval = 0);
+
+		/**
+		* @return whether the timer was pending.
+		*/
+		bool Cancel(LuaTimerId id);
+		bool IsPending(LuaTimerId id) const;
+
+		/**
+		* Move the wheel ticks forward and call the expired callbacks tick by tick.
+		* All callbacks of the call share one error handler setup, an error only stops its own callback.
+		* An Advance from inside a callback does nothing.
+		*
+		* @param L the thread to run the callbacks on, nullptr means the state of the wheel.
+		* @return events is the count of expired timers.
+		*/
+		LuaDispatchStats Advance(unsigned long long ticks, lua_State* L = nullptr);
+
+		unsigned long long Now(void) const { return _now; }
+		size_t Count(void) const { return _count; }
+
+	private:
+		LuaTimerWheel(const LuaTimerWheel&);
+		LuaTimerWheel& operator=(const LuaTimerWheel&);
+
+		static constexpr unsigned int LevelBits = 6;
+		static constexpr unsigned int LevelCount = 5;
+		static constexpr unsigned int SlotCount = 1 << LevelBits;
+		static constexpr unsigned int Nil = 0xffffffff;
+
+		typedef enum {
+			TimerStateFree,
+			TimerStatePending,		// linked into a slot
+			TimerStateFiring,		// in the batch of the current tick
+			TimerStateCancelled		// cancelled while in the batch
+		} TimerState;
+
+		struct Timer
+		{
+			unsigned long long		expires;
+			unsigned long long		interval;
+			std::vector<LuaValue>	args;
+			LuaFunction				func;
+			unsigned int			generation;
+			unsigned int			prev;
+			unsigned int			next;		// the next free timer when free
+			unsigned int			slot;		// level * SlotCount + index when pending
+			TimerState				state;
+		};
+
+		unsigned int Find(LuaTimerId id) const;
+		void Link(unsigned int index);
+		void Unlink(unsigned int index);
+		void Cascade(unsigned int level);
+		void Release(unsigned int index);
+		void Fire(lua_State* L, int errfunc, LuaDispatchStats& stats);
+
+		lua_State*					_L;
+		std::vector<Timer>			_timers;
+		std::vector<unsigned int>	_batch;
+		unsigned int				_slots[LevelCount * SlotCount];
+		unsigned long long			_occupied[LevelCount];	// a bit per non empty slot, lets Advance skip the empty ones
+		unsigned int				_free;
+		unsigned long long			_now;
+		size_t						_count;
+		bool						_advancing;
+	};
+
+}
@@ -0,0 +1,214 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#include "lua_transfer.h"
+
+namespace LuaCppHelper
+{
+
+	namespace
+	{
+		// deeper tables fail instead of exhausting the C stack
+		const int MaxDepth = 200;
+	}
+
+	bool LuaTransfer::Copy(lua_State * from, int index, lua_State * to, const LuaTransferPolicy & policy)
+	{
+		if (from == to)
+		{
+			return false;
+		}
+		index = lua_absindex(from, index);
+		int fromTop = lua_gettop(from);
+		int toTop = lua_gettop(to);
+		LuaTransfer transfer(from, to, policy);
+		if (!transfer.CopyValue(index, 0))
+		{
+			lua_settop(from, fromTop);
+			lua_settop(to, toTop);
+			return false;
+		}
+		if (transfer._tables > 0)
+		{
+			lua_remove(to, transfer._created);									/* to: copy */
+		}
+		lua_settop(from, fromTop);
+		return true;
+	}
+
+	LuaTransfer::LuaTransfer(lua_State * from, lua_State * to, const LuaTransferPolicy & policy)
+		: _from(from)
+		, _to(to)
+		, _policy(policy)
+		, _seen(0)
+		, _created(0)
+		, _tables(0)
+	{
+	}
+
+	bool LuaTransfer::CopyValue(int index, int depth)
+	{
+		luaL_checkstack(_to, 3, "too many nested values");
+		switch (lua_type(_from, index))
+		{
+		case LUA_TNIL:
+			lua_pushnil(_to);
+			return true;
+		case LUA_TBOOLEAN:
+			lua_pushboolean(_to, lua_toboolean(_from, index));
+			return true;
+		case LUA_TNUMBER:
+			if (lua_isinteger(_from, index))
+			{
+				lua_pushinteger(_to, lua_tointeger(_from, index));
+			}
+			else
+			{
+				lua_pushnumber(_to, lua_tonumber(_from, index));
+			}
+			return true;
+		case LUA_TSTRING:
+		{
+			size_t size;
+			const char* data = lua_tolstring(_from, index, &size);
+			lua_pushlstring(_to, data, size);
+			return true;
+		}
+		case LUA_TLIGHTUSERDATA:
+			lua_pushlightuserdata(_to, lua_touserdata(_from, index));
+			return true;
+		case LUA_TTABLE:
+			return depth < MaxDepth && CopyTable(index, depth);
+		case LUA_TFUNCTION:
+		{
+			lua_CFunction cfunction = lua_tocfunction(_from, index);
+			if (cfunction != nullptr)
+			{
+				if (lua_getupvalue(_from, index, 1) == nullptr)
+				{
+					lua_pushcfunction(_to, cfunction);
+					return true;
+				}
+				lua_pop(_from, 1);
+			}
+			return CopyByPolicy(_policy.functionMode, _policy.function, index);
+		}
+		case LUA_TUSERDATA:
+			return CopyByPolicy(_policy.userdataMode, _policy.userdata, index);
+		default:
+			return false;
+		}
+	}
+
+	bool LuaTransfer::CopyTable(int index, int depth)
+	{
+		index = lua_absindex(_from, index);
+		luaL_checkstack(_from, 3, "too many nested tables");
+		if (_tables == 0)
+		{
+			lua_newtable(_from);												/* from: seen */
+			_seen = lua_gettop(_from);
+			lua_newtable(_to);													/* to: created */
+			_created = lua_gettop(_to);
+		}
+		else
+		{
+			lua_pushvalue(_from, index);										/* from: table */
+			if (lua_rawget(_from, _seen) == LUA_TNUMBER)						/* from: id */
+			{
+				// reached before, refer to the same copy
+				lua_rawgeti(_to, _created, lua_tointeger(_from, -1));			/* to: copy */
+				lua_pop(_from, 1);												/* from: */
+				return true;
+			}
+			lua_pop(_from, 1);													/* from: */
+		}
+
+		// count the entries first, the copy is created with its final size
+		int arraySize = (int)lua_rawlen(_from, index);
+		int hashSize = 0;
+		lua_pushnil(_from);														/* from: nil */
+		while (lua_next(_from, index))											/* from: key, value */
+		{
+			lua_pop(_from, 1);													/* from: key */
+			if (!lua_isinteger(_from, -1) || lua_tointeger(_from, -1) < 1 || lua_tointeger(_from, -1) > arraySize)
+			{
+				++hashSize;
+			}
+		}
+		lua_createtable(_to, arraySize, hashSize);								/* to: copy */
+		int copy = lua_gettop(_to);
+		int id = ++_tables;
+		lua_pushvalue(_to, copy);												/* to: copy, copy */
+		lua_rawseti(_to, _created, id);											/* to: copy */
+		lua_pushvalue(_from, index);											/* from: table */
+		lua_pushinteger(_from, id);												/* from: table, id */
+		lua_rawset(_from, _seen);												/* from: */
+
+		for (int i = 1; i <= arraySize; ++i)
+		{
+			lua_rawgeti(_from, index, i);										/* from: value */
+			bool ok = CopyValue(lua_gettop(_from), depth + 1);					/* to: copy, value */
+			lua_pop(_from, 1);													/* from: */
+			if (!ok)
+			{
+				return false;
+			}
+			lua_rawseti(_to, copy, i);											/* to: copy */
+		}
+		if (hashSize == 0)
+		{
+			return true;
+		}
+		lua_pushnil(_from);														/* from: nil */
+		while (lua_next(_from, index))											/* from: key, value */
+		{
+			int key = lua_gettop(_from) - 1;
+			if (lua_isinteger(_from, key) && lua_tointeger(_from, key) >= 1 && lua_tointeger(_from, key) <= arraySize)
+			{
+				lua_pop(_from, 1);												/* from: key */
+				continue;
+			}
+			if (!CopyValue(key, depth + 1))										/* to: copy, key */
+			{
+				return false;
+			}
+			if (lua_isnil(_to, -1))
+			{
+				// the policy turned the key into nil, the entry can't be set
+				lua_pop(_to, 1);												/* to: copy */
+				lua_pop(_from, 1);												/* from: key */
+				continue;
+			}
+			if (!CopyValue(key + 1, depth + 1))									/* to: copy, key, value */
+			{
+				return false;
+			}
+			lua_rawset(_to, copy);												/* to: copy */
+			lua_pop(_from, 1);													/* from: key */
+		}
+		return true;
+	}
+
+	bool LuaTransfer::CopyByPolicy(LuaTransferMode mode, const std::function<bool(lua_State*, int, lua_State*)>& hook, int index)
+	{
+		if (mode == LuaTransferNil)
+		{
+			lua_pushnil(_to);
+			return true;
+		}
+		if (mode != LuaTransferCustom || !hook)
+		{
+			return false;
+		}
+		int top = lua_gettop(_to);
+		if (!hook(_from, index, _to))
+		{
+			lua_settop(_to, top);
+			return false;
+		}
+		// exactly one value is expected
+		lua_settop(_to, top + 1);
+		return true;
+	}
+
+}
@@ -0,0 +1,65 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#pragma once
+
+#include <functional>
+#include "lua_helper.h"
+
+namespace LuaCppHelper
+{
+
+	/// @cond
+	typedef enum {
+		LuaTransferFail,		// the copy fails
+		LuaTransferNil,			// the value is copied as nil, table entries with such a key are skipped
+		LuaTransferCustom		// the hook of the policy pushes the copy
+	} LuaTransferMode;
+	/// @endcond
+
+	/**
+	* What to do with the values bound to their lua_State: lua functions, full userdata and threads.
+	* C functions without upvalues and lightuserdata don't depend on the state, they are always copied.
+	* A hook is called with the source value at index and must push exactly one value onto to.
+	*/
+	struct LuaTransferPolicy
+	{
+		LuaTransferPolicy(void) : functionMode(LuaTransferFail), userdataMode(LuaTransferFail) {}
+
+		LuaTransferMode		functionMode;
+		LuaTransferMode		userdataMode;
+		std::function<bool(lua_State* from, int index, lua_State* to)>	function;
+		std::function<bool(lua_State* from, int index, lua_State* to)>	userdata;
+	};
+
+	/**
+	* LuaTransfer copies values from one lua_State to another in a single walk, no LuaValue tree is built.
+	* Tables are created with their final sizes, a table reached twice is copied once so that shared
+	* sub-tables and cycles are preserved. Metatables are not copied.
+	*/
+	class LuaTransfer
+	{
+	public:
+		/**
+		* Copy the value at index of from onto the top of to.
+		* from and to may be threads of the same state but not the same thread.
+		*
+		* @return false if the policy refused a value, nothing is pushed then.
+		*/
+		static bool Copy(lua_State* from, int index, lua_State* to, const LuaTransferPolicy& policy = LuaTransferPolicy());
+
+	private:
+		LuaTransfer(lua_State* from, lua_State* to, const LuaTransferPolicy& policy);
+
+		bool CopyValue(int index, int depth);
+		bool CopyTable(int index, int depth);
+		bool CopyByPolicy(LuaTransferMode mode, const std::function<bool(lua_State*, int, lua_State*)>& hook, int index);
+
+		lua_State*					_from;
+		lua_State*					_to;
+		const LuaTransferPolicy&	_policy;
+		int							_seen;		// on from: source table -> id
+		int							_created;	// on to: id -> copied table
+		int							_tables;
+	};
+
+}
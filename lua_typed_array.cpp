@@ -0,0 +1,636 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#include <climits>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include "lua_typed_array.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LCH_ARRAY_SSE2 1
+#endif
+
+namespace LuaCppHelper
+{
+
+	namespace
+	{
+		// the type the element arithmetic runs in: integers wrap around in their unsigned type
+		template <typename T>
+		struct Arithmetic
+		{
+			typedef typename std::conditional<std::is_integral<T>::value, std::make_unsigned<T>, std::common_type<T> >::type::type Type;
+		};
+
+		// the type sums and dot products run in
+		template <typename T>
+		struct Wide
+		{
+			typedef typename std::conditional<std::is_integral<T>::value, unsigned long long, double>::type Type;
+		};
+
+		template <typename T>
+		inline T AddValues(T a, T b)
+		{
+			typedef typename Arithmetic<T>::Type A;
+			return (T)((A)a + (A)b);
+		}
+
+		template <typename T>
+		inline T MulValues(T a, T b)
+		{
+			typedef typename Arithmetic<T>::Type A;
+			return (T)((A)a * (A)b);
+		}
+
+		template <typename T>
+		inline void PushValue(lua_State* L, T value)
+		{
+			if constexpr (std::is_floating_point<T>::value)
+			{
+				lua_pushnumber(L, (lua_Number)value);
+			}
+			else
+			{
+				lua_pushinteger(L, (lua_Integer)value);
+			}
+		}
+
+		template <typename T>
+		inline T CheckValue(lua_State* L, int index)
+		{
+			if constexpr (std::is_floating_point<T>::value)
+			{
+				return (T)luaL_checknumber(L, index);
+			}
+			else
+			{
+				return (T)luaL_checkinteger(L, index);
+			}
+		}
+
+		template <bool MAX, typename T>
+		inline T Pick(T value, T current)
+		{
+			return MAX ? (value > current ? value : current) : (value < current ? value : current);
+		}
+
+#ifdef LCH_ARRAY_SSE2
+		// compilers leave the scalar min and max loops of float and double alone: without fast math they don't turn
+		// x < m ? x : m into a min instruction. _mm_min_ps(x, m) computes exactly that per lane, NaN elements are skipped alike
+		inline __m128 PackedLoad(const float* p) { return _mm_loadu_ps(p); }
+		inline __m128d PackedLoad(const double* p) { return _mm_loadu_pd(p); }
+		inline __m128 PackedSplat(float value) { return _mm_set1_ps(value); }
+		inline __m128d PackedSplat(double value) { return _mm_set1_pd(value); }
+		inline void PackedStore(float* p, __m128 v) { _mm_storeu_ps(p, v); }
+		inline void PackedStore(double* p, __m128d v) { _mm_storeu_pd(p, v); }
+		template <bool MAX>
+		inline __m128 PackedPick(__m128 values, __m128 current) { return MAX ? _mm_max_ps(values, current) : _mm_min_ps(values, current); }
+		template <bool MAX>
+		inline __m128d PackedPick(__m128d values, __m128d current) { return MAX ? _mm_max_pd(values, current) : _mm_min_pd(values, current); }
+
+		// two vectors of independent lanes, then the lanes and the tail like the scalar loop
+		template <bool MAX, typename T>
+		T PackedExtreme(const T* data, size_t length)
+		{
+			const size_t width = 16 / sizeof(T);
+			auto m0 = PackedSplat(data[0]);
+			auto m1 = m0;
+			size_t i = 0;
+			for (; i + 2 * width <= length; i += 2 * width)
+			{
+				m0 = PackedPick<MAX>(PackedLoad(data + i), m0);
+				m1 = PackedPick<MAX>(PackedLoad(data + i + width), m1);
+			}
+			T lanes[2 * width];
+			PackedStore(lanes, m0);
+			PackedStore(lanes + width, m1);
+			T m = lanes[0];
+			for (size_t j = 1; j < 2 * width; ++j)
+			{
+				m = Pick<MAX>(lanes[j], m);
+			}
+			for (; i < length; ++i)
+			{
+				m = Pick<MAX>(data[i], m);
+			}
+			return m;
+		}
+#endif
+
+		// the element at index, false if it isn't a number that fits T
+		template <typename T>
+		inline bool ToValue(lua_State* L, int index, T& value)
+		{
+			int isnum = 0;
+			if constexpr (std::is_floating_point<T>::value)
+			{
+				value = (T)lua_tonumberx(L, index, &isnum);
+			}
+			else
+			{
+				value = (T)lua_tointegerx(L, index, &isnum);
+			}
+			return isnum != 0 && lua_type(L, index) == LUA_TNUMBER;
+		}
+
+		/**
+		* The lua methods of LuaTypedArray<T>.
+		*/
+		template <typename T>
+		struct ArrayMethods
+		{
+			typedef LuaTypedArray<T> Array;
+
+			// numeric keys reach the elements, other keys the methods in the metatable, the upvalue
+			static int Index(lua_State* L)
+			{
+				Array* array = Array::Check(L, 1);
+				if (lua_type(L, 2) == LUA_TNUMBER)
+				{
+					int isnum = 0;
+					lua_Integer i = lua_tointegerx(L, 2, &isnum);
+					if (isnum && i >= 1 && (lua_Unsigned)i <= array->Length())
+					{
+						PushValue(L, (*array)[(size_t)i - 1]);
+					}
+					else
+					{
+						lua_pushnil(L);
+					}
+					return 1;
+				}
+				lua_settop(L, 2);
+				lua_rawget(L, lua_upvalueindex(1));
+				return 1;
+			}
+
+			static int NewIndex(lua_State* L)
+			{
+				Array* array = Array::Check(L, 1);
+				int isnum = 0;
+				lua_Integer i = lua_tointegerx(L, 2, &isnum);
+				luaL_argcheck(L, isnum && lua_type(L, 2) == LUA_TNUMBER && i >= 1 && (lua_Unsigned)i <= array->Length(), 2, "index out of range");
+				(*array)[(size_t)i - 1] = CheckValue<T>(L, 3);
+				return 0;
+			}
+
+			static int Len(lua_State* L)
+			{
+				lua_pushinteger(L, (lua_Integer)Array::Check(L, 1)->Length());
+				return 1;
+			}
+
+			// a:slice(first [, last]), positions like string.sub
+			static int Slice(lua_State* L)
+			{
+				Array* array = Array::Check(L, 1);
+				lua_Integer length = (lua_Integer)array->Length();
+				lua_Integer first = luaL_checkinteger(L, 2);
+				lua_Integer last = luaL_optinteger(L, 3, -1);
+				if (first < 0)
+				{
+					first = length + first + 1 > 1 ? length + first + 1 : 1;
+				}
+				else if (first == 0)
+				{
+					first = 1;
+				}
+				if (last < 0)
+				{
+					last = length + last + 1;
+				}
+				else if (last > length)
+				{
+					last = length;
+				}
+				if (first > last)
+				{
+					Array::Slice(L, 1, (size_t)(first - 1 < length ? first - 1 : length), 0);
+				}
+				else
+				{
+					Array::Slice(L, 1, (size_t)(first - 1), (size_t)(last - first + 1));
+				}
+				return 1;
+			}
+
+			static int Fill(lua_State* L)
+			{
+				Array::Check(L, 1)->Fill(CheckValue<T>(L, 2));
+				lua_settop(L, 1);
+				return 1;
+			}
+
+			static int Add(lua_State* L)
+			{
+				Array* array = Array::Check(L, 1);
+				if (lua_type(L, 2) == LUA_TNUMBER)
+				{
+					array->Add(CheckValue<T>(L, 2));
+				}
+				else
+				{
+					array->Add(*CheckSameLength(L, array, 2));
+				}
+				lua_settop(L, 1);
+				return 1;
+			}
+
+			static int Mul(lua_State* L)
+			{
+				Array* array = Array::Check(L, 1);
+				if (lua_type(L, 2) == LUA_TNUMBER)
+				{
+					array->Mul(CheckValue<T>(L, 2));
+				}
+				else
+				{
+					array->Mul(*CheckSameLength(L, array, 2));
+				}
+				lua_settop(L, 1);
+				return 1;
+			}
+
+			// a:copy(src [, first])
+			static int Copy(lua_State* L)
+			{
+				Array* array = Array::Check(L, 1);
+				Array* src = Array::Check(L, 2);
+				lua_Integer first = luaL_optinteger(L, 3, 1);
+				luaL_argcheck(L, first >= 1 && (lua_Unsigned)(first - 1) <= array->Length() && src->Length() <= array->Length() - (size_t)(first - 1),
+					3, "source does not fit");
+				array->Copy(*src, (size_t)(first - 1));
+				lua_settop(L, 1);
+				return 1;
+			}
+
+			static int Sum(lua_State* L)
+			{
+				PushValue(L, Array::Check(L, 1)->Sum());
+				return 1;
+			}
+
+			static int Dot(lua_State* L)
+			{
+				Array* array = Array::Check(L, 1);
+				PushValue(L, array->Dot(*CheckSameLength(L, array, 2)));
+				return 1;
+			}
+
+			static int Min(lua_State* L)
+			{
+				Array* array = Array::Check(L, 1);
+				if (array->Length() == 0)
+				{
+					lua_pushnil(L);
+				}
+				else
+				{
+					PushValue(L, array->Min());
+				}
+				return 1;
+			}
+
+			static int Max(lua_State* L)
+			{
+				Array* array = Array::Check(L, 1);
+				if (array->Length() == 0)
+				{
+					lua_pushnil(L);
+				}
+				else
+				{
+					PushValue(L, array->Max());
+				}
+				return 1;
+			}
+
+			static int ToTable(lua_State* L)
+			{
+				Array* array = Array::Check(L, 1);
+				size_t length = array->Length();
+				lua_createtable(L, length < INT_MAX ? (int)length : INT_MAX, 0);
+				for (size_t i = 0; i < length; ++i)
+				{
+					PushValue(L, (*array)[i]);
+					lua_rawseti(L, -2, (lua_Integer)i + 1);
+				}
+				return 1;
+			}
+
+			static int Type(lua_State* L)
+			{
+				Array::Check(L, 1);
+				lua_pushstring(L, LuaTypedArrayTraits<T>::Name());
+				return 1;
+			}
+
+			static Array* CheckSameLength(lua_State* L, Array* array, int index)
+			{
+				Array* other = Array::Check(L, index);
+				luaL_argcheck(L, other->Length() == array->Length(), index, "length mismatch");
+				return other;
+			}
+		};
+
+		// the elements start at the first aligned offset after the header
+		template <typename T>
+		constexpr size_t HeaderSize(void)
+		{
+			return (sizeof(LuaTypedArray<T>) + sizeof(LuaUserdataAlignment) - 1) / sizeof(LuaUserdataAlignment) * sizeof(LuaUserdataAlignment);
+		}
+	}
+
+	template <typename T>
+	void LuaTypedArray<T>::Register(lua_State* L)
+	{
+		typedef ArrayMethods<T> Methods;
+		static const luaL_Reg methods[] =
+		{
+			{ "__newindex", Methods::NewIndex },
+			{ "__len", Methods::Len },
+			{ "slice", Methods::Slice },
+			{ "fill", Methods::Fill },
+			{ "add", Methods::Add },
+			{ "mul", Methods::Mul },
+			{ "copy", Methods::Copy },
+			{ "sum", Methods::Sum },
+			{ "dot", Methods::Dot },
+			{ "min", Methods::Min },
+			{ "max", Methods::Max },
+			{ "totable", Methods::ToTable },
+			{ "type", Methods::Type },
+			{ NULL, NULL }
+		};
+		std::string name = std::string("LuaTypedArray.") + LuaTypedArrayTraits<T>::Name();
+		LuaClass<LuaTypedArray>::Register(L, name.c_str(), methods);
+		LuaTypeRegistry<LuaTypedArray>::PushMetatable(L);		/* L: mt */
+		lua_pushvalue(L, -1);									/* L: mt, mt */
+		lua_pushcclosure(L, Methods::Index, 1);					/* L: mt, index */
+		lua_setfield(L, -2, "__index");							/* L: mt */
+		lua_pop(L, 1);											/* L: */
+	}
+
+	template <typename T>
+	void* LuaTypedArray<T>::NewBlock(lua_State* L, size_t size)
+	{
+		void* block = lua_newuserdata(L, size);					/* L: ud */
+		if (!LuaTypeRegistry<LuaTypedArray>::PushMetatable(L))	/* L: ud, mt */
+		{
+			return (luaL_error(L, "LuaTypedArray<%s> is not registered", LuaTypedArrayTraits<T>::Name()), nullptr);
+		}
+		lua_setmetatable(L, -2);								/* L: ud */
+		return block;
+	}
+
+	template <typename T>
+	LuaTypedArray<T>* LuaTypedArray<T>::New(lua_State* L, size_t length)
+	{
+		const size_t header = HeaderSize<T>();
+		if (length > (std::numeric_limits<size_t>::max() - header) / sizeof(T))
+		{
+			return (luaL_error(L, "array too large"), nullptr);
+		}
+		char* block = (char*)NewBlock(L, header + length * sizeof(T));
+		T* data = (T*)(block + header);
+		memset(data, 0, length * sizeof(T));
+		return new (block) LuaTypedArray(data, length);
+	}
+
+	template <typename T>
+	LuaTypedArray<T>* LuaTypedArray<T>::Slice(lua_State* L, int index, size_t offset, size_t length)
+	{
+		index = lua_absindex(L, index);
+		LuaTypedArray* array = Check(L, index);
+		LuaTypedArray* view = new (NewBlock(L, sizeof(LuaTypedArray))) LuaTypedArray(array->_data + offset, length);	/* L: view */
+		// the storage lives in the block of the array which owns it, a view of a view refers to that array too
+		if (lua_getuservalue(L, index) == LUA_TNIL)				/* L: view, owner */
+		{
+			lua_pop(L, 1);										/* L: view */
+			lua_pushvalue(L, index);							/* L: view, owner */
+		}
+		lua_setuservalue(L, -2);								/* L: view */
+		return view;
+	}
+
+	template <typename T>
+	int LuaTypedArray<T>::LuaNew(lua_State* L)
+	{
+		if (lua_istable(L, 1))
+		{
+			size_t length = lua_rawlen(L, 1);
+			LuaTypedArray* array = New(L, length);
+			for (size_t i = 0; i < length; ++i)
+			{
+				lua_rawgeti(L, 1, (lua_Integer)i + 1);
+				if (!ToValue(L, -1, array->_data[i]))
+				{
+					return luaL_error(L, "bad element #%d, number expected, got %s", (int)i + 1, luaL_typename(L, -1));
+				}
+				lua_pop(L, 1);
+			}
+			return 1;
+		}
+		lua_Integer length = luaL_checkinteger(L, 1);
+		luaL_argcheck(L, length >= 0, 1, "invalid length");
+		New(L, (size_t)length);
+		return 1;
+	}
+
+	template <typename T>
+	void LuaTypedArray<T>::Fill(T value)
+	{
+		T* data = _data;
+		size_t length = _length;
+		for (size_t i = 0; i < length; ++i)
+		{
+			data[i] = value;
+		}
+	}
+
+	template <typename T>
+	void LuaTypedArray<T>::Add(T value)
+	{
+		T* data = _data;
+		size_t length = _length;
+		for (size_t i = 0; i < length; ++i)
+		{
+			data[i] = AddValues(data[i], value);
+		}
+	}
+
+	template <typename T>
+	void LuaTypedArray<T>::Add(const LuaTypedArray& other)
+	{
+		T* data = _data;
+		const T* src = other._data;
+		size_t length = _length;
+		for (size_t i = 0; i < length; ++i)
+		{
+			data[i] = AddValues(data[i], src[i]);
+		}
+	}
+
+	template <typename T>
+	void LuaTypedArray<T>::Mul(T value)
+	{
+		T* data = _data;
+		size_t length = _length;
+		for (size_t i = 0; i < length; ++i)
+		{
+			data[i] = MulValues(data[i], value);
+		}
+	}
+
+	template <typename T>
+	void LuaTypedArray<T>::Mul(const LuaTypedArray& other)
+	{
+		T* data = _data;
+		const T* src = other._data;
+		size_t length = _length;
+		for (size_t i = 0; i < length; ++i)
+		{
+			data[i] = MulValues(data[i], src[i]);
+		}
+	}
+
+	template <typename T>
+	void LuaTypedArray<T>::Copy(const LuaTypedArray& src, size_t offset)
+	{
+		memmove(_data + offset, src._data, src._length * sizeof(T));
+	}
+
+	// four independent accumulators, so the loop vectorizes without reassociating a single sum
+	template <typename T>
+	typename LuaTypedArray<T>::Accumulator LuaTypedArray<T>::Sum(void) const
+	{
+		typedef typename Wide<T>::Type W;
+		const T* data = _data;
+		size_t length = _length;
+		W s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+		size_t i = 0;
+		for (; i + 4 <= length; i += 4)
+		{
+			s0 += (W)data[i];
+			s1 += (W)data[i + 1];
+			s2 += (W)data[i + 2];
+			s3 += (W)data[i + 3];
+		}
+		for (; i < length; ++i)
+		{
+			s0 += (W)data[i];
+		}
+		return (Accumulator)((s0 + s1) + (s2 + s3));
+	}
+
+	template <typename T>
+	typename LuaTypedArray<T>::Accumulator LuaTypedArray<T>::Dot(const LuaTypedArray& other) const
+	{
+		typedef typename Wide<T>::Type W;
+		const T* a = _data;
+		const T* b = other._data;
+		size_t length = _length;
+		W s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+		size_t i = 0;
+		for (; i + 4 <= length; i += 4)
+		{
+			s0 += (W)a[i] * (W)b[i];
+			s1 += (W)a[i + 1] * (W)b[i + 1];
+			s2 += (W)a[i + 2] * (W)b[i + 2];
+			s3 += (W)a[i + 3] * (W)b[i + 3];
+		}
+		for (; i < length; ++i)
+		{
+			s0 += (W)a[i] * (W)b[i];
+		}
+		return (Accumulator)((s0 + s1) + (s2 + s3));
+	}
+
+	template <typename T>
+	T LuaTypedArray<T>::Min(void) const
+	{
+#ifdef LCH_ARRAY_SSE2
+		if constexpr (std::is_floating_point<T>::value)
+		{
+			return PackedExtreme<false>(_data, _length);
+		}
+		else
+#endif
+		{
+			const T* data = _data;
+			size_t length = _length;
+			T m0 = data[0], m1 = m0, m2 = m0, m3 = m0;
+			size_t i = 0;
+			for (; i + 4 <= length; i += 4)
+			{
+				m0 = Pick<false>(data[i], m0);
+				m1 = Pick<false>(data[i + 1], m1);
+				m2 = Pick<false>(data[i + 2], m2);
+				m3 = Pick<false>(data[i + 3], m3);
+			}
+			for (; i < length; ++i)
+			{
+				m0 = Pick<false>(data[i], m0);
+			}
+			return Pick<false>(Pick<false>(m2, Pick<false>(m3, m2)), Pick<false>(m1, m0));
+		}
+	}
+
+	template <typename T>
+	T LuaTypedArray<T>::Max(void) const
+	{
+#ifdef LCH_ARRAY_SSE2
+		if constexpr (std::is_floating_point<T>::value)
+		{
+			return PackedExtreme<true>(_data, _length);
+		}
+		else
+#endif
+		{
+			const T* data = _data;
+			size_t length = _length;
+			T m0 = data[0], m1 = m0, m2 = m0, m3 = m0;
+			size_t i = 0;
+			for (; i + 4 <= length; i += 4)
+			{
+				m0 = Pick<true>(data[i], m0);
+				m1 = Pick<true>(data[i + 1], m1);
+				m2 = Pick<true>(data[i + 2], m2);
+				m3 = Pick<true>(data[i + 3], m3);
+			}
+			for (; i < length; ++i)
+			{
+				m0 = Pick<true>(data[i], m0);
+			}
+			return Pick<true>(Pick<true>(m2, Pick<true>(m3, m2)), Pick<true>(m1, m0));
+		}
+	}
+
+	template class LuaTypedArray<float>;
+	template class LuaTypedArray<double>;
+	template class LuaTypedArray<int32_t>;
+	template class LuaTypedArray<int64_t>;
+	template class LuaTypedArray<uint8_t>;
+
+	void LuaTypedArrayOpen(lua_State* L)
+	{
+		LuaFloat32Array::Register(L);
+		LuaFloat64Array::Register(L);
+		LuaInt32Array::Register(L);
+		LuaInt64Array::Register(L);
+		LuaUint8Array::Register(L);
+		static const luaL_Reg constructors[] =
+		{
+			{ "float32", LuaFloat32Array::LuaNew },
+			{ "float64", LuaFloat64Array::LuaNew },
+			{ "int32", LuaInt32Array::LuaNew },
+			{ "int64", LuaInt64Array::LuaNew },
+			{ "uint8", LuaUint8Array::LuaNew },
+			{ NULL, NULL }
+		};
+		luaL_newlib(L, constructors);
+	}
+
+}
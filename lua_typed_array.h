@@ -0,0 +1,169 @@
+﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
+
+#pragma once
+
+#include <cstdint>
+#include "lua_object.h"
+
+namespace LuaCppHelper
+{
+
+	/// @cond
+	template <typename T>
+	struct LuaTypedArrayTraits;
+
+	template <>
+	struct LuaTypedArrayTraits<float>
+	{
+		typedef double Accumulator;
+		static const char* Name(void) { return "float32"; }
+	};
+
+	template <>
+	struct LuaTypedArrayTraits<double>
+	{
+		typedef double Accumulator;
+		static const char* Name(void) { return "float64"; }
+	};
+
+	template <>
+	struct LuaTypedArrayTraits<int32_t>
+	{
+		typedef long long Accumulator;
+		static const char* Name(void) { return "int32"; }
+	};
+
+	template <>
+	struct LuaTypedArrayTraits<int64_t>
+	{
+		typedef long long Accumulator;
+		static const char* Name(void) { return "int64"; }
+	};
+
+	template <>
+	struct LuaTypedArrayTraits<uint8_t>
+	{
+		typedef long long Accumulator;
+		static const char* Name(void) { return "uint8"; }
+	};
+	/// @endcond
+
+	/**
+	* LuaTypedArray is a userdata holding a contiguous array of T, T is float, double, int32_t, int64_t or uint8_t.
+	* C++ reads and writes the elements in place through Data(), lua indexes them from 1 like a table:
+	*
+	*   local positions = lch_array.float32(1024)
+	*   positions[1] = 0.5
+	*   positions:slice(1, 512):mul(2.0)
+	*   print(#positions, positions:sum(), positions:max())
+	*
+	* The elements follow the header in the same userdata block. A slice is a view sharing the storage of the array,
+	* it keeps the array alive through its user value.
+	* Integer arithmetic wraps around like lua integers, sums of float32 arrays are computed in double.
+	*
+	* Lua methods:
+	*   a[i], a[i] = v, #a
+	*   a:slice(first [, last]), negative positions count from the end like string.sub
+	*   a:fill(v), a:add(b), a:mul(b), b is an array of the same type and length or a number, they return a
+	*   a:copy(src [, first]), copy src into a starting at first, return a
+	*   a:sum(), a:min(), a:max(), a:dot(b), min and max return nil for an empty array
+	*   a:totable(), a:type()
+	*/
+	template <typename T>
+	class LuaTypedArray
+	{
+	public:
+		typedef T ValueType;
+		typedef typename LuaTypedArrayTraits<T>::Accumulator Accumulator;
+
+		/**
+		* Create the metatable of the array type, once per lua_State before the type is used.
+		*/
+		static void Register(lua_State* L);
+
+		/**
+		* Push a new array of length zeroed elements.
+		*/
+		static LuaTypedArray* New(lua_State* L, size_t length);
+
+		/**
+		* Push a view of length elements of the array at index starting at offset, which must fit in the array.
+		*/
+		static LuaTypedArray* Slice(lua_State* L, int index, size_t offset, size_t length);
+
+		/**
+		* Get the array at index, raise a lua error if it isn't a LuaTypedArray<T>.
+		*/
+		static LuaTypedArray* Check(lua_State* L, int index) { return LuaClass<LuaTypedArray>::Check(L, index); }
+
+		/**
+		* Get the array at index, nullptr if it isn't a LuaTypedArray<T>.
+		*/
+		static LuaTypedArray* Test(lua_State* L, int index) { return LuaClass<LuaTypedArray>::Test(L, index); }
+
+		/**
+		* The lua constructor, lch_array.float32(length) or lch_array.float32({ 1, 2, 3 }).
+		*/
+		static int LuaNew(lua_State* L);
+
+		T* Data(void) { return _data; }
+		const T* Data(void) const { return _data; }
+		size_t Length(void) const { return _length; }
+
+		T& operator[](size_t index) { return _data[index]; }
+		const T& operator[](size_t index) const { return _data[index]; }
+
+		T* begin(void) { return _data; }
+		T* end(void) { return _data + _length; }
+		const T* begin(void) const { return _data; }
+		const T* end(void) const { return _data + _length; }
+
+		/**
+		* The bulk kernels, written so the compiler vectorizes them. Two arrays must have the same length,
+		* they may overlap, Copy needs offset + src.Length() <= Length().
+		*/
+		void Fill(T value);
+		void Add(T value);
+		void Add(const LuaTypedArray& other);
+		void Mul(T value);
+		void Mul(const LuaTypedArray& other);
+		void Copy(const LuaTypedArray& src, size_t offset = 0);
+
+		Accumulator Sum(void) const;
+		Accumulator Dot(const LuaTypedArray& other) const;
+
+		/**
+		* The least and the greatest element, the array must not be empty.
+		*/
+		T Min(void) const;
+		T Max(void) const;
+
+	private:
+		LuaTypedArray(T* data, size_t length) : _data(data), _length(length) {}
+
+		static void* NewBlock(lua_State* L, size_t size);
+
+		T*						_data;
+		size_t					_length;
+	};
+
+	/// @cond
+	extern template class LuaTypedArray<float>;
+	extern template class LuaTypedArray<double>;
+	extern template class LuaTypedArray<int32_t>;
+	extern template class LuaTypedArray<int64_t>;
+	extern template class LuaTypedArray<uint8_t>;
+	/// @endcond
+
+	typedef LuaTypedArray<float> LuaFloat32Array;
+	typedef LuaTypedArray<double> LuaFloat64Array;
+	typedef LuaTypedArray<int32_t> LuaInt32Array;
+	typedef LuaTypedArray<int64_t> LuaInt64Array;
+	typedef LuaTypedArray<uint8_t> LuaUint8Array;
+
+	/**
+	* Register the five array types and push a table of their lua constructors: float32, float64, int32, int64, uint8.
+	*/
+	void LuaTypedArrayOpen(lua_State* L);
+
+}
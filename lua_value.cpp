@@ -1,18 +1,20 @@
 ﻿//Copyright (c) 2017-2018 Beijing StormBringer Entertainment, Inc. All Rights Reserved.
 
-#include "lua_value.h"
+#include "lua_table.h"
+#include "lua_arena.h"
+#include "lua_function_ref.h"
 
 namespace LuaCppHelper
 {
 
-	const LuaValue LuaValue::NilValue()
+	LuaValue LuaValue::NilValue()
 	{
 		LuaValue value;
 		value._type = LuaValueTypeNil;
 		return value;
 	}
 
-	const LuaValue LuaValue::IntValue(const long long intValue)
+	LuaValue LuaValue::IntValue(const long long intValue)
 	{
 		LuaValue value;
 		value._type = LuaValueTypeInt;
@@ -20,7 +22,7 @@ namespace LuaCppHelper
 		return value;
 	}
 
-	const LuaValue LuaValue::NumberValue(const double numberValue)
+	LuaValue LuaValue::NumberValue(const double numberValue)
 	{
 		LuaValue value;
 		value._type = LuaValueTypeFloat;
@@ -28,7 +30,7 @@ namespace LuaCppHelper
 		return value;
 	}
 
-	const LuaValue LuaValue::BooleanValue(const bool booleanValue)
+	LuaValue LuaValue::BooleanValue(const bool booleanValue)
 	{
 		LuaValue value;
 		value._type = LuaValueTypeBoolean;
@@ -36,23 +38,44 @@ namespace LuaCppHelper
 		return value;
 	}
 
-	const LuaValue LuaValue::StringValue(const char* stringValue)
+	LuaValue LuaValue::StringValue(const char* stringValue)
+	{
+		return LuaValue::StringValue(stringValue ? stringValue : "", stringValue ? strlen(stringValue) : 0);
+	}
+
+	LuaValue LuaValue::StringValue(const std::string& stringValue)
+	{
+		return LuaValue::StringValue(stringValue.c_str(), stringValue.size());
+	}
+
+	LuaValue LuaValue::StringValue(const char* stringValue, size_t stringSize)
 	{
 		LuaValue value;
 		value._type = LuaValueTypeString;
-		value._field.stringValue = new std::string(stringValue ? stringValue : "");
+		value.SetString(stringValue, stringSize);
 		return value;
 	}
 
-	const LuaValue LuaValue::StringValue(const std::string& stringValue)
+	LuaValue LuaValue::StringValue(const char* stringValue, size_t stringSize, LuaArena& arena)
+	{
+		if (stringSize <= LuaValueInlineStringSize)
+		{
+			return LuaValue::StringValue(stringValue, stringSize);
+		}
+		return LuaValue::ExternalStringValue(arena.CopyString(stringValue, stringSize), stringSize);
+	}
+
+	LuaValue LuaValue::ExternalStringValue(const char* stringValue, size_t stringSize)
 	{
 		LuaValue value;
 		value._type = LuaValueTypeString;
-		value._field.stringValue = new std::string(stringValue);
+		value._storage = LuaValueStorageExternal;
+		value._field.pointerString.data = const_cast<char*>(stringValue);
+		value._field.pointerString.size = stringSize;
 		return value;
 	}
 
-	const LuaValue LuaValue::TableValue(const LuaTable & tableValue)
+	LuaValue LuaValue::TableValue(const LuaTable & tableValue)
 	{
 		LuaValue value;
 		value._type = LuaValueTypeTable;
@@ -60,101 +83,223 @@ namespace LuaCppHelper
 		return value;
 	}
 
-	const LuaValue LuaValue::TableValue(const LuaValueDict & dictValue, const LuaValueArray & arrayValue)
+	LuaValue LuaValue::TableValue(LuaTable && tableValue)
+	{
+		LuaValue value;
+		value._type = LuaValueTypeTable;
+		value._field.tableValue = new LuaTable(std::move(tableValue));
+		return value;
+	}
+
+	LuaValue LuaValue::TableValue(LuaTable && tableValue, LuaArena& arena)
+	{
+		LuaValue value;
+		value._type = LuaValueTypeTable;
+		value._storage = LuaValueStorageArena;
+		value._field.tableValue = new (arena.Allocate(sizeof(LuaTable), alignof(LuaTable))) LuaTable(std::move(tableValue));
+		return value;
+	}
+
+	LuaValue LuaValue::TableValue(const LuaValueDict & dictValue, const LuaValueArray & arrayValue)
 	{
 		LuaValue value;
 		value._type = LuaValueTypeTable;
-		value._field.tableValue = new LuaTable();
-		value._field.tableValue->first = dictValue;
-		value._field.tableValue->second = arrayValue;
+		value._field.tableValue = new LuaTable(dictValue, arrayValue);
 		return value;
 	}
 
-	const LuaValue LuaValue::DictValue(const LuaValueDict& dictValue)
+	LuaValue LuaValue::DictValue(const LuaValueDict& dictValue)
 	{
 		LuaValue value;
 		value._type = LuaValueTypeTable;
-		value._field.tableValue->first = dictValue;
+		value._field.tableValue = new LuaTable(dictValue, LuaValueArray());
 		return value;
 	}
 
-	const LuaValue LuaValue::ArrayValue(const LuaValueArray& arrayValue)
+	LuaValue LuaValue::ArrayValue(const LuaValueArray& arrayValue)
 	{
 		LuaValue value;
 		value._type = LuaValueTypeTable;
-		value._field.tableValue->second = arrayValue;
+		value._field.tableValue = new LuaTable(LuaValueDict(), arrayValue);
+		return value;
+	}
+
+	LuaValue LuaValue::ObjectValue(void * object_value, const char * object_typename)
+	{
+		LuaValue value;
+		value._type = LuaValueTypeObject;
+		new (&value._field.objectValue) LuaObject(object_value, object_typename == nullptr ? "" : object_typename);
 		return value;
 	}
 
-	const LuaValue LuaValue::ObjectValue(void * object_value, const char * object_typename)
+	LuaValue LuaValue::ObjectValue(void * object_value, const std::string & object_typename)
 	{
 		LuaValue value;
 		value._type = LuaValueTypeObject;
-		value._field.objectValue = new LuaObject();
-		value._field.objectValue->first = object_value;
-		value._field.objectValue->second = object_typename == nullptr ? "" : std::string(object_typename);
+		new (&value._field.objectValue) LuaObject(object_value, object_typename);
 		return value;
 	}
 
-	const LuaValue LuaValue::ObjectValue(void * object_value, const std::string & object_typename)
+	LuaValue LuaValue::FunctionValue(const LuaFunction functionValue)
 	{
-		return LuaValue::ObjectValue(object_value, object_typename.c_str());
+		LuaValue value;
+		value._type = LuaValueTypeFunction;
+		value._field.functionValue.func = functionValue;
+		return value;
 	}
 
-	const LuaValue LuaValue::FunctionValue(const LuaFunction functionValue)
+	LuaValue LuaValue::FunctionValue(lua_State* L, const LuaFunction functionValue)
 	{
 		LuaValue value;
 		value._type = LuaValueTypeFunction;
-		value._field.functionValue = functionValue;
+		value._field.functionValue.func = functionValue;
+		lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);		/* L: main */
+		value._field.functionValue.L = lua_tothread(L, -1);
+		lua_pop(L, 1);												/* L: */
+		value._field.functionValue.pool = &LuaFunctionPool::Get(L);
 		return value;
 	}
 
+	const LuaValueDict& LuaValue::DictValue(void) const
+	{
+		static const LuaValueDict empty;
+		return _type == LuaValueTypeTable ? _field.tableValue->DictView() : empty;
+	}
+
+	const LuaValueArray& LuaValue::ArrayValue(void) const
+	{
+		static const LuaValueArray empty;
+		return _type == LuaValueTypeTable ? _field.tableValue->ArrayView() : empty;
+	}
+
 	LuaValue::LuaValue(const LuaValue& rhs)
 	{
 		Copy(rhs);
 	}
 
+	LuaValue::LuaValue(LuaValue&& rhs) noexcept
+	{
+		Move(rhs);
+	}
+
 	LuaValue& LuaValue::operator=(const LuaValue& rhs)
 	{
-		if (this != &rhs) Copy(rhs);
+		if (this != &rhs)
+		{
+			Release();
+			Copy(rhs);
+		}
+		return *this;
+	}
+
+	LuaValue& LuaValue::operator=(LuaValue&& rhs) noexcept
+	{
+		if (this != &rhs)
+		{
+			Release();
+			Move(rhs);
+		}
 		return *this;
 	}
 
-	LuaValue::~LuaValue(void)
+	void LuaValue::Copy(const LuaValue& rhs)
 	{
+		memcpy(&_field, &rhs._field, sizeof(_field));
+		_type = rhs._type;
+		_storage = rhs._storage;
+		// a copy always owns its payload, whoever owned the original
 		if (_type == LuaValueTypeString)
 		{
-			delete _field.stringValue;
-			_field.stringValue = nullptr;
+			if (_storage != LuaValueStorageInline)
+			{
+				SetString(rhs._field.pointerString.data, rhs._field.pointerString.size);
+			}
 		}
 		else if (_type == LuaValueTypeTable)
 		{
-			delete _field.tableValue;
-			_field.tableValue = nullptr;
+			_storage = LuaValueStorageHeap;
+			_field.tableValue = new LuaTable(*rhs._field.tableValue);
 		}
 		else if (_type == LuaValueTypeObject)
 		{
-			delete _field.objectValue;
-			_field.objectValue = nullptr;
+			new (&_field.objectValue) LuaObject(rhs.ObjectValue());
+		}
+		else if (_type == LuaValueTypeFunction && _field.functionValue.pool != nullptr)
+		{
+			_field.functionValue.pool->Retain(_field.functionValue.func);
 		}
 	}
 
-	void LuaValue::Copy(const LuaValue& rhs)
+	void LuaValue::Move(LuaValue& rhs)
 	{
+		// strings and tables only own a pointer, stealing the bits is enough
 		memcpy(&_field, &rhs._field, sizeof(_field));
 		_type = rhs._type;
+		_storage = rhs._storage;
+		if (_type == LuaValueTypeObject)
+		{
+			LuaObject& object = *reinterpret_cast<LuaObject*>(&rhs._field.objectValue);
+			new (&_field.objectValue) LuaObject(std::move(object));
+			object.~LuaObject();
+		}
+		rhs._type = LuaValueTypeNil;
+		rhs._storage = LuaValueStorageInline;
+		memset(&rhs._field, 0, sizeof(rhs._field));
+	}
+
+	void LuaValue::Release(void)
+	{
 		if (_type == LuaValueTypeString)
 		{
-			_field.stringValue = new std::string(*rhs._field.stringValue);
+			if (_storage == LuaValueStorageHeap)
+			{
+				delete[] _field.pointerString.data;
+			}
 		}
 		else if (_type == LuaValueTypeTable)
 		{
-			_field.tableValue = new LuaTable(*rhs._field.tableValue);
+			if (_storage == LuaValueStorageArena)
+			{
+				_field.tableValue->~LuaTable();
+			}
+			else
+			{
+				delete _field.tableValue;
+			}
 		}
 		else if (_type == LuaValueTypeObject)
 		{
-			_field.objectValue = new LuaObject(*rhs._field.objectValue);
+			reinterpret_cast<LuaObject*>(&_field.objectValue)->~LuaObject();
+		}
+		else if (_type == LuaValueTypeFunction)
+		{
+			if (_field.functionValue.pool != nullptr)
+			{
+				_field.functionValue.pool->Release(_field.functionValue.L, _field.functionValue.func);
+			}
+		}
+		_type = LuaValueTypeNil;
+		_storage = LuaValueStorageInline;
+	}
+
+	void LuaValue::SetString(const char* stringValue, size_t stringSize)
+	{
+		char* data = nullptr;
+		if (stringSize <= LuaValueInlineStringSize)
+		{
+			_storage = LuaValueStorageInline;
+			_field.inlineString.size = (unsigned char)stringSize;
+			data = _field.inlineString.data;
+		}
+		else
+		{
+			_storage = LuaValueStorageHeap;
+			_field.pointerString.size = stringSize;
+			_field.pointerString.data = new char[stringSize + 1];
+			data = _field.pointerString.data;
 		}
+		memcpy(data, stringValue, stringSize);
+		data[stringSize] = '\0';
 	}
 
 }
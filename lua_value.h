@@ -2,9 +2,12 @@
 
 #pragma once
 
+#include <cstring>
 #include <list>
 #include <map>
 #include <string>
+#include <string_view>
+#include <type_traits>
 extern "C" {
 #include "lua.h"
 }
@@ -15,12 +18,14 @@ namespace LuaCppHelper
 	typedef int LuaFunction;
 
 	class LuaValue;
+	class LuaFunctionPool;
+	class LuaTable;
+	class LuaArena;
 
 	typedef std::map<std::string, LuaValue>			LuaValueDict;
 	typedef LuaValueDict::const_iterator			LuaValueDictIterator;
 	typedef std::map<long long, LuaValue>			LuaValueArray;
 	typedef LuaValueArray::const_iterator			LuaValueArrayIterator;
-	typedef std::pair<LuaValueDict, LuaValueArray>	LuaTable;
 	typedef std::pair<void *, std::string>			LuaObject;
 
 	/// @cond
@@ -37,14 +42,34 @@ namespace LuaCppHelper
 	/// @endcond
 
 	/// @cond
+	// strings up to this length are kept inside LuaValue instead of on the heap
+	static const size_t LuaValueInlineStringSize = sizeof(LuaObject) - 2;
+
+	typedef struct {
+		char*				data;
+		size_t				size;
+	} LuaValuePointerString;
+
+	typedef struct {
+		char				data[LuaValueInlineStringSize + 1];
+		unsigned char		size;
+	} LuaValueInlineString;
+
+	typedef struct {
+		LuaFunction			func;
+		lua_State*			L;		// the main thread
+		LuaFunctionPool*	pool;	// nullptr if the ref isn't owned
+	} LuaValueFunction;
+
 	typedef union {
 		long long           intValue;
 		double              numberValue;
 		bool                booleanValue;
-		std::string*        stringValue;
+		LuaValuePointerString pointerString;
+		LuaValueInlineString inlineString;
 		LuaTable*			tableValue;
-		LuaObject*			objectValue;
-		LuaFunction			functionValue;
+		std::aligned_storage<sizeof(LuaObject), alignof(LuaObject)>::type objectValue;
+		LuaValueFunction	functionValue;
 	} LuaValueField;
 	/// @endcond
 
@@ -62,7 +87,7 @@ namespace LuaCppHelper
 		*
 		* @return a LuaValue object.
 		*/
-		static const LuaValue NilValue();
+		static LuaValue NilValue();
 
 		/**
 		* Construct a LuaValue object by a long long value.
@@ -70,7 +95,7 @@ namespace LuaCppHelper
 		* @param intValue a int value.
 		* @return a LuaValue object.
 		*/
-		static const LuaValue IntValue(const long long intValue);
+		static LuaValue IntValue(const long long intValue);
 
 		/**
 		* Construct a LuaValue object by a double value.
@@ -78,7 +103,7 @@ namespace LuaCppHelper
 		* @param floatValue a float value.
 		* @return a LuaValue object.
 		*/
-		static const LuaValue NumberValue(const double floatValue);
+		static LuaValue NumberValue(const double floatValue);
 
 		/**
 		* Construct a LuaValue object by a boolean value.
@@ -86,7 +111,7 @@ namespace LuaCppHelper
 		* @param booleanValue a bool value.
 		* @return a LuaValue object.
 		*/
-		static const LuaValue BooleanValue(const bool booleanValue);
+		static LuaValue BooleanValue(const bool booleanValue);
 
 		/**
 		* Construct a LuaValue object by a string pointer.
@@ -94,7 +119,7 @@ namespace LuaCppHelper
 		* @param stringValue a string pointer.
 		* @return a LuaValue object.
 		*/
-		static const LuaValue StringValue(const char* stringValue);
+		static LuaValue StringValue(const char* stringValue);
 
 		/**
 		* Construct a LuaValue object by a std::string object.
@@ -102,7 +127,36 @@ namespace LuaCppHelper
 		* @param stringValue a std::string object.
 		* @return a LuaValue object.
 		*/
-		static const LuaValue StringValue(const std::string& stringValue);
+		static LuaValue StringValue(const std::string& stringValue);
+
+		/**
+		* Construct a LuaValue object by a buffer and its length, the buffer may contain '\0'.
+		*
+		* @param stringValue a pointer to the first character.
+		* @param stringSize the count of characters.
+		* @return a LuaValue object.
+		*/
+		static LuaValue StringValue(const char* stringValue, size_t stringSize);
+
+		/**
+		* Construct a LuaValue object by a buffer, long strings are copied into the arena.
+		*
+		* @param stringValue a pointer to the first character.
+		* @param stringSize the count of characters.
+		* @param arena the arena which must outlive the LuaValue object.
+		* @return a LuaValue object.
+		*/
+		static LuaValue StringValue(const char* stringValue, size_t stringSize, LuaArena& arena);
+
+		/**
+		* Construct a LuaValue object referring to a buffer owned by someone else, nothing is copied.
+		* The buffer must outlive the LuaValue object, copies of the LuaValue object own their characters.
+		*
+		* @param stringValue a pointer to the first character.
+		* @param stringSize the count of characters.
+		* @return a LuaValue object.
+		*/
+		static LuaValue ExternalStringValue(const char* stringValue, size_t stringSize);
 
 		/**
 		* Construct a LuaValue object by a LuaValueDict value and a LuaValueArray value.
@@ -110,7 +164,24 @@ namespace LuaCppHelper
 		* @param tableValue a LuaTable object.
 		* @return a LuaValue object.
 		*/
-		static const LuaValue TableValue(const LuaTable& tableValue);
+		static LuaValue TableValue(const LuaTable& tableValue);
+
+		/**
+		* Construct a LuaValue object by taking over a LuaTable value.
+		*
+		* @param tableValue a LuaTable object, it is left empty.
+		* @return a LuaValue object.
+		*/
+		static LuaValue TableValue(LuaTable&& tableValue);
+
+		/**
+		* Construct a LuaValue object by taking over a LuaTable value, the table is placed in the arena.
+		*
+		* @param tableValue a LuaTable object, it is left empty.
+		* @param arena the arena which must outlive the LuaValue object.
+		* @return a LuaValue object.
+		*/
+		static LuaValue TableValue(LuaTable&& tableValue, LuaArena& arena);
 
 		/**
 		* Construct a LuaValue object by a LuaValueDict value and a LuaValueArray value.
@@ -119,7 +190,7 @@ namespace LuaCppHelper
 		* @param arrayValue a LuaValueArray object.
 		* @return a LuaValue object.
 		*/
-		static const LuaValue TableValue(const LuaValueDict& dictValue, const LuaValueArray& arrayValue);
+		static LuaValue TableValue(const LuaValueDict& dictValue, const LuaValueArray& arrayValue);
 
 		/**
 		* Construct a LuaValue object by a LuaValueDict value.
@@ -127,7 +198,7 @@ namespace LuaCppHelper
 		* @param dictValue a LuaValueDict object.
 		* @return a LuaValue object.
 		*/
-		static const LuaValue DictValue(const LuaValueDict& dictValue);
+		static LuaValue DictValue(const LuaValueDict& dictValue);
 
 		/**
 		* Construct a LuaValue object by a LuaValueArray value.
@@ -135,7 +206,7 @@ namespace LuaCppHelper
 		* @param arrayValue a LuaValueArray object.
 		* @return a LuaValue object.
 		*/
-		static const LuaValue ArrayValue(const LuaValueArray& arrayValue);
+		static LuaValue ArrayValue(const LuaValueArray& arrayValue);
 
 		/**
 		* Construct a LuaValue object by a pointer.
@@ -144,7 +215,7 @@ namespace LuaCppHelper
 		* @param object_typename a string pointer point to the typename of object.
 		* @return a LuaValue object.
 		*/
-		static const LuaValue ObjectValue(void* object_value, const char* object_typename);
+		static LuaValue ObjectValue(void* object_value, const char* object_typename);
 
 		/**
 		* Construct a LuaValue object by a pointer.
@@ -153,15 +224,24 @@ namespace LuaCppHelper
 		* @param object_typename a std::string object represent the typename of object.
 		* @return a LuaValue object.
 		*/
-		static const LuaValue ObjectValue(void* object_value, const std::string& object_typename);
+		static LuaValue ObjectValue(void* object_value, const std::string& object_typename);
 
 		/**
-		* Construct a LuaValue object by a LuaFunction value.
+		* Construct a LuaValue object by a LuaFunction value, the ref isn't owned by the value.
 		*
 		* @param functionValue a LuaFunction value.
 		* @return a LuaValue object.
 		*/
-		static const LuaValue FunctionValue(const LuaFunction functionValue);
+		static LuaValue FunctionValue(const LuaFunction functionValue);
+
+		/**
+		* Construct a LuaValue object owning one reference of a ref of the LuaFunctionPool of L:
+		* copies retain it, the last one releases it. The lua_State must outlive the value.
+		*
+		* @param functionValue a ref returned by LuaFunctionPool::Acquire.
+		* @return a LuaValue object.
+		*/
+		static LuaValue FunctionValue(lua_State* L, const LuaFunction functionValue);
 
 
 		/**
@@ -170,6 +250,7 @@ namespace LuaCppHelper
 		*/
 		LuaValue(void)
 			: _type(LuaValueTypeNil)
+			, _storage(LuaValueStorageInline)
 		{
 			memset(&_field, 0, sizeof(_field));
 		}
@@ -179,15 +260,31 @@ namespace LuaCppHelper
 		*/
 		LuaValue(const LuaValue& rhs);
 
+		/**
+		* Move constructor, rhs is left as a nil value.
+		*/
+		LuaValue(LuaValue&& rhs) noexcept;
+
 		/**
 		* Override of operator= .
 		*/
 		LuaValue& operator=(const LuaValue& rhs);
 
 		/**
-		* Destructor.
+		* Override of move operator= , rhs is left as a nil value.
 		*/
-		~LuaValue(void);
+		LuaValue& operator=(LuaValue&& rhs) noexcept;
+
+		/**
+		* Destructor, only heap strings, tables, objects and owned functions have something to release.
+		*/
+		~LuaValue(void) {
+			if ((_type == LuaValueTypeString && _storage == LuaValueStorageHeap) || _type == LuaValueTypeTable || _type == LuaValueTypeObject
+				|| (_type == LuaValueTypeFunction && _field.functionValue.pool != nullptr))
+			{
+				Release();
+			}
+		}
 
 		/**
 		* Get the type of LuaValue object.
@@ -235,12 +332,31 @@ namespace LuaCppHelper
 		}
 
 		/**
-		* Get the boolean value of LuaValue object.
+		* Get the string value of LuaValue object, short strings are stored inside the value.
 		*
-		* @return the reference about string value.
+		* @return a view valid as long as the LuaValue object is not modified,
+		*	callers keeping the string past that construct a std::string from it explicitly.
 		*/
-		const std::string& StringValue(void) const {
-			return *_field.stringValue;
+		std::string_view StringValue(void) const {
+			return std::string_view(StringData(), StringSize());
+		}
+
+		/**
+		* Get the characters of the string value, terminated by '\0' unless built by ExternalStringValue.
+		*
+		* @return the pointer to the first character.
+		*/
+		const char* StringData(void) const {
+			return _storage == LuaValueStorageInline ? _field.inlineString.data : _field.pointerString.data;
+		}
+
+		/**
+		* Get the length of the string value.
+		*
+		* @return the count of characters.
+		*/
+		size_t StringSize(void) const {
+			return _storage == LuaValueStorageInline ? _field.inlineString.size : _field.pointerString.size;
 		}
 
 		/**
@@ -258,26 +374,22 @@ namespace LuaCppHelper
 		* @return the LuaTable value.
 		*/
 		const LuaObject& ObjectValue(void) const {
-			return *_field.objectValue;
+			return *reinterpret_cast<const LuaObject*>(&_field.objectValue);
 		}
 
 		/**
-		* Get the LuaValueDict value of LuaValue object.
+		* Get the string keyed part of the LuaTable value of LuaValue object.
 		*
-		* @return the LuaValueDict value.
+		* @return a LuaValueDict built from the table on first use, empty if the value isn't a table.
 		*/
-		const LuaValueDict& DictValue(void) const {
-			return _field.tableValue->first;
-		}
+		const LuaValueDict& DictValue(void) const;
 
 		/**
-		* Get the LuaValueArray value of LuaValue object.
+		* Get the integer keyed part of the LuaTable value of LuaValue object.
 		*
-		* @return the LuaValueArray value.
+		* @return a LuaValueArray built from the table on first use, empty if the value isn't a table.
 		*/
-		const LuaValueArray& ArrayValue(void) const {
-			return _field.tableValue->second;
-		}
+		const LuaValueArray& ArrayValue(void) const;
 
 		/**
 		* Get the LuaFunction value of LuaValue object.
@@ -285,7 +397,7 @@ namespace LuaCppHelper
 		* @return the LuaFunction value.
 		*/
 		const LuaFunction& FunctionValue(void) const {
-			return _field.functionValue;
+			return _field.functionValue.func;
 		}
 
 		/**
@@ -298,11 +410,24 @@ namespace LuaCppHelper
 		//}
 
 	private:
+		/// @cond
+		typedef enum {
+			LuaValueStorageInline,
+			LuaValueStorageHeap,
+			LuaValueStorageExternal,	// not owned, nothing to release
+			LuaValueStorageArena		// placed in a LuaArena, destroyed but not freed
+		} LuaValueStorage;
+		/// @endcond
+
 		LuaValueField _field;
 		LuaValueType  _type;
+		unsigned char _storage;
 		//	std::string*    _ccobjectType;
 
 		void Copy(const LuaValue& rhs);
+		void Move(LuaValue& rhs);
+		void Release(void);
+		void SetString(const char* stringValue, size_t stringSize);
 	};
 
 }